@@ -9,12 +9,14 @@
 #include <Adafruit_NeoPixel.h>
 #include <BlinkMarinePkpCanOpen.h>
 #include <CANSAME5x.h>
+#include <PkpRxRing.h>
 
 //Prototype for hardware specific callback function
 uint8_t transmittMessageCallBack(const struct can_frame& txMsg);
 
 CANSAME5x         can;
 Pkp               keypad(KEYPAD_BASE_ID, transmittMessageCallBack);
+PkpRxRing         rxRing;
 Adafruit_NeoPixel pixel(1, 8, NEO_GRB + NEO_KHZ800);
 
 void setup() {
@@ -90,6 +92,8 @@ void setup() {
     keypad.initializeEncoder(0, 16, 5);
     keypad.initializeEncoder(1, 16, 10);
 
+    // received frames are decoded in loop() instead of the receive interrupt
+    keypad.attachRxRing(&rxRing);
     keypad.begin();
 }
 
@@ -100,11 +104,14 @@ void loop() {
     static uint32_t lastIncrement = 0;
     uint32_t        currentMillis = millis();
 
+    // decode the frames received since the last iteration
+    keypad.poll();
+
     if (keypad.getKeyState(Pkp::KEY_1) == 1) {
         // do stuff
     }
 
-    // if key 9 is release, blink for two seconds and turn off afterwards
+    // if key 9 is switched off, blink for two seconds and turn off afterwards
     uint8_t key9State = keypad.getKeyState(Pkp::KEY_9);
     if (key9State == 0 && lastKey9State == 1) {
         key9OnTime = currentMillis;
@@ -157,5 +164,5 @@ void onReceive(int packetSize) {
         }
         rxMsg.data[i] = (char)can.read();
     }
-    keypad.process(rxMsg);
+    rxRing.push(rxMsg);
 }
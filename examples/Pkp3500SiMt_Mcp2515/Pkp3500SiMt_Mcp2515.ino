@@ -5,6 +5,7 @@
 
 #include <Adafruit_MCP2515.h>
 #include <BlinkMarinePkpCanOpen.h>
+#include <PkpRxRing.h>
 
 //Prototype for hardware specific callback function
 uint8_t transmittMessageCallBack(const struct can_frame& txMsg);
@@ -17,6 +18,7 @@ uint8_t transmittMessageCallBack(const struct can_frame& txMsg);
 
 Adafruit_MCP2515 can(MCP_CS_PIN);
 Pkp              keypad(KEYPAD_BASE_ID, transmittMessageCallBack);
+PkpRxRing        rxRing;
 
 void setup() {
 
@@ -91,6 +93,8 @@ void setup() {
     keypad.initializeEncoder(0, 16, 5);
     keypad.initializeEncoder(1, 16, 10);
 
+    // received frames are decoded in loop() instead of the receive interrupt
+    keypad.attachRxRing(&rxRing);
     keypad.begin();
 }
 
@@ -101,11 +105,14 @@ void loop() {
     static uint32_t lastIncrement = 0;
     uint32_t        currentMillis = millis();
 
+    // decode the frames received since the last iteration
+    keypad.poll();
+
     if (keypad.getKeyState(Pkp::KEY_1) == 1) {
         // do stuff
     }
 
-    // if key 9 is release, blink for two seconds and turn off afterwards
+    // if key 9 is switched off, blink for two seconds and turn off afterwards
     uint8_t key9State = keypad.getKeyState(Pkp::KEY_9);
     if (key9State == 0 && lastKey9State == 1) {
         key9OnTime = currentMillis;
@@ -155,5 +162,5 @@ void onReceive(int packetSize) {
         }
         rxMsg.data[i] = (char)can.read();
     }
-    keypad.process(rxMsg);
+    rxRing.push(rxMsg);
 }
@@ -0,0 +1,209 @@
+/**
+ * @brief   Host micro-benchmark for the Pkp receive path
+ * @author  Stefan Hirschenberger
+ *
+ * Replays synthetic key, encoder, wired-input, heartbeat and foreign frames through Pkp::process()
+ * and reports the time per frame, the number of transmitted frames per received frame and the
+ * number of heap allocations. A second run compares calling process() on every keypad of a
+ * multi-keypad bus against routing the frames through PkpBus. If built with PKP_STATS, the timings of
+ * Pkp::getStats() are reported per scenario as well.
+ *
+ * Usage: pkp_benchmark [iterations]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <BlinkMarinePkpCanOpen.h>
+#include <PkpBus.h>
+
+static constexpr uint8_t KEYPAD_ID = 0x15;
+
+static uint32_t txFrameCount = 0;
+static uint32_t txChecksum   = 0;
+static uint32_t allocCount   = 0;
+
+void* operator new(size_t size) {
+    allocCount++;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+uint8_t countingTxCallback(const struct can_frame& txMsg) {
+    txFrameCount++;
+    txChecksum += txMsg.can_id;
+    for (int i = 0; i < txMsg.can_dlc; i++) {
+        txChecksum += txMsg.data[i];
+    }
+    return 0;
+}
+
+typedef void (*FrameGenerator)(struct can_frame& frame, uint32_t n);
+
+// Alternating press/release of varying keys, every PDO changes at least one key
+void keyFrame(struct can_frame& frame, uint32_t n) {
+    frame.can_id  = 0x180 + KEYPAD_ID;
+    frame.can_dlc = 8;
+    uint16_t keys = (n & 1) ? (1 << (n % 15)) : 0;
+    frame.data[0] = keys & 0xFF;
+    frame.data[1] = keys >> 8;
+}
+
+// Periodic key PDO without any change (all released)
+void keyIdleFrame(struct can_frame& frame, uint32_t n) {
+    (void)n;
+    frame.can_id  = 0x180 + KEYPAD_ID;
+    frame.can_dlc = 8;
+}
+
+void encoderFrame(struct can_frame& frame, uint32_t n) {
+    frame.can_id  = ((n & 1) ? 0x380 : 0x280) + KEYPAD_ID;
+    frame.can_dlc = 8;
+    frame.data[0] = (n & 2) ? 0x81 : 0x01;
+    frame.data[1] = n & 0x0F;
+}
+
+void wiredInputFrame(struct can_frame& frame, uint32_t n) {
+    frame.can_id  = 0x480 + KEYPAD_ID;
+    frame.can_dlc = 8;
+    for (int i = 0; i < 4; i++) {
+        uint16_t value        = (n * 7 + i * 125) % 600;
+        frame.data[i * 2]     = value & 0xFF;
+        frame.data[i * 2 + 1] = value >> 8;
+    }
+}
+
+void heartbeatFrame(struct can_frame& frame, uint32_t n) {
+    (void)n;
+    frame.can_id  = 0x700 + KEYPAD_ID;
+    frame.can_dlc = 1;
+    frame.data[0] = 0x05;
+}
+
+void foreignFrame(struct can_frame& frame, uint32_t n) {
+    frame.can_id  = 0x100 + (n % 0x80);
+    frame.can_dlc = 8;
+}
+
+void mixedFrame(struct can_frame& frame, uint32_t n) {
+    static const FrameGenerator generators[] = {keyFrame, encoderFrame, wiredInputFrame, heartbeatFrame, foreignFrame, keyIdleFrame};
+    generators[n % 6](frame, n / 6);
+}
+
+struct Scenario {
+    const char*    name;
+    FrameGenerator generator;
+};
+
+static void setupKeypad(Pkp& keypad) {
+    const uint8_t colors[4] = {Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_GREEN, Pkp::KEY_COLOR_AMBER, Pkp::KEY_COLOR_RED};
+    const uint8_t blinks[4] = {Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_GREEN, Pkp::KEY_COLOR_BLANK};
+    for (uint8_t i = 0; i < PKP_MAX_KEY_AMOUNT; i++) {
+        keypad.setKeyColor(i, colors, blinks);
+        keypad.setKeyMode(i, i % 4);
+    }
+    keypad.begin();
+}
+
+int main(int argc, char** argv) {
+    uint32_t iterations = 200000;
+    if (argc > 1) {
+        iterations = (uint32_t)strtoul(argv[1], nullptr, 0);
+    }
+
+    const Scenario scenarios[] = {
+        {"key change",  keyFrame       },
+        {"key idle",    keyIdleFrame   },
+        {"encoder",     encoderFrame   },
+        {"wired input", wiredInputFrame},
+        {"heartbeat",   heartbeatFrame },
+        {"foreign",     foreignFrame   },
+        {"mixed",       mixedFrame     },
+    };
+
+    printf("Pkp::process() benchmark, %u frames per scenario, sizeof(Pkp) = %u bytes\n", iterations, (unsigned)sizeof(Pkp));
+    printf("%-12s %12s %12s %12s\n", "scenario", "ns/frame", "tx/rx", "allocations");
+
+    for (const Scenario& scenario : scenarios) {
+        Pkp keypad(KEYPAD_ID, countingTxCallback);
+        setupKeypad(keypad);
+
+        struct can_frame frame;
+        txFrameCount     = 0;
+        allocCount       = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t n = 0; n < iterations; n++) {
+            frame = can_frame();
+            scenario.generator(frame, n);
+            keypad.process(frame);
+        }
+        const auto   stop = std::chrono::steady_clock::now();
+        const double ns   = std::chrono::duration<double, std::nano>(stop - start).count();
+
+        printf("%-12s %12.1f %12.3f %12u\n", scenario.name, ns / iterations, (double)txFrameCount / iterations, allocCount);
+#if PKP_STATS
+        // Includes the begin() of the keypad, so the update timings show up in every scenario
+        Pkp::stats_t stats;
+        keypad.getStats(stats);
+        printf("%-12s process max %u us, update max %u us, process histogram", "", stats.processTime.max, stats.updateTime.max);
+        for (uint8_t bin = 0; bin < Pkp::TIMING_BINS; bin++) {
+            printf(" %u", stats.processTime.histogram[bin]);
+        }
+        printf("\n");
+#endif
+    }
+
+    printf("\nMulti-keypad dispatch, mixed frames spread over all nodes\n");
+    printf("%-12s %12s %12s\n", "keypads", "per node", "PkpBus");
+
+    const uint8_t nodeCounts[] = {1, 4, 8};
+    for (uint8_t nodeCount : nodeCounts) {
+        Pkp*   keypads[PKP_BUS_MAX_NODES];
+        PkpBus bus;
+        for (uint8_t i = 0; i < nodeCount; i++) {
+            keypads[i] = new Pkp(KEYPAD_ID + i, countingTxCallback);
+            setupKeypad(*keypads[i]);
+            bus.attach(*keypads[i]);
+        }
+
+        double nsPerFrame[2];
+        for (int useBus = 0; useBus < 2; useBus++) {
+            struct can_frame frame;
+            const auto       start = std::chrono::steady_clock::now();
+            for (uint32_t n = 0; n < iterations; n++) {
+                frame = can_frame();
+                mixedFrame(frame, n);
+                frame.can_id += (n % nodeCount) * ((frame.can_id & 0x7F) == KEYPAD_ID);
+                if (useBus) {
+                    bus.process(frame);
+                    continue;
+                }
+                for (uint8_t i = 0; i < nodeCount; i++) {
+                    keypads[i]->process(frame);
+                }
+            }
+            nsPerFrame[useBus] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+        }
+        printf("%-12u %12.1f %12.1f\n", nodeCount, nsPerFrame[0], nsPerFrame[1]);
+
+        for (uint8_t i = 0; i < nodeCount; i++) {
+            delete keypads[i];
+        }
+    }
+
+    printf("checksum %08x\n", txChecksum);
+    return 0;
+}
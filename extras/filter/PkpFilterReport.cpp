@@ -0,0 +1,136 @@
+/**
+ * @brief   Acceptance filter register report
+ * @author  Stefan Hirschenberger
+ *
+ * Prints the MCP2515 mask/filter registers and the SAME5x standard message ID filter elements
+ * computed by PkpFilter for the given keypad node IDs, with the number of standard identifiers
+ * the hardware lets through. With a candump log (candump -l or PkpRecorder format) of the bus,
+ * the logged frames are run through both filters to show how much foreign traffic still
+ * reaches the MCU and how much is dropped by the hardware.
+ *
+ * Usage: pkp_filter [--log <candump log>] [--elements <SAME5x filter elements>] <node id>...
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#include <PkpFilter.h>
+
+static constexpr uint8_t DEFAULT_SAME5X_ELEMENTS = 8;
+static constexpr uint8_t MAX_SAME5X_ELEMENTS     = 128;
+
+struct Traffic {
+    uint32_t frames;  // frames in the log
+    uint32_t keypad;  // frames sent by the keypads
+    uint32_t mcp2515; // frames passing the MCP2515 filters
+    uint32_t same5x;  // frames passing the SAME5x filter elements
+};
+
+static bool isKeypadFrame(const uint16_t ids[], uint8_t count, uint16_t canId) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (ids[i] == canId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool analyzeLog(const char* path, const PkpFilter::mcp2515Filters_t& mcp2515, const uint32_t elements[], uint8_t elementCount,
+                       const uint16_t ids[], uint8_t idCount, Traffic& traffic) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        unsigned long seconds;
+        unsigned long microseconds;
+        char          interface[32];
+        char          frameText[64];
+        if (sscanf(line, " (%lu.%lu) %31s %63s", &seconds, &microseconds, interface, frameText) != 4 || strchr(frameText, '#') == nullptr) {
+            continue;
+        }
+        unsigned long canId = strtoul(frameText, nullptr, 16);
+        if (canId > 0x7FF) {
+            continue;
+        }
+        traffic.frames++;
+        traffic.keypad  += isKeypadFrame(ids, idCount, canId);
+        traffic.mcp2515 += PkpFilter::accepts(mcp2515, canId);
+        traffic.same5x  += PkpFilter::acceptsSame5x(elements, elementCount, canId);
+    }
+    fclose(file);
+    return true;
+}
+
+static void printShare(const char* label, uint32_t passed, const Traffic& traffic) {
+    uint32_t foreign = traffic.frames - traffic.keypad;
+    printf("%-8s %u of %u frames reach the MCU, %u of %u foreign frames (%.1f %%) pass as false positives\n", label, passed, traffic.frames,
+           passed - traffic.keypad, foreign, foreign ? 100.0 * (passed - traffic.keypad) / foreign : 0.0);
+}
+
+int main(int argc, char** argv) {
+    const char* logPath  = nullptr;
+    unsigned    elements = DEFAULT_SAME5X_ELEMENTS;
+    PkpFilter   filter;
+    uint16_t    ids[PkpFilter::MAX_IDS];
+    uint8_t     idCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            logPath = argv[++i];
+        } else if (strcmp(argv[i], "--elements") == 0 && i + 1 < argc) {
+            elements = strtoul(argv[++i], nullptr, 0);
+        } else {
+            unsigned long nodeId = strtoul(argv[i], nullptr, 0);
+            if (nodeId > 127 || !filter.addNode((uint8_t)nodeId)) {
+                printf("Invalid node id %s\n", argv[i]);
+                return 2;
+            }
+            for (uint16_t base : {0x180, 0x280, 0x380, 0x480, 0x580, 0x700}) {
+                if (!isKeypadFrame(ids, idCount, base + nodeId)) {
+                    ids[idCount++] = base + nodeId;
+                }
+            }
+        }
+    }
+    if (filter.getIdCount() == 0 || elements == 0 || elements > MAX_SAME5X_ELEMENTS) {
+        printf("Usage: %s [--log <candump log>] [--elements <SAME5x filter elements>] <node id>...\n", argv[0]);
+        return 2;
+    }
+
+    PkpFilter::mcp2515Filters_t mcp2515;
+    filter.getMcp2515Filters(mcp2515);
+    printf("%u COB-IDs to receive\n\nMCP2515\n", filter.getIdCount());
+    for (uint8_t buffer = 0; buffer < 2; buffer++) {
+        printf("  RXM%u 0x%03X ", buffer, mcp2515.mask[buffer]);
+        for (uint8_t i = buffer ? 2 : 0; i < (buffer ? 6 : 2); i++) {
+            printf(" RXF%u 0x%03X", i, mcp2515.filter[i]);
+        }
+        printf("\n");
+    }
+    printf("  %u standard identifiers accepted\n\nSAME5x\n", mcp2515.acceptedIds);
+
+    uint32_t same5x[MAX_SAME5X_ELEMENTS];
+    uint16_t same5xAccepted;
+    uint8_t  same5xCount = filter.getSame5xFilters(same5x, elements, same5xAccepted);
+    for (uint8_t i = 0; i < same5xCount; i++) {
+        printf("  S%-3u 0x%08X\n", i, same5x[i]);
+    }
+    printf("  %u of %u elements used, %u standard identifiers accepted\n", same5xCount, elements, same5xAccepted);
+
+    if (logPath != nullptr) {
+        Traffic traffic = {};
+        if (!analyzeLog(logPath, mcp2515, same5x, same5xCount, ids, idCount, traffic)) {
+            printf("Cannot read %s\n", logPath);
+            return 2;
+        }
+        printf("\n%s: %u frames, %u sent by the keypads\n", logPath, traffic.frames, traffic.keypad);
+        printShare("MCP2515", traffic.mcp2515, traffic);
+        printShare("SAME5x", traffic.same5x, traffic);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <thread>
+
+static bool     useVirtualClock = false;
+static uint64_t virtualMicros   = 0;
+
+static std::chrono::steady_clock::time_point startTime() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return start;
+}
+
+uint64_t hostGetClock() {
+    if (useVirtualClock) {
+        return virtualMicros;
+    }
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime()).count();
+}
+
+void hostAdvanceClock(uint32_t us) {
+    if (useVirtualClock) {
+        virtualMicros += us;
+    }
+}
+
+void hostUseVirtualClock(bool enable) {
+    //Continue from the current time, so millis() and micros() never jump backwards
+    virtualMicros   = hostGetClock();
+    useVirtualClock = enable;
+}
+
+uint32_t millis() {
+    return (uint32_t)(hostGetClock() / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t)hostGetClock();
+}
+
+void delay(uint32_t ms) {
+    if (useVirtualClock) {
+        virtualMicros += (uint64_t)ms * 1000;
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
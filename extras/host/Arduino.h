@@ -0,0 +1,71 @@
+/*
+ * Minimal Arduino core shim for building the PKP library on a host (Linux/macOS).
+ *
+ * Only the subset of the Arduino API used by the library is provided. Timing is
+ * based on std::chrono::steady_clock and starts at zero with the first call. Host
+ * tools can switch to a virtual clock, which only advances through hostAdvanceClock()
+ * and delay(), to run the library deterministically and faster than real time.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_HOST_ARDUINO_SHIM
+#define BLINK_MARINE_HOST_ARDUINO_SHIM
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+
+//Host only: virtual clock control, hostAdvanceClock() has no effect while the steady clock is used
+void     hostAdvanceClock(uint32_t us);
+uint64_t hostGetClock();
+void     hostUseVirtualClock(bool enable);
+
+//Subset of the Arduino Print class, derived classes only have to implement write(uint8_t)
+class Print {
+  public:
+    virtual size_t write(uint8_t value) = 0;
+
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t written = 0;
+        while (written < size && write(buffer[written]) == 1) {
+            written++;
+        }
+        return written;
+    }
+};
+
+//Host builds have no interrupts, PkpRxRing relies on atomics instead
+inline void noInterrupts() {
+}
+
+inline void interrupts() {
+}
+
+//Template replacements for the Arduino min/max/constrain macros, the arguments are compared in their common type like
+//the usual arithmetic conversions of the macros do, without sign-compare warnings
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b) {
+    typedef typename std::common_type<A, B>::type C;
+    return ((C)b < (C)a) ? (C)b : (C)a;
+}
+
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b) {
+    typedef typename std::common_type<A, B>::type C;
+    return ((C)a < (C)b) ? (C)b : (C)a;
+}
+
+template <typename T, typename L, typename H>
+inline typename std::common_type<T, L, H>::type constrain(T amt, L low, H high) {
+    typedef typename std::common_type<T, L, H>::type C;
+    return (C)amt < (C)low ? (C)low : ((C)amt > (C)high ? (C)high : (C)amt);
+}
+
+#endif // BLINK_MARINE_HOST_ARDUINO_SHIM
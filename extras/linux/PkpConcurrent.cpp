@@ -0,0 +1,370 @@
+#include "PkpConcurrent.h"
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs a thread-safe facade for a keypad and publishes its current input state.
+ *
+ * From now on, the keypad must only be accessed by the thread calling service(), which is usually the thread
+ * receiving the CAN frames.
+ *
+ * @param keypad The keypad to serve. It must outlive the facade.
+ */
+template <typename Model>
+PkpConcurrentKeypad<Model>::PkpConcurrentKeypad(PkpKeypad<Model>& keypad) : _keypad(keypad) {
+    for (uint32_t i = 0; i < PKP_CONCURRENT_QUEUE_SIZE; i++) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < PKP_CONCURRENT_EVENT_QUEUE_SIZE; i++) {
+        _eventCells[i].sequence.store(0, std::memory_order_relaxed);
+    }
+    _keypad.takeInputSnapshot(_published);
+    _publish(_published);
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Posts Pkp::applyDefaultKeyStates(). May be called from any thread.
+ *
+ * @return True if the command was queued, false if the queue is full.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::applyDefaultKeyStates() {
+    command_t command = {};
+    command.type      = CT_APPLY_DEFAULT_KEY_STATES;
+    return _post(command);
+}
+
+/**
+ * @brief Forwards the input events queued by the keypad to the readers of nextEvent().
+ *
+ * Must only be called by the thread owning the keypad. service() calls it as well, PkpSocketCan calls it after every
+ * received frame, so the event queue of the keypad (PKP_EVENT_QUEUE_SIZE) does not overflow within a batch. No
+ * events are queued by the keypad while an event callback is registered with Pkp::setEventCallback().
+ */
+template <typename Model>
+void PkpConcurrentKeypad<Model>::collectEvents() {
+    PkpBase::event_t event;
+    while (_keypad.nextEvent(event)) {
+        uint32_t words[2];
+        memcpy(words, &event, sizeof(words));
+
+        // Single writer, a reader seeing an odd or newer sequence knows the cell is being overwritten
+        uint32_t     position = _eventPosition.load(std::memory_order_relaxed);
+        eventCell_t& cell     = _eventCells[position & (PKP_CONCURRENT_EVENT_QUEUE_SIZE - 1)];
+        cell.sequence.store(2 * position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        cell.words[0].store(words[0], std::memory_order_relaxed);
+        cell.words[1].store(words[1], std::memory_order_relaxed);
+        cell.sequence.store(2 * position + 2, std::memory_order_release);
+        _eventPosition.store(position + 1, std::memory_order_release);
+    }
+}
+
+/**
+ * @brief Returns the position of the next event to be forwarded. May be called from any thread.
+ *
+ * @return The position a new reader starts nextEvent() with to receive the events from now on.
+ */
+template <typename Model>
+uint32_t PkpConcurrentKeypad<Model>::getEventPosition() {
+    return _eventPosition.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Returns the number of the last published snapshot. May be called from any thread.
+ *
+ * @return The publication number, incremented whenever the input state changed.
+ */
+template <typename Model>
+uint32_t PkpConcurrentKeypad<Model>::getPublication() {
+    return _sequence.load(std::memory_order_acquire) / 2;
+}
+
+/**
+ * @brief Copies the last published input state. May be called from any thread, never blocks the CAN thread.
+ *
+ * The copy is retried if the CAN thread published a new state meanwhile, so the snapshot is always consistent.
+ * relativeEncoderTicks holds the ticks since the previous publication, readers that may miss publications should
+ * use the difference of encoderCount between their snapshots instead.
+ *
+ * @param snapshot Receives the input state.
+ * @return The publication number of the snapshot, see getPublication().
+ */
+template <typename Model>
+uint32_t PkpConcurrentKeypad<Model>::getSnapshot(PkpBase::inputSnapshot_t& snapshot) {
+    uint32_t words[SNAPSHOT_WORDS];
+    for (;;) {
+        uint32_t sequence = _sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            // The CAN thread is writing, which takes a few stores only
+            continue;
+        }
+        for (uint8_t i = 0; i < SNAPSHOT_WORDS; i++) {
+            words[i] = _words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) == sequence) {
+            memcpy(&snapshot, words, sizeof(snapshot));
+            return sequence / 2;
+        }
+    }
+}
+
+/**
+ * @brief Returns the command and publication counters. May be called from any thread.
+ *
+ * @param statistics Receives the counters since construction.
+ */
+template <typename Model>
+void PkpConcurrentKeypad<Model>::getStatistics(statistics_t& statistics) {
+    statistics.commandsApplied = _commandsApplied.load(std::memory_order_relaxed);
+    statistics.commandsDropped = _commandsDropped.load(std::memory_order_relaxed);
+    statistics.commandsFailed  = _commandsFailed.load(std::memory_order_relaxed);
+    statistics.events          = getEventPosition();
+    statistics.publications    = getPublication();
+}
+
+/**
+ * @brief Takes the event at a reader's position. May be called from any thread, never blocks the CAN thread.
+ *
+ * Every reader keeps a position of its own, starting with getEventPosition(), so all readers receive all events. The
+ * ring holds the last PKP_CONCURRENT_EVENT_QUEUE_SIZE events. A reader falling further behind continues with the
+ * oldest event still held, the events skipped are the difference of the position before and after the call minus 1.
+ *
+ * @param position The reader's position, advanced past the returned event.
+ * @param event Receives the event.
+ * @return True if an event was available, false if the reader is up to date.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::nextEvent(uint32_t& position, PkpBase::event_t& event) {
+    for (;;) {
+        eventCell_t& cell     = _eventCells[position & (PKP_CONCURRENT_EVENT_QUEUE_SIZE - 1)];
+        uint32_t     written  = 2 * position + 2;
+        uint32_t     sequence = cell.sequence.load(std::memory_order_acquire);
+        if (sequence == written) {
+            uint32_t words[2];
+            words[0] = cell.words[0].load(std::memory_order_relaxed);
+            words[1] = cell.words[1].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (cell.sequence.load(std::memory_order_relaxed) == sequence) {
+                memcpy(&event, words, sizeof(words));
+                position++;
+                return true;
+            }
+        } else if ((int32_t)(sequence - written) < 0) {
+            // Not forwarded yet
+            return false;
+        } else {
+            // Overwritten by a later event, the cell of the position forwarded next is the oldest one still valid
+            uint32_t published = _eventPosition.load(std::memory_order_acquire);
+            position           = published > PKP_CONCURRENT_EVENT_QUEUE_SIZE ? published - PKP_CONCURRENT_EVENT_QUEUE_SIZE : 0;
+        }
+    }
+}
+
+/**
+ * @brief Forwards the input events, applies the queued commands and publishes the input state if it changed.
+ *
+ * Must only be called by the thread owning the keypad, after the received frames were processed. PkpSocketCan
+ * calls it for all attached facades (see PkpSocketCan::attachConcurrent()). The snapshot is taken with
+ * Pkp::takeInputSnapshot(), so the relative encoder ticks of the keypad are consumed by the facade.
+ *
+ * @return The number of commands applied.
+ */
+template <typename Model>
+uint8_t PkpConcurrentKeypad<Model>::service() {
+    collectEvents();
+
+    uint8_t applied = 0;
+    for (;;) {
+        cell_t&  cell     = _cells[_dequeuePosition & (PKP_CONCURRENT_QUEUE_SIZE - 1)];
+        uint32_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (sequence != _dequeuePosition + 1) {
+            break;
+        }
+        command_t command = cell.command;
+        cell.sequence.store(_dequeuePosition + PKP_CONCURRENT_QUEUE_SIZE, std::memory_order_release);
+        _dequeuePosition++;
+
+        if (_apply(command) != PkpBase::RS_SUCCESS) {
+            _commandsFailed.fetch_add(1, std::memory_order_relaxed);
+        }
+        _commandsApplied.fetch_add(1, std::memory_order_relaxed);
+        applied++;
+    }
+
+    // Commands may have changed key states, so the state is taken afterwards
+    PkpBase::inputSnapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    _keypad.takeInputSnapshot(snapshot);
+    if (0 != memcmp(&snapshot, &_published, sizeof(snapshot))) {
+        _published = snapshot;
+        _publish(snapshot);
+    }
+    return applied;
+}
+
+/**
+ * @brief Posts Pkp::setBacklight(). May be called from any thread.
+ *
+ * @param color The backlight color, see Pkp::setBacklight().
+ * @param brightness The backlight brightness, see Pkp::setBacklight().
+ * @return True if the command was queued, false if the queue is full.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::setBacklight(int8_t color, int8_t brightness) {
+    command_t command = {};
+    command.type      = CT_BACKLIGHT;
+    command.value[0]  = color;
+    command.value[1]  = brightness;
+    return _post(command);
+}
+
+/**
+ * @brief Posts Pkp::setEncoderLeds(). May be called from any thread.
+ *
+ * @param ledsEncoder The LED patterns of the encoder rings, see Pkp::setEncoderLeds().
+ * @return True if the command was queued, false if the queue is full.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::setEncoderLeds(const int32_t ledsEncoder[PKP_MAX_ROTARY_ENCODER_AMOUNT]) {
+    command_t command = {};
+    command.type      = CT_ENCODER_LEDS;
+    memcpy(command.encoderLeds, ledsEncoder, sizeof(command.encoderLeds));
+    return _post(command);
+}
+
+/**
+ * @brief Posts Pkp::setKeyBrightness(). May be called from any thread.
+ *
+ * @param brightness The key brightness from 0 to 100.
+ * @return True if the command was queued, false if the queue is full.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::setKeyBrightness(uint8_t brightness) {
+    command_t command = {};
+    command.type      = CT_KEY_BRIGHTNESS;
+    command.value[0]  = min(brightness, (uint8_t)100);
+    return _post(command);
+}
+
+/**
+ * @brief Posts Pkp::setKeyColor(). May be called from any thread.
+ *
+ * @param keyIndex The index of the key.
+ * @param colors The colors per key state, see Pkp::setKeyColor().
+ * @param blinkColors The blink colors per key state, see Pkp::setKeyColor().
+ * @return True if the command was queued, false if the queue is full.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::setKeyColor(uint8_t keyIndex, const uint8_t colors[4], const uint8_t blinkColors[4]) {
+    command_t command = {};
+    command.type      = CT_KEY_COLOR;
+    command.index     = keyIndex;
+    memcpy(&command.colors[0], colors, 4);
+    memcpy(&command.colors[4], blinkColors, 4);
+    return _post(command);
+}
+
+/**
+ * @brief Posts Pkp::setKeyMode(). May be called from any thread.
+ *
+ * @param keyIndex The index of the key.
+ * @param keyMode The key mode, see Pkp::setKeyMode().
+ * @return True if the command was queued, false if the queue is full.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::setKeyMode(uint8_t keyIndex, uint8_t keyMode) {
+    command_t command = {};
+    command.type      = CT_KEY_MODE;
+    command.index     = keyIndex;
+    command.value[0]  = keyMode;
+    return _post(command);
+}
+
+/**
+ * @brief Posts Pkp::setKeyStateOverride(). May be called from any thread.
+ *
+ * @param keyIndex The index of the key.
+ * @param keyState The key state to show, -1 to end the override, see Pkp::setKeyStateOverride().
+ * @return True if the command was queued, false if the queue is full.
+ */
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::setKeyStateOverride(uint8_t keyIndex, int8_t keyState) {
+    command_t command = {};
+    command.type      = CT_KEY_STATE_OVERRIDE;
+    command.index     = keyIndex;
+    command.value[0]  = keyState;
+    return _post(command);
+}
+
+//********** PRIVATE METHODS **********
+template <typename Model>
+PkpBase::returnState_e PkpConcurrentKeypad<Model>::_apply(command_t& command) {
+    switch (command.type) {
+        case CT_APPLY_DEFAULT_KEY_STATES:
+            return _keypad.applyDefaultKeyStates();
+        case CT_BACKLIGHT:
+            return _keypad.setBacklight(command.value[0], command.value[1]);
+        case CT_ENCODER_LEDS:
+            return _keypad.setEncoderLeds(command.encoderLeds);
+        case CT_KEY_BRIGHTNESS:
+            return _keypad.setKeyBrightness(command.value[0]);
+        case CT_KEY_COLOR:
+            return _keypad.setKeyColor(command.index, &command.colors[0], &command.colors[4]);
+        case CT_KEY_MODE:
+            return _keypad.setKeyMode(command.index, command.value[0]);
+        case CT_KEY_STATE_OVERRIDE:
+            return _keypad.setKeyStateOverride(command.index, command.value[0]);
+        default:
+            return PkpBase::RS_SUCCESS;
+    }
+}
+
+template <typename Model>
+bool PkpConcurrentKeypad<Model>::_post(const command_t& command) {
+    // Bounded multi-producer queue: a producer claims a position by CAS, the cell sequence hands it to service()
+    uint32_t position = _enqueuePosition.load(std::memory_order_relaxed);
+    for (;;) {
+        cell_t&  cell       = _cells[position & (PKP_CONCURRENT_QUEUE_SIZE - 1)];
+        uint32_t sequence   = cell.sequence.load(std::memory_order_acquire);
+        int32_t  difference = (int32_t)(sequence - position);
+        if (difference == 0) {
+            if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.command = command;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            // The cell still holds a command from one round earlier
+            _commandsDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = _enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename Model>
+void PkpConcurrentKeypad<Model>::_publish(const PkpBase::inputSnapshot_t& snapshot) {
+    uint32_t words[SNAPSHOT_WORDS] = {};
+    memcpy(words, &snapshot, sizeof(snapshot));
+
+    // Single writer, the odd sequence makes readers retry until all words are stored
+    uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint8_t i = 0; i < SNAPSHOT_WORDS; i++) {
+        _words[i].store(words[i], std::memory_order_relaxed);
+    }
+    _sequence.store(sequence + 2, std::memory_order_release);
+}
+
+template class PkpConcurrentKeypad<Pkp2200Si>;
+template class PkpConcurrentKeypad<Pkp2300Si>;
+template class PkpConcurrentKeypad<Pkp2400Si>;
+template class PkpConcurrentKeypad<Pkp2500Si>;
+template class PkpConcurrentKeypad<Pkp2600Si>;
+template class PkpConcurrentKeypad<Pkp3500SiMt>;
@@ -0,0 +1,135 @@
+/*
+ * Thread-safe keypad facade for Linux gateways
+ *
+ * The keypad is owned by the thread receiving the CAN frames (e.g. the one running
+ * PkpSocketCan::run()). After each batch of frames, that thread calls service(), which applies
+ * the queued LED commands and publishes the input state of the keypad (keys, presses, encoders,
+ * wired inputs, communication status) through a seqlock. Any number of threads take consistent
+ * snapshots without locks and post LED commands through a bounded lock-free multi-producer
+ * queue, so control threads neither block the CAN thread nor each other.
+ *
+ * A snapshot only shows the state after the batch, a key pressed and released within one batch
+ * is not visible in it. The input events of the keypad (see Pkp::nextEvent()) are therefore
+ * forwarded into a lock-free broadcast ring, from which every thread reads all events in order
+ * with a position of its own.
+ *
+ * Linux only, not part of the Arduino library.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_CONCURRENT
+#define BLINK_MARINE_CAN_OPEN_CONCURRENT
+
+#include <BlinkMarinePkpCanOpen.h>
+
+#include <atomic>
+
+#ifndef PKP_CONCURRENT_QUEUE_SIZE
+#define PKP_CONCURRENT_QUEUE_SIZE 64
+#endif
+
+#ifndef PKP_CONCURRENT_EVENT_QUEUE_SIZE
+#define PKP_CONCURRENT_EVENT_QUEUE_SIZE 256
+#endif
+
+static_assert(PKP_EVENTS, "PkpConcurrent forwards the input events of the keypad and requires PKP_EVENTS set to 1");
+static_assert((PKP_CONCURRENT_QUEUE_SIZE & (PKP_CONCURRENT_QUEUE_SIZE - 1)) == 0 && PKP_CONCURRENT_QUEUE_SIZE >= 2,
+              "PKP_CONCURRENT_QUEUE_SIZE must be a power of two of at least 2");
+static_assert((PKP_CONCURRENT_EVENT_QUEUE_SIZE & (PKP_CONCURRENT_EVENT_QUEUE_SIZE - 1)) == 0 && PKP_CONCURRENT_EVENT_QUEUE_SIZE >= 2,
+              "PKP_CONCURRENT_EVENT_QUEUE_SIZE must be a power of two of at least 2");
+
+class PkpConcurrentBase {
+  public:
+    // ------ Public Types ------
+    struct statistics_t {
+        uint32_t commandsApplied;
+        uint32_t commandsDropped; // queue full when posted
+        uint32_t commandsFailed;  // rejected by the keypad, e.g. an invalid key index
+        uint32_t events;          // input events forwarded
+        uint32_t publications;
+    };
+
+    // ------ Public Functions ------
+    virtual ~PkpConcurrentBase()   = default;
+    virtual void    collectEvents() = 0;
+    virtual uint8_t service()       = 0;
+};
+
+template <typename Model>
+class PkpConcurrentKeypad final : public PkpConcurrentBase {
+  public:
+    // ------ Public Functions ------
+    explicit PkpConcurrentKeypad(PkpKeypad<Model>& keypad);
+    bool     applyDefaultKeyStates();
+    void     collectEvents() override;
+    uint32_t getEventPosition();
+    uint32_t getPublication();
+    uint32_t getSnapshot(PkpBase::inputSnapshot_t& snapshot);
+    void     getStatistics(statistics_t& statistics);
+    bool     nextEvent(uint32_t& position, PkpBase::event_t& event);
+    uint8_t  service() override;
+    bool     setBacklight(int8_t color, int8_t brightness);
+    bool     setEncoderLeds(const int32_t ledsEncoder[PKP_MAX_ROTARY_ENCODER_AMOUNT]);
+    bool     setKeyBrightness(uint8_t brightness);
+    bool     setKeyColor(uint8_t keyIndex, const uint8_t colors[4], const uint8_t blinkColors[4]);
+    bool     setKeyMode(uint8_t keyIndex, uint8_t keyMode);
+    bool     setKeyStateOverride(uint8_t keyIndex, int8_t keyState);
+
+  private:
+    // ------ Private Type Definitions  ------
+    enum commandType_e : uint8_t {
+        CT_APPLY_DEFAULT_KEY_STATES = 0,
+        CT_BACKLIGHT                = 1,
+        CT_ENCODER_LEDS             = 2,
+        CT_KEY_BRIGHTNESS           = 3,
+        CT_KEY_COLOR                = 4,
+        CT_KEY_MODE                 = 5,
+        CT_KEY_STATE_OVERRIDE       = 6
+    };
+
+    struct command_t {
+        commandType_e type;
+        uint8_t       index;     // key index
+        int8_t        value[2];  // backlight color and brightness, key brightness, key mode or key state
+        uint8_t       colors[8]; // key colors followed by key blink colors
+        int32_t       encoderLeds[PKP_MAX_ROTARY_ENCODER_AMOUNT];
+    };
+
+    struct cell_t {
+        std::atomic<uint32_t> sequence; // position the cell is free for, position + 1 once written
+        command_t             command;
+    };
+
+    struct eventCell_t {
+        std::atomic<uint32_t> sequence; // 2 * position + 1 while written, 2 * position + 2 once written
+        std::atomic<uint32_t> words[2];
+    };
+
+    // ------ Private Constants ------
+    static constexpr uint8_t SNAPSHOT_WORDS = (sizeof(PkpBase::inputSnapshot_t) + 3) / 4;
+    static_assert(sizeof(PkpBase::event_t) == sizeof(eventCell_t::words), "An event has to fit into two words");
+
+    // ------ Private Variables ------
+    cell_t                   _cells[PKP_CONCURRENT_QUEUE_SIZE];
+    std::atomic<uint32_t>    _commandsApplied  = {0};
+    std::atomic<uint32_t>    _commandsDropped  = {0};
+    std::atomic<uint32_t>    _commandsFailed   = {0};
+    uint32_t                 _dequeuePosition  = 0; // accessed by service() only
+    std::atomic<uint32_t>    _enqueuePosition  = {0};
+    eventCell_t              _eventCells[PKP_CONCURRENT_EVENT_QUEUE_SIZE];
+    std::atomic<uint32_t>    _eventPosition    = {0}; // events published
+    PkpKeypad<Model>&        _keypad;
+    PkpBase::inputSnapshot_t _published        = {};  // last published state, accessed by service() only
+    std::atomic<uint32_t>    _sequence         = {0}; // odd while a snapshot is written
+    std::atomic<uint32_t>    _words[SNAPSHOT_WORDS];
+
+    // ------ Private Functions ------
+    PkpBase::returnState_e _apply(command_t& command);
+    bool                   _post(const command_t& command);
+    void                   _publish(const PkpBase::inputSnapshot_t& snapshot);
+};
+
+typedef PkpConcurrentKeypad<Pkp3500SiMt> PkpConcurrent;
+
+#endif // BLINK_MARINE_CAN_OPEN_CONCURRENT
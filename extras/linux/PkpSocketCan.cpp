@@ -0,0 +1,368 @@
+
+#include "PkpSocketCan.h"
+#include "PkpConcurrent.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <initializer_list>
+
+// <linux/can.h> declares its own struct can_frame, which clashes with the library's one, so the few
+// SocketCAN definitions needed here are repeated from <linux/can.h> and <linux/can/raw.h>
+namespace {
+constexpr int      SOCKET_CAN_RAW        = 1;
+constexpr int      SOCKET_CAN_SOL_RAW    = 100 + SOCKET_CAN_RAW;
+constexpr int      SOCKET_CAN_RAW_FILTER = 1;
+constexpr uint32_t SOCKET_CAN_EFF_FLAG   = 0x80000000uL;
+constexpr uint32_t SOCKET_CAN_RTR_FLAG   = 0x40000000uL;
+constexpr uint32_t SOCKET_CAN_SFF_MASK   = 0x000007FFuL;
+
+struct socketCanAddress_t {
+    sa_family_t family;
+    int         ifIndex;
+    uint8_t     address[16];
+};
+
+struct socketCanFilter_t {
+    uint32_t id;
+    uint32_t mask;
+};
+
+// COB-IDs of the frames sent by a keypad: TPDO1-4, SDO response, heartbeat
+constexpr uint16_t KEYPAD_COB_IDS[] = {0x180, 0x280, 0x380, 0x480, 0x580, 0x700};
+} // namespace
+
+// The library frames are passed to the kernel as they are
+static_assert(sizeof(struct can_frame) == 16, "can_frame does not match the SocketCAN frame size");
+static_assert(offsetof(struct can_frame, can_dlc) == 4, "can_frame does not match the SocketCAN layout");
+static_assert(offsetof(struct can_frame, data) == 8, "can_frame does not match the SocketCAN layout");
+static_assert(sizeof(socketCanAddress_t) == 24, "socketCanAddress_t does not match struct sockaddr_can");
+
+PkpSocketCan* PkpSocketCan::_instance = nullptr;
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs a SocketCAN transport for the keypads attached to a bus.
+ *
+ * @param bus The bus received frames are routed to and whose keypads determine the kernel filters.
+ */
+PkpSocketCan::PkpSocketCan(PkpBus& bus) : _bus(bus) {
+}
+
+PkpSocketCan::~PkpSocketCan() {
+    close();
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Uses an already connected packet socket instead of a CAN interface.
+ *
+ * Meant for in-process tests with one end of a socketpair(AF_UNIX, SOCK_SEQPACKET), where every packet holds one
+ * 16 byte frame. Kernel filters are installed if the socket supports them. The transport takes ownership of the
+ * descriptor.
+ *
+ * @param fd The socket to use.
+ * @return True on success, false with errno set otherwise.
+ */
+bool PkpSocketCan::adopt(int fd) {
+    close();
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return false;
+    }
+    _fd = fd;
+    updateFilters();
+    if (!_setupEventLoop()) {
+        close();
+        return false;
+    }
+    _instance = this;
+    return true;
+}
+
+/**
+ * @brief Services a thread-safe keypad facade from the event loop.
+ *
+ * After the received frames of each event were handled, runOnce() applies the commands posted to the facade and
+ * publishes the input state of its keypad, so other threads see changes and have their commands sent within one
+ * poll cycle. The input events are forwarded after every received frame, so none is lost within a batch.
+ *
+ * @param facade The facade to service. It must outlive the transport.
+ * @return True on success, false if PKP_BUS_MAX_NODES facades are attached already.
+ */
+bool PkpSocketCan::attachConcurrent(PkpConcurrentBase& facade) {
+    if (_concurrentCount >= PKP_BUS_MAX_NODES) {
+        return false;
+    }
+    _concurrent[_concurrentCount++] = &facade;
+    return true;
+}
+
+/**
+ * @brief Closes the socket and the event loop descriptors. Frames not yet transmitted are discarded.
+ */
+void PkpSocketCan::close() {
+    for (int* fd : {&_fd, &_epollFd, &_timerFd}) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    _txCount = 0;
+    if (_instance == this) {
+        _instance = nullptr;
+    }
+}
+
+/**
+ * @brief Writes all collected frames with as few sendmmsg() calls as possible.
+ *
+ * Called by runOnce() after each batch of events, only needed when the transport is driven otherwise.
+ *
+ * @return True if all frames were written, false if the socket buffer is full or an error occurred.
+ */
+bool PkpSocketCan::flush() {
+    while (_txCount > 0) {
+        struct mmsghdr messages[PKP_SOCKET_CAN_BATCH] = {};
+        struct iovec   vectors[PKP_SOCKET_CAN_BATCH];
+        for (uint8_t i = 0; i < _txCount; i++) {
+            vectors[i].iov_base            = &_txFrames[i];
+            vectors[i].iov_len             = sizeof(struct can_frame);
+            messages[i].msg_hdr.msg_iov    = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = sendmmsg(_fd, messages, _txCount, MSG_DONTWAIT);
+        _statistics.txSyscalls++;
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        _statistics.txFrames += sent;
+        _txCount             -= sent;
+        memmove(_txFrames, &_txFrames[sent], _txCount * sizeof(struct can_frame));
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the socket descriptor, e.g. to integrate the transport into another event loop.
+ *
+ * @return The descriptor, -1 if no socket is open.
+ */
+int PkpSocketCan::getFd() {
+    return _fd;
+}
+
+/**
+ * @brief Returns the frame and system call counters.
+ *
+ * @param statistics Receives the counters since construction.
+ */
+void PkpSocketCan::getStatistics(statistics_t& statistics) {
+    statistics = _statistics;
+}
+
+/**
+ * @brief Opens a SocketCAN interface.
+ *
+ * @param interfaceName The name of the interface, e.g. "can0" or "vcan0".
+ * @return True on success, false with errno set otherwise.
+ */
+bool PkpSocketCan::open(const char* interfaceName) {
+    close();
+    _fd = socket(AF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, SOCKET_CAN_RAW);
+    if (_fd < 0) {
+        return false;
+    }
+
+    socketCanAddress_t address = {};
+    address.family             = AF_CAN;
+    address.ifIndex            = if_nametoindex(interfaceName);
+    if (address.ifIndex == 0 || bind(_fd, (struct sockaddr*)&address, sizeof(address)) < 0 || !updateFilters() || !_setupEventLoop()) {
+        int error = errno;
+        close();
+        errno = error;
+        return false;
+    }
+    _instance = this;
+    return true;
+}
+
+/**
+ * @brief Runs the event loop until stop() is called or the socket is closed by the peer.
+ */
+void PkpSocketCan::run() {
+    _running = true;
+    while (_running && _fd >= 0) {
+        if (runOnce(-1) < 0 && errno != EINTR) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Waits for received frames or the next poll cycle and handles them.
+ *
+ * Received frames are read in batches of up to PKP_SOCKET_CAN_BATCH and routed through PkpBus::process(), once
+ * per millisecond PkpBus::poll() runs the watchdogs. Attached facades are serviced afterwards (see
+ * attachConcurrent()). Frames transmitted by the keypads meanwhile are written by flush() before returning.
+ *
+ * @param timeoutMs Maximum time to wait in milliseconds, -1 to wait for the next event.
+ * @return The number of handled events, -1 with errno set on errors.
+ */
+int PkpSocketCan::runOnce(int timeoutMs) {
+    struct epoll_event events[2];
+    int                count = epoll_wait(_epollFd, events, 2, timeoutMs);
+    for (int i = 0; i < count; i++) {
+        if (events[i].data.fd == _timerFd) {
+            uint64_t expirations;
+            if (read(_timerFd, &expirations, sizeof(expirations)) > 0) {
+                _bus.poll();
+            }
+        } else {
+            _receive();
+        }
+    }
+    for (uint8_t i = 0; i < _concurrentCount; i++) {
+        _concurrent[i]->service();
+    }
+    flush();
+    return count;
+}
+
+/**
+ * @brief Makes run() return after the current event. May be called from a signal handler.
+ */
+void PkpSocketCan::stop() {
+    _running = false;
+}
+
+/**
+ * @brief Installs kernel filters for the frames sent by the keypads attached to the bus.
+ *
+ * Called by open() and adopt(), has to be called again if keypads are attached to the bus later. Without attached
+ * keypads no frames are received.
+ *
+ * @return True on success, false if the socket does not support CAN filters.
+ */
+bool PkpSocketCan::updateFilters() {
+    socketCanFilter_t filters[PKP_BUS_MAX_NODES * sizeof(KEYPAD_COB_IDS) / sizeof(KEYPAD_COB_IDS[0])];
+    size_t            count = 0;
+    for (uint8_t i = 0; i < _bus.getNodeCount(); i++) {
+        for (uint16_t cobId : KEYPAD_COB_IDS) {
+            // Standard data frames with exactly this identifier
+            filters[count].id   = cobId + _bus.getNodeId(i);
+            filters[count].mask = SOCKET_CAN_SFF_MASK | SOCKET_CAN_EFF_FLAG | SOCKET_CAN_RTR_FLAG;
+            count++;
+        }
+    }
+    return setsockopt(_fd, SOCKET_CAN_SOL_RAW, SOCKET_CAN_RAW_FILTER, filters, count * sizeof(socketCanFilter_t)) == 0;
+}
+
+/**
+ * @brief Transmit callback for the keypads, see CanMsgTxCallback.
+ *
+ * Frames are collected and written by flush(), so transmission errors of the socket are not reported here. Frames
+ * are only rejected if the batch is full and cannot be written. Routes to the transport opened last.
+ *
+ * @param txMsg The frame to transmit.
+ * @return 0 if the frame was accepted, 1 otherwise.
+ */
+uint8_t PkpSocketCan::transmit(const struct can_frame& txMsg) {
+    if (_instance == nullptr) {
+        return 1;
+    }
+    return _instance->_queue(txMsg) ? 0 : 1;
+}
+
+//********** PRIVATE METHODS **********
+bool PkpSocketCan::_queue(const struct can_frame& txMsg) {
+    if (_txCount == PKP_SOCKET_CAN_BATCH && !flush()) {
+        _statistics.txDropped++;
+        return false;
+    }
+
+    // The padding bytes are reserved fields for the kernel and have to be zero
+    struct can_frame& frame = _txFrames[_txCount++];
+    frame                   = can_frame();
+    frame.can_id  = txMsg.can_id;
+    frame.can_dlc = txMsg.can_dlc;
+    memcpy(frame.data, txMsg.data, sizeof(frame.data));
+    return true;
+}
+
+void PkpSocketCan::_receive() {
+    struct mmsghdr messages[PKP_SOCKET_CAN_BATCH];
+    struct iovec   vectors[PKP_SOCKET_CAN_BATCH];
+
+    // Limited, so a flooded socket cannot starve the poll cycle, the epoll loop reports the remaining frames again
+    int received = PKP_SOCKET_CAN_BATCH;
+    for (uint8_t batch = 0; batch < RX_BATCHES_PER_EVENT && received == PKP_SOCKET_CAN_BATCH; batch++) {
+        memset(messages, 0, sizeof(messages));
+        for (uint8_t i = 0; i < PKP_SOCKET_CAN_BATCH; i++) {
+            vectors[i].iov_base            = &_rxFrames[i];
+            vectors[i].iov_len             = sizeof(struct can_frame);
+            messages[i].msg_hdr.msg_iov    = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        received = recvmmsg(_fd, messages, PKP_SOCKET_CAN_BATCH, MSG_DONTWAIT, nullptr);
+        _statistics.rxSyscalls++;
+        if (received < 0) {
+            return;
+        }
+
+        // Extended, remote and error frames have flags above the 11-bit identifier and are dropped by the bus
+        for (int i = 0; i < received; i++) {
+            if (messages[i].msg_len == 0) {
+                // Peer of an adopted socket closed, a closed SOCK_SEQPACKET socket reads as empty messages
+                _statistics.rxFrames += i;
+                stop();
+                close();
+                return;
+            }
+            if (messages[i].msg_len == sizeof(struct can_frame) && _bus.process(_rxFrames[i])) {
+                for (uint8_t j = 0; j < _concurrentCount; j++) {
+                    _concurrent[j]->collectEvents();
+                }
+            }
+        }
+        _statistics.rxFrames += received;
+    }
+}
+
+bool PkpSocketCan::_setupEventLoop() {
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    _timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_epollFd < 0 || _timerFd < 0) {
+        return false;
+    }
+
+    struct itimerspec interval   = {};
+    interval.it_interval.tv_nsec = POLL_INTERVAL_NS;
+    interval.it_value.tv_nsec    = POLL_INTERVAL_NS;
+    if (timerfd_settime(_timerFd, 0, &interval, nullptr) < 0) {
+        return false;
+    }
+
+    for (int fd : {_fd, _timerFd}) {
+        struct epoll_event event = {};
+        event.events             = EPOLLIN;
+        event.data.fd            = fd;
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+ * Linux SocketCAN transport for Blink Marine KeyPads
+ *
+ * Connects a PkpBus to a SocketCAN interface (can0, vcan0, ...) with batched I/O: received
+ * frames are read with recvmmsg() directly into library can_frame buffers (the layout matches
+ * the kernel's struct can_frame, so no conversion is needed) and transmitted frames are
+ * collected and written with sendmmsg(). Kernel CAN_RAW_FILTERs limit reception to the
+ * frames the attached keypads send. An epoll loop drives reception and the 1 ms poll cycle.
+ *
+ * Instead of a CAN interface, any connected packet socket (e.g. one end of a SOCK_SEQPACKET
+ * socketpair) can be adopted to run the transport in-process, without kernel filters.
+ *
+ * Linux only, not part of the Arduino library.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_SOCKET_CAN
+#define BLINK_MARINE_CAN_OPEN_SOCKET_CAN
+
+#include <BlinkMarinePkpCanOpen.h>
+#include <PkpBus.h>
+
+#ifndef PKP_SOCKET_CAN_BATCH
+#define PKP_SOCKET_CAN_BATCH 32
+#endif
+
+class PkpConcurrentBase;
+
+class PkpSocketCan {
+  public:
+    // ------ Public Types ------
+    struct statistics_t {
+        uint32_t rxFrames;
+        uint32_t rxSyscalls;
+        uint32_t txFrames;
+        uint32_t txSyscalls;
+        uint32_t txDropped;
+    };
+
+    // ------ Public Functions ------
+    explicit PkpSocketCan(PkpBus& bus);
+    ~PkpSocketCan();
+    bool           adopt(int fd);
+    bool           attachConcurrent(PkpConcurrentBase& facade);
+    void           close();
+    bool           flush();
+    int            getFd();
+    void           getStatistics(statistics_t& statistics);
+    bool           open(const char* interfaceName);
+    void           run();
+    int            runOnce(int timeoutMs);
+    void           stop();
+    bool           updateFilters();
+    static uint8_t transmit(const struct can_frame& txMsg);
+
+  private:
+    // ------ Private Constants ------
+    static constexpr uint32_t POLL_INTERVAL_NS     = 1000000;
+    static constexpr uint8_t  RX_BATCHES_PER_EVENT = 8; // recvmmsg() calls per readable event
+
+    // ------ Private Variables ------
+    PkpBus&              _bus;
+    PkpConcurrentBase*   _concurrent[PKP_BUS_MAX_NODES] = {};
+    uint8_t              _concurrentCount               = 0;
+    int                  _epollFd                       = -1;
+    int                  _fd                            = -1;
+    static PkpSocketCan* _instance;
+    volatile bool        _running                       = false;
+    struct can_frame     _rxFrames[PKP_SOCKET_CAN_BATCH];
+    statistics_t         _statistics                    = {};
+    int                  _timerFd                       = -1;
+    uint8_t              _txCount                       = 0;
+    struct can_frame     _txFrames[PKP_SOCKET_CAN_BATCH];
+
+    // ------ Private Functions ------
+    bool _queue(const struct can_frame& txMsg);
+    void _receive();
+    bool _setupEventLoop();
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_SOCKET_CAN
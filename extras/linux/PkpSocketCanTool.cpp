@@ -0,0 +1,198 @@
+/**
+ * @brief   SocketCAN gateway and transport self-test
+ * @author  Stefan Hirschenberger
+ *
+ * With an interface name, runs the keypads with the given node IDs on that interface until
+ * Ctrl+C and prints the transport statistics, e.g. against vcan0:
+ *
+ *   sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+ *   pkp_socketcan vcan0 0x15 0x16
+ *
+ * With --socketpair, the transport is connected to an in-process peer over a SOCK_SEQPACKET
+ * socketpair instead. The peer sends bursts of key PDOs, heartbeats and foreign frames and
+ * counts the LED frames sent back, the statistics show the frames handled per system call.
+ * Meanwhile a control thread takes snapshots through a PkpConcurrent facade, posts backlight
+ * commands once per millisecond and counts the key presses among the forwarded events. As
+ * each burst presses and releases keys several times, a press is only seen as an event.
+ *
+ * Usage: pkp_socketcan <interface> <node id>...
+ *        pkp_socketcan --socketpair [frames]
+ */
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "PkpConcurrent.h"
+#include "PkpSocketCan.h"
+
+static constexpr uint8_t  SELF_TEST_NODE_ID = 0x15;
+static constexpr uint32_t BURST_FRAMES      = 64;
+
+static PkpSocketCan* transport = nullptr;
+
+static void onSignal(int) {
+    transport->stop();
+}
+
+static void printStatistics() {
+    PkpSocketCan::statistics_t statistics;
+    transport->getStatistics(statistics);
+    printf("rx %u frames in %u syscalls (%.1f frames/syscall)\n", statistics.rxFrames, statistics.rxSyscalls,
+           statistics.rxSyscalls ? (double)statistics.rxFrames / statistics.rxSyscalls : 0.0);
+    printf("tx %u frames in %u syscalls (%.1f frames/syscall), %u dropped\n", statistics.txFrames, statistics.txSyscalls,
+           statistics.txSyscalls ? (double)statistics.txFrames / statistics.txSyscalls : 0.0, statistics.txDropped);
+}
+
+static int runGateway(const char* interfaceName, int nodeCount, char** nodeIds) {
+    PkpBus            bus;
+    PkpSocketCan      socketCan(bus);
+    std::vector<Pkp*> keypads;
+    transport = &socketCan;
+
+    for (int i = 0; i < nodeCount; i++) {
+        Pkp* keypad = new Pkp((uint8_t)strtoul(nodeIds[i], nullptr, 0), PkpSocketCan::transmit);
+        if (bus.attach(*keypad) != Pkp::RS_SUCCESS) {
+            printf("Cannot attach node %s\n", nodeIds[i]);
+            return 2;
+        }
+        keypads.push_back(keypad);
+    }
+    if (!socketCan.open(interfaceName)) {
+        printf("Cannot open %s: %s\n", interfaceName, strerror(errno));
+        return 2;
+    }
+    for (Pkp* keypad : keypads) {
+        keypad->begin();
+    }
+
+    signal(SIGINT, onSignal);
+    socketCan.run();
+    printStatistics();
+    return 0;
+}
+
+static int runSelfTest(uint32_t frames) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+        printf("socketpair: %s\n", strerror(errno));
+        return 2;
+    }
+
+    PkpBus       bus;
+    PkpSocketCan socketCan(bus);
+    Pkp          keypad(SELF_TEST_NODE_ID, PkpSocketCan::transmit);
+    transport = &socketCan;
+
+    // Every key press and release changes the LEDs
+    const uint8_t colors[4] = {Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_GREEN, Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK};
+    for (uint8_t i = 0; i < Pkp::KEY_AMOUNT; i++) {
+        keypad.setKeyColor(i, colors, colors);
+    }
+    bus.attach(keypad);
+    socketCan.adopt(fds[0]);
+    keypad.begin();
+
+    // From here on, the keypad is accessed through the facade only
+    PkpConcurrent facade(keypad);
+    socketCan.attachConcurrent(facade);
+
+    std::atomic<bool>     peerDone(false);
+    std::atomic<uint32_t> ledFrames(0);
+    std::thread           peer([&]() {
+        struct can_frame frame;
+        uint32_t         sent = 0;
+        while (sent < frames) {
+            for (uint32_t i = 0; i < BURST_FRAMES && sent < frames; i++, sent++) {
+                frame         = can_frame();
+                frame.can_dlc = 8;
+                if (sent % 16 == 15) {
+                    frame.can_id  = 0x700 + SELF_TEST_NODE_ID;
+                    frame.can_dlc = 1;
+                    frame.data[0] = Pkp::NMT_OPERATIONAL;
+                } else if (sent % 4 == 3) {
+                    frame.can_id = 0x123;
+                } else {
+                    frame.can_id  = 0x180 + SELF_TEST_NODE_ID;
+                    frame.data[0] = (sent & 1) ? 1 << ((sent / 2) % 8) : 0;
+                }
+                send(fds[1], &frame, sizeof(frame), 0);
+            }
+            while (recv(fds[1], &frame, sizeof(frame), MSG_DONTWAIT) == sizeof(frame)) {
+                ledFrames += (frame.can_id & 0x780) == 0x200;
+            }
+            usleep(1000);
+        }
+        usleep(10000);
+        while (recv(fds[1], &frame, sizeof(frame), MSG_DONTWAIT) == sizeof(frame)) {
+            ledFrames += (frame.can_id & 0x780) == 0x200;
+        }
+        peerDone = true;
+    });
+
+    uint32_t    snapshots       = 0;
+    uint32_t    lastPublication = 0;
+    uint32_t    eventPosition   = facade.getEventPosition();
+    uint32_t    keyDownEvents   = 0;
+    uint32_t    skippedEvents   = 0;
+    auto        readEvents      = [&]() {
+        Pkp::event_t event;
+        uint32_t     expected = eventPosition;
+        while (facade.nextEvent(eventPosition, event)) {
+            skippedEvents += eventPosition - expected - 1;
+            expected      = eventPosition;
+            keyDownEvents += event.type == Pkp::EV_KEY_DOWN;
+        }
+    };
+    std::thread control([&]() {
+        Pkp::inputSnapshot_t snapshot;
+        while (!peerDone) {
+            lastPublication = facade.getSnapshot(snapshot);
+            snapshots++;
+            facade.setBacklight(Pkp::BACKLIGHT_WHITE, snapshot.keyPressed ? 50 : 20);
+            readEvents();
+            usleep(1000);
+        }
+    });
+
+    while (!peerDone) {
+        socketCan.runOnce(1);
+    }
+    peer.join();
+    control.join();
+    close(fds[1]);
+    readEvents();
+
+    // Every fourth frame starting with the second presses a key after a frame releasing all keys
+    uint32_t keyPresses = (frames + 2) / 4;
+
+    PkpConcurrent::statistics_t statistics;
+    facade.getStatistics(statistics);
+    printf("socketpair self-test, %u frames sent by the peer, %u key LED frames received\n", frames, ledFrames.load());
+    printStatistics();
+    printf("facade %u snapshots up to publication %u of %u, %u commands applied, %u dropped, %u failed\n", snapshots,
+           lastPublication, statistics.publications, statistics.commandsApplied, statistics.commandsDropped,
+           statistics.commandsFailed);
+    printf("facade %u of %u events read, %u key presses of %u sent\n", statistics.events - skippedEvents,
+           statistics.events, keyDownEvents, keyPresses);
+    bool eventsComplete = skippedEvents > 0 || keyDownEvents == keyPresses;
+    return ledFrames > 0 && statistics.commandsApplied > 0 && statistics.commandsFailed == 0 && eventsComplete ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--socketpair") == 0) {
+        return runSelfTest(argc > 2 ? strtoul(argv[2], nullptr, 0) : 100000);
+    }
+    if (argc < 3) {
+        printf("Usage: %s <interface> <node id>...\n       %s --socketpair [frames]\n", argv[0], argv[0]);
+        return 2;
+    }
+    return runGateway(argv[1], argc - 2, &argv[2]);
+}
@@ -0,0 +1,269 @@
+/**
+ * @brief   Deterministic host replay of recorded keypad traffic
+ * @author  Stefan Hirschenberger
+ *
+ * Reads a log written by PkpRecorder (candump -l text or binary records) or by candump itself,
+ * feeds the received frames through Pkp::process() on a virtual clock and compares the frames
+ * transmitted by the library with the transmitted frames of the log. Between two logged frames
+ * the clock advances in 1 ms steps with a call of getStatus() per step, like a main loop would,
+ * so timeouts, heartbeats and reconnects are reproduced at the logged times. The replay runs as
+ * fast as the host allows and reports the speed relative to real time.
+ *
+ * Logs of candump without the rx/tx interface names of PkpRecorder are split by COB-ID: NMT
+ * commands and the RPDOs and SDO requests to the replayed node are compared as transmitted
+ * frames, all other frames are received frames.
+ *
+ * The transmitted frames only match if the keypad is configured like in the recorded application,
+ * adapt configureKeypad() accordingly.
+ *
+ * Usage: pkp_replay <log> [node id] [output log]
+ *        The optional output log receives the replayed traffic in candump -l format.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include <BlinkMarinePkpCanOpen.h>
+#include <PkpRecorder.h>
+
+static constexpr uint32_t TICK_US = 1000;
+
+struct Record {
+    uint64_t         timestamp; // microseconds since the first record
+    struct can_frame frame;
+    bool             transmitted;
+};
+
+class FilePrint : public Print {
+  public:
+    explicit FilePrint(FILE* file) : _file(file) {
+    }
+
+    size_t write(uint8_t value) override {
+        return fputc(value, _file) == EOF ? 0 : 1;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        return fwrite(buffer, 1, size, _file);
+    }
+
+  private:
+    FILE* _file;
+};
+
+static std::vector<Record> expectedTx;
+static std::vector<Record> producedTx;
+static uint64_t            clockOffset = 0;
+
+uint8_t captureTxCallback(const struct can_frame& txMsg) {
+    producedTx.push_back({hostGetClock() - clockOffset, txMsg, true});
+    return 0;
+}
+
+// Mirror the setup() of the recorded application here
+static void configureKeypad(Pkp& keypad) {
+    keypad.begin();
+}
+
+static bool isTransmittedFrame(uint32_t canId, uint8_t nodeId) {
+    if (canId == 0x000) {
+        return true;
+    }
+    uint32_t function = canId & 0x780;
+    bool     rpdo     = function == 0x200 || function == 0x300 || function == 0x400 || function == 0x500;
+    return (canId & 0x7F) == nodeId && (rpdo || function == 0x600);
+}
+
+static bool parseCandumpLine(const char* line, uint8_t nodeId, Record& record) {
+    unsigned long seconds;
+    unsigned long microseconds;
+    char          interface[32];
+    char          frameText[64];
+    if (sscanf(line, " (%lu.%lu) %31s %63s", &seconds, &microseconds, interface, frameText) != 4) {
+        return false;
+    }
+
+    char*         hash  = strchr(frameText, '#');
+    unsigned long canId = strtoul(frameText, nullptr, 16);
+    if (hash == nullptr || canId > 0x7FF) {
+        return false;
+    }
+
+    record.timestamp    = (uint64_t)seconds * 1000000 + microseconds;
+    record.frame        = can_frame();
+    record.frame.can_id = canId;
+    const char* data    = hash + 1;
+    while (record.frame.can_dlc < 8 && data[0] != '\0' && data[1] != '\0') {
+        char byteText[3] = {data[0], data[1], '\0'};
+        record.frame.data[record.frame.can_dlc++] = (uint8_t)strtoul(byteText, nullptr, 16);
+        data += 2;
+    }
+
+    if (strcmp(interface, "tx") == 0) {
+        record.transmitted = true;
+    } else if (strcmp(interface, "rx") == 0) {
+        record.transmitted = false;
+    } else {
+        record.transmitted = isTransmittedFrame(canId, nodeId);
+    }
+    return true;
+}
+
+static bool loadLog(const char* path, uint8_t nodeId, std::vector<Record>& records) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    int first = fgetc(file);
+    ungetc(first, file);
+
+    if (first == '(') {
+        char line[256];
+        while (fgets(line, sizeof(line), file) != nullptr) {
+            Record record;
+            if (parseCandumpLine(line, nodeId, record)) {
+                records.push_back(record);
+            }
+        }
+    } else {
+        // 32 bit timestamps of binary records wrap after 71 minutes
+        uint8_t  buffer[PkpRecorder::BINARY_RECORD_SIZE];
+        uint32_t lastTimestamp = 0;
+        uint64_t timestamp     = 0;
+        while (fread(buffer, 1, sizeof(buffer), file) == sizeof(buffer)) {
+            Record   record;
+            uint32_t raw = buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+            uint16_t id  = buffer[4] | (buffer[5] << 8);
+            timestamp            += records.empty() ? raw : (uint32_t)(raw - lastTimestamp);
+            lastTimestamp        = raw;
+            record.timestamp     = timestamp;
+            record.frame         = can_frame();
+            record.frame.can_id  = id & 0x7FF;
+            record.frame.can_dlc = min(buffer[6], (uint8_t)8);
+            record.transmitted   = (id & PkpRecorder::BINARY_TX_FLAG) != 0;
+            memcpy(record.frame.data, &buffer[8], record.frame.can_dlc);
+            records.push_back(record);
+        }
+    }
+    fclose(file);
+
+    // Replay relative to the first record
+    if (!records.empty()) {
+        uint64_t start = records.front().timestamp;
+        for (Record& record : records) {
+            record.timestamp -= start;
+        }
+    }
+    return true;
+}
+
+static void printFrame(const char* label, const Record& record) {
+    printf("  %-9s %10.6f s  %03" PRIX32 "#", label, record.timestamp / 1e6, record.frame.can_id);
+    for (uint8_t i = 0; i < record.frame.can_dlc; i++) {
+        printf("%02X", record.frame.data[i]);
+    }
+    printf("\n");
+}
+
+static bool sameFrame(const struct can_frame& a, const struct can_frame& b) {
+    return a.can_id == b.can_id && a.can_dlc == b.can_dlc && memcmp(a.data, b.data, a.can_dlc) == 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("Usage: %s <log> [node id] [output log]\n", argv[0]);
+        return 2;
+    }
+    uint8_t nodeId = 0x15;
+    if (argc > 2) {
+        nodeId = (uint8_t)strtoul(argv[2], nullptr, 0);
+    }
+
+    std::vector<Record> records;
+    if (!loadLog(argv[1], nodeId, records)) {
+        printf("Cannot read %s\n", argv[1]);
+        return 2;
+    }
+
+    hostUseVirtualClock(true);
+    clockOffset = hostGetClock();
+
+    FILE*        outputFile = nullptr;
+    FilePrint*   output     = nullptr;
+    PkpRecorder* recorder   = nullptr;
+    if (argc > 3) {
+        outputFile = fopen(argv[3], "w");
+        if (outputFile == nullptr) {
+            printf("Cannot write %s\n", argv[3]);
+            return 2;
+        }
+        output   = new FilePrint(outputFile);
+        recorder = new PkpRecorder(*output);
+    }
+
+    Pkp keypad(nodeId, captureTxCallback);
+    keypad.attachRecorder(recorder);
+
+    auto     wallStart = std::chrono::steady_clock::now();
+    uint32_t rxCount   = 0;
+    configureKeypad(keypad);
+    for (const Record& record : records) {
+        while (hostGetClock() - clockOffset + TICK_US <= record.timestamp) {
+            hostAdvanceClock(TICK_US);
+            keypad.getStatus();
+        }
+        hostAdvanceClock((uint32_t)(record.timestamp - (hostGetClock() - clockOffset)));
+
+        if (record.transmitted) {
+            expectedTx.push_back(record);
+        } else {
+            keypad.process(record.frame);
+            rxCount++;
+        }
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    if (outputFile != nullptr) {
+        fclose(outputFile);
+    }
+
+    double traceSeconds = records.empty() ? 0.0 : records.back().timestamp / 1e6;
+    printf("%u records, %u received, %u transmitted, %.3f s trace\n", (unsigned)records.size(), rxCount, (unsigned)expectedTx.size(),
+           traceSeconds);
+    printf("replayed in %.3f s (%.0fx real time, %.0f frames/s)\n", wallSeconds, wallSeconds > 0 ? traceSeconds / wallSeconds : 0.0,
+           wallSeconds > 0 ? records.size() / wallSeconds : 0.0);
+
+    size_t   compared  = min(expectedTx.size(), producedTx.size());
+    size_t   mismatch  = compared;
+    uint64_t maxSkewUs = 0;
+    for (size_t i = 0; i < compared; i++) {
+        if (!sameFrame(expectedTx[i].frame, producedTx[i].frame)) {
+            mismatch = i;
+            break;
+        }
+        uint64_t skew = expectedTx[i].timestamp > producedTx[i].timestamp ? expectedTx[i].timestamp - producedTx[i].timestamp
+                                                                          : producedTx[i].timestamp - expectedTx[i].timestamp;
+        maxSkewUs = max(maxSkewUs, skew);
+    }
+
+    printf("TX frames: %u expected, %u produced, %u identical, max skew %.3f ms\n", (unsigned)expectedTx.size(), (unsigned)producedTx.size(),
+           (unsigned)mismatch, maxSkewUs / 1e3);
+    if (mismatch == compared && expectedTx.size() == producedTx.size()) {
+        printf("TX output identical\n");
+        return 0;
+    }
+
+    printf("TX output differs at frame %u\n", (unsigned)mismatch);
+    if (mismatch < expectedTx.size()) {
+        printFrame("expected", expectedTx[mismatch]);
+    }
+    if (mismatch < producedTx.size()) {
+        printFrame("produced", producedTx[mismatch]);
+    }
+    return 1;
+}
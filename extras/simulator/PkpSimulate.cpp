@@ -0,0 +1,391 @@
+/**
+ * @brief   End-to-end measurements against simulated keypads
+ * @author  Stefan Hirschenberger
+ *
+ * Connects the library to simulated PKP-3500-SI-MT keypads (PkpSimulator) through a loopback bus
+ * and runs four scenarios on the virtual clock of the host shim:
+ *
+ * - latency:   key press to LED update of one keypad in toggle mode
+ * - reconnect: time from power-up of a keypad until its configuration and LEDs are restored,
+ *              for several lengths of the preceding power loss
+ * - startup:   time until all keypads are configured and the peak transmit backlog, for
+ *              begin() on each keypad versus one PkpBus::begin()
+ * - stress:    random key, encoder and wired input activity on several keypads sharing one
+ *              PkpBus, reporting bus load (measured by the loopback and estimated by PkpBusLoad),
+ *              latency and LED states that diverged from the key states,
+ *              plus the counters and timings of Pkp::getStats() if built with PKP_STATS
+ *
+ * The application loop (PkpBus::poll(), draining the event queues) runs once per millisecond,
+ * received frames are processed immediately like from a receive interrupt.
+ *
+ * Usage: pkp_simulate [keypads] [seconds] [bitrate]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <BlinkMarinePkpCanOpen.h>
+#include <PkpBus.h>
+#include <PkpBusLoad.h>
+
+#include "PkpSimulator.h"
+
+static constexpr uint32_t STEP_US        = 10;
+static constexpr uint32_t LOOP_PERIOD_US = 1000;
+static constexpr uint8_t  FIRST_NODE_ID  = 0x15;
+
+static PkpLoopback*               loopback = nullptr;
+static PkpBus*                    bus      = nullptr;
+static PkpBusLoad*                busLoad  = nullptr;
+static std::vector<Pkp*>          keypads;
+static std::vector<PkpBusLoad*>   nodeLoads;
+static std::vector<PkpSimulator*> devices;
+static uint64_t                   nextLoop = 0;
+static uint32_t                   rng      = 12345;
+
+struct latency_t {
+    uint32_t count = 0;
+    uint64_t sum   = 0;
+    uint32_t min   = UINT32_MAX;
+    uint32_t max   = 0;
+
+    void add(uint32_t us) {
+        count++;
+        sum += us;
+        min = ::min(min, us);
+        max = ::max(max, us);
+    }
+
+    void print(const char* label) {
+        if (count == 0) {
+            printf("%-22s no samples\n", label);
+            return;
+        }
+        printf("%-22s %6u samples, min %7.3f ms, avg %7.3f ms, max %7.3f ms\n", label, count, min / 1e3, (double)sum / count / 1e3, max / 1e3);
+    }
+};
+
+uint8_t loopbackTransmit(const struct can_frame& txMsg) {
+    return loopback->send(txMsg);
+}
+
+void busReceive(const struct can_frame& rxMsg) {
+    bus->process(rxMsg);
+}
+
+static uint32_t random(uint32_t range) {
+    rng = rng * 1103515245u + 12345u;
+    return (rng >> 8) % range;
+}
+
+static void setup(uint8_t keypadCount, uint32_t bitrate, bool fleetStart = false) {
+    for (Pkp* keypad : keypads) {
+        delete keypad;
+    }
+    for (PkpSimulator* device : devices) {
+        delete device;
+    }
+    for (PkpBusLoad* nodeLoad : nodeLoads) {
+        delete nodeLoad;
+    }
+    keypads.clear();
+    devices.clear();
+    nodeLoads.clear();
+    delete bus;
+    delete busLoad;
+    delete loopback;
+
+    loopback = new PkpLoopback(bitrate);
+    bus      = new PkpBus();
+    busLoad  = new PkpBusLoad(bitrate);
+    loopback->setHostReceiver(busReceive);
+    bus->attachBusLoad(busLoad);
+
+    const uint8_t colors[4] = {Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_GREEN, Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK};
+    const uint8_t blinks[4] = {Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK};
+    for (uint8_t n = 0; n < keypadCount; n++) {
+        PkpSimulator* device = new PkpSimulator(FIRST_NODE_ID + n);
+        loopback->attach(*device);
+        device->powerOn();
+        devices.push_back(device);
+
+        Pkp* keypad = new Pkp(FIRST_NODE_ID + n, loopbackTransmit, 100);
+        for (uint8_t i = 0; i < Pkp::KEY_AMOUNT; i++) {
+            keypad->setKeyColor(i, colors, blinks);
+            keypad->setKeyMode(i, Pkp::KEY_MODE_TOGGLE);
+        }
+        keypad->setBacklight(Pkp::BACKLIGHT_BLUE, 60);
+        keypad->setKeyBrightness(80);
+        keypad->initializeEncoder((uint8_t)Pkp::encoderIndex_e::ENCODER_1, 0x10, 8);
+        PkpBusLoad* nodeLoad = new PkpBusLoad(bitrate);
+        nodeLoad->attachTotal(busLoad);
+        keypad->attachBusLoad(nodeLoad);
+        nodeLoads.push_back(nodeLoad);
+
+        bus->attach(*keypad);
+        if (!fleetStart) {
+            keypad->begin();
+        }
+        keypads.push_back(keypad);
+    }
+    if (fleetStart) {
+        bus->begin();
+    }
+    nextLoop = hostGetClock();
+}
+
+// Advances the virtual clock, running the bus, the keypads and the application loop
+static void run(uint32_t us) {
+    uint64_t end = hostGetClock() + us;
+    while (hostGetClock() < end) {
+        hostAdvanceClock(STEP_US);
+        loopback->poll();
+        if (hostGetClock() >= nextLoop) {
+            nextLoop += LOOP_PERIOD_US;
+            bus->poll();
+            Pkp::event_t event;
+            for (Pkp* keypad : keypads) {
+                while (keypad->nextEvent(event)) {
+                }
+            }
+            for (PkpSimulator* device : devices) {
+                device->poll();
+            }
+        }
+    }
+}
+
+// The green LEDs show which keys are in state 1
+static bool ledsMatch(uint8_t n) {
+    uint16_t expected = 0;
+    for (uint8_t i = 0; i < Pkp::KEY_AMOUNT; i++) {
+        expected |= (keypads[n]->getKeyState(i) == 1) << i;
+    }
+    return devices[n]->getKeyLeds(1) == expected;
+}
+
+// Presses and releases a key, returns the time until the LEDs changed or 0 if they did not
+static uint32_t pressKey(uint8_t n, uint8_t key, uint32_t holdUs) {
+    uint32_t pressed = micros();
+    devices[n]->setKeys(1 << key);
+    run(holdUs);
+    devices[n]->setKeys(0);
+    uint32_t ledTimestamp = devices[n]->getLedTimestamp();
+    return (int32_t)(ledTimestamp - pressed) > 0 ? ledTimestamp - pressed : 0;
+}
+
+// Key states fall back to their defaults once the communication loss is detected, so the LEDs are compared with the current key states
+static bool configurationRestored(uint8_t n) {
+    PkpSimulator* device = devices[n];
+    return device->getNmtState() == Pkp::NMT_OPERATIONAL && device->getHeartbeatTime() == 100 && device->getKeyBrightness() == 0x3F * 80 / 100
+           && device->getBacklightColor() == Pkp::BACKLIGHT_BLUE && device->getBacklightBrightness() == 0x3F * 60 / 100 && ledsMatch(n)
+           && keypads[n]->getStatus() == Pkp::KPS_RX_WITHIN_LAST_SECOND;
+}
+
+static void latencyScenario(uint32_t bitrate) {
+    setup(1, bitrate);
+    run(500000);
+
+    latency_t latency;
+    uint32_t  missed = 0;
+    for (uint32_t i = 0; i < 500; i++) {
+        uint32_t us = pressKey(0, random(Pkp::KEY_AMOUNT), 20000 + random(30000));
+        if (us == 0) {
+            missed++;
+        } else {
+            latency.add(us);
+        }
+        run(20000 + random(30000));
+    }
+    printf("\nLatency, 1 keypad\n");
+    latency.print("key press to LED");
+    printf("%-22s %6u\n", "presses without LED", missed);
+}
+
+static void reconnectScenario(uint32_t bitrate) {
+    static const uint32_t offTimes[] = {50, 1000, 5000, 30000, 120000};
+
+    setup(1, bitrate);
+    run(500000);
+
+    printf("\nReconnect, 1 keypad, power loss of\n");
+    for (uint32_t offMs : offTimes) {
+        pressKey(0, 3, 20000);
+        run(100000);
+        devices[0]->powerOff();
+        run(offMs * 1000);
+        devices[0]->powerOn();
+
+        uint32_t restoredUs = 0;
+        for (uint32_t t = 0; t < 60000; t++) {
+            run(1000);
+            if (configurationRestored(0)) {
+                restoredUs = (t + 1) * 1000;
+                break;
+            }
+        }
+        if (restoredUs == 0) {
+            printf("%8u ms: not restored within 60 s\n", offMs);
+        } else {
+            printf("%8u ms: restored %7.3f ms after power-up\n", offMs, restoredUs / 1e3);
+        }
+        run(1000000);
+    }
+}
+
+static void startupScenario(uint8_t keypadCount, uint32_t bitrate) {
+    printf("\nStartup, %u keypads\n", keypadCount);
+    for (bool fleetStart : {false, true}) {
+        setup(keypadCount, bitrate, fleetStart);
+
+        uint32_t frameStart  = loopback->getFrameCount();
+        uint32_t peakBacklog = loopback->getPending();
+        uint32_t readyUs     = 0;
+        for (uint32_t t = 0; t < 10000 && readyUs == 0; t++) {
+            run(100);
+            peakBacklog = max(peakBacklog, loopback->getPending());
+            bool ready  = true;
+            for (uint8_t n = 0; n < keypadCount && ready; n++) {
+                ready = configurationRestored(n);
+            }
+            readyUs = ready ? (t + 1) * 100 : 0;
+        }
+
+        const char* label = fleetStart ? "PkpBus::begin()" : "begin() per keypad";
+        if (readyUs == 0) {
+            printf("%-22s not configured within 1 s\n", label);
+        } else {
+            printf("%-22s configured after %7.3f ms, %4u frames, peak backlog %3u frames\n", label, readyUs / 1e3, loopback->getFrameCount() - frameStart,
+                   peakBacklog);
+        }
+    }
+}
+
+#if PKP_STATS
+static void printTiming(const char* label, const Pkp::timing_t& timing) {
+    printf("%-22s %6u calls, min %4u us, max %4u us, histogram", label, timing.count, timing.count ? timing.min : 0, timing.max);
+    for (uint8_t bin = 0; bin < Pkp::TIMING_BINS; bin++) {
+        printf(" %u", timing.histogram[bin]);
+    }
+    printf("\n");
+}
+
+// The counters of the keypad with the most received frames, since the end of the startup phase
+static void printStats() {
+    Pkp::stats_t stats = {};
+    uint32_t     most  = 0;
+    for (Pkp* keypad : keypads) {
+        Pkp::stats_t candidate;
+        keypad->getStats(candidate);
+        uint32_t rx = 0;
+        for (uint8_t type = 0; type < Pkp::RX_TYPE_AMOUNT; type++) {
+            rx += candidate.rxFrames[type];
+        }
+        if (rx >= most) {
+            most  = rx;
+            stats = candidate;
+        }
+    }
+    printf("%-22s keys %u, encoder %u, wired in %u, heartbeat %u, SDO %u, foreign %u\n", "busiest keypad rx", stats.rxFrames[Pkp::RX_KEYS],
+           stats.rxFrames[Pkp::RX_ENCODER], stats.rxFrames[Pkp::RX_WIRED_IN], stats.rxFrames[Pkp::RX_HEARTBEAT], stats.rxFrames[Pkp::RX_SDO],
+           stats.rxFrames[Pkp::RX_FOREIGN]);
+    printf("%-22s %u frames, %u errors, %u LED frames suppressed\n", "busiest keypad tx", stats.txFrames, stats.txErrors, stats.ledSuppressed);
+    printf("%-22s %u watchdog trips, %u initializations, %u reconfigurations\n", "busiest keypad status", stats.watchdogTrips, stats.initializations,
+           stats.reconfigurations);
+    printTiming("process time", stats.processTime);
+    printTiming("update time", stats.updateTime);
+}
+#endif
+
+static void stressScenario(uint8_t keypadCount, uint32_t seconds, uint32_t bitrate) {
+    setup(keypadCount, bitrate);
+    run(500000);
+
+    for (Pkp* keypad : keypads) {
+        keypad->resetStats();
+    }
+    busLoad->reset();
+    for (PkpBusLoad* nodeLoad : nodeLoads) {
+        nodeLoad->reset();
+    }
+    uint64_t busyStart  = loopback->getBusyTime();
+    uint32_t frameStart = loopback->getFrameCount();
+    uint64_t timeStart  = hostGetClock();
+
+    std::vector<uint32_t> pressTime(keypadCount, 0);
+    std::vector<uint32_t> releaseTime(keypadCount, 0);
+    latency_t             latency;
+    for (uint32_t ms = 0; ms < seconds * 1000; ms++) {
+        uint32_t now = micros();
+        for (uint8_t n = 0; n < keypadCount; n++) {
+            PkpSimulator* device = devices[n];
+            if (pressTime[n] != 0 && (int32_t)(device->getLedTimestamp() - pressTime[n]) > 0) {
+                latency.add(device->getLedTimestamp() - pressTime[n]);
+                pressTime[n] = 0;
+            }
+            if (releaseTime[n] != 0 && (int32_t)(now - releaseTime[n]) >= 0) {
+                device->setKeys(0);
+                releaseTime[n] = 0;
+            } else if (releaseTime[n] == 0 && random(100) == 0) {
+                device->setKeys(1 << random(Pkp::KEY_AMOUNT));
+                pressTime[n]   = now;
+                releaseTime[n] = now + 20000 + random(80000);
+            }
+            if (random(20) == 0) {
+                device->turnEncoder(random(2), random(2) ? 1 : -1);
+            }
+            if (random(50) == 0) {
+                device->setWiredInput(random(4), random(501));
+            }
+        }
+        run(1000);
+    }
+    run(200000);
+
+    uint8_t mismatches = 0;
+    for (uint8_t n = 0; n < keypadCount; n++) {
+        mismatches += !ledsMatch(n);
+    }
+    uint64_t elapsed = hostGetClock() - timeStart;
+    printf("\nStress, %u keypads, %u s\n", keypadCount, seconds);
+    printf("%-22s %6u (%.0f frames/s)\n", "frames", loopback->getFrameCount() - frameStart, (loopback->getFrameCount() - frameStart) * 1e6 / elapsed);
+    printf("%-22s %6.1f %%\n", "bus load", (loopback->getBusyTime() - busyStart) * 100.0 / elapsed);
+
+    // The library weights each frame with its worst-case length, so its figures are upper bounds of the above
+    uint32_t nodeBits = 0;
+    for (PkpBusLoad* nodeLoad : nodeLoads) {
+        nodeBits = max(nodeBits, nodeLoad->getBitCount());
+    }
+    printf("%-22s %6.1f %%, peak %.1f %% in 1 s window\n", "bus load (PkpBusLoad)", busLoad->getBitCount() * 1e8 / bitrate / elapsed,
+           busLoad->getPeakLoad() / 10.0);
+    printf("%-22s %6.1f %%\n", "busiest keypad load", nodeBits * 1e8 / bitrate / elapsed);
+    latency.print("key press to LED");
+    printf("%-22s %6u\n", "LED mismatches", mismatches);
+#if PKP_STATS
+    printStats();
+#endif
+}
+
+int main(int argc, char** argv) {
+    uint8_t  keypadCount = PKP_BUS_MAX_NODES;
+    uint32_t seconds     = 60;
+    uint32_t bitrate     = 250000;
+    if (argc > 1) {
+        keypadCount = constrain(strtoul(argv[1], nullptr, 0), 1, PKP_BUS_MAX_NODES);
+    }
+    if (argc > 2) {
+        seconds = strtoul(argv[2], nullptr, 0);
+    }
+    if (argc > 3) {
+        bitrate = strtoul(argv[3], nullptr, 0);
+    }
+
+    hostUseVirtualClock(true);
+    printf("Simulated bus at %u bit/s, application loop every %u us\n", bitrate, LOOP_PERIOD_US);
+    latencyScenario(bitrate);
+    reconnectScenario(bitrate);
+    startupScenario(keypadCount, bitrate);
+    stressScenario(keypadCount, seconds, bitrate);
+    return 0;
+}
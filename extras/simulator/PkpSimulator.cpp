@@ -0,0 +1,557 @@
+
+#include "PkpSimulator.h"
+
+#include <algorithm>
+
+//********** LOOPBACK **********
+
+/**
+ * @brief Constructs a loopback bus.
+ *
+ * @param bitrate The simulated bitrate in bit/s, it determines how long each frame occupies the bus.
+ */
+PkpLoopback::PkpLoopback(uint32_t bitrate) : _bitrate(bitrate) {
+}
+
+/**
+ * @brief Connects a simulated keypad to the bus.
+ *
+ * @param device The keypad to connect. It must outlive the loopback.
+ */
+void PkpLoopback::attach(PkpSimulator& device) {
+    _devices.push_back(&device);
+    device._loopback = this;
+}
+
+/**
+ * @brief Returns the accumulated time the bus was occupied by frames.
+ *
+ * @return The busy time in microseconds, divided by the elapsed time it gives the bus load.
+ */
+uint64_t PkpLoopback::getBusyTime() {
+    return _busyTime;
+}
+
+/**
+ * @brief Returns the number of frames transmitted over the bus.
+ *
+ * @return The number of delivered frames.
+ */
+uint32_t PkpLoopback::getFrameCount() {
+    return _frameCount;
+}
+
+/**
+ * @brief Returns the number of frames waiting for the bus, including the frame in transmission.
+ *
+ * @return The number of pending frames.
+ */
+uint32_t PkpLoopback::getPending() {
+    return _pending.size() + (_busActive ? 1 : 0);
+}
+
+/**
+ * @brief Delivers all frames whose transmission completed until now.
+ *
+ * A delivered frame is passed to the host receiver and to all powered keypads except its sender. Frames queued
+ * while the bus was busy win the arbitration in COB-ID order. Has to be called at least once per frame time for
+ * realistic timing.
+ */
+void PkpLoopback::poll() {
+    uint64_t now = hostGetClock();
+    while (true) {
+        if (_busActive) {
+            if (_busyUntil > now) {
+                return;
+            }
+            _busActive = false;
+            _frameCount++;
+
+            // Copy first, receivers may queue new frames
+            pendingFrame_t delivered = _current;
+            if (delivered.sender != nullptr && _hostReceiver != nullptr) {
+                _hostReceiver(delivered.frame);
+            }
+            for (PkpSimulator* device : _devices) {
+                if (device != delivered.sender && device->isPowered()) {
+                    device->receive(delivered.frame);
+                }
+            }
+        }
+
+        if (_pending.empty()) {
+            return;
+        }
+
+        auto next = std::min_element(_pending.begin(), _pending.end(), [](const pendingFrame_t& a, const pendingFrame_t& b) {
+            return a.frame.can_id != b.frame.can_id ? a.frame.can_id < b.frame.can_id : a.sequence < b.sequence;
+        });
+        uint32_t frameTime = _frameTime(next->frame);
+        _current           = *next;
+        _pending.erase(next);
+
+        // A frame queued on an idle bus starts right away, otherwise directly after the previous frame
+        _busyUntil = max(_busyUntil, now) + frameTime;
+        _busyTime  += frameTime;
+        _busActive = true;
+    }
+}
+
+/**
+ * @brief Queues a frame for transmission.
+ *
+ * Matches CanMsgTxCallback for frames sent by the library, when wrapped in a function without the sender argument.
+ *
+ * @param frame The frame to transmit.
+ * @param sender The sending keypad, nullptr for frames of the library.
+ * @return Always 0, the loopback never rejects frames.
+ */
+uint8_t PkpLoopback::send(const struct can_frame& frame, PkpSimulator* sender) {
+    _pending.push_back({frame, sender, _sequence++});
+    return 0;
+}
+
+/**
+ * @brief Sets the function receiving all frames sent by the simulated keypads, e.g. a wrapper of Pkp::process().
+ *
+ * @param sink The receiver, called from poll().
+ */
+void PkpLoopback::setHostReceiver(FrameSink sink) {
+    _hostReceiver = sink;
+}
+
+uint32_t PkpLoopback::_frameTime(const struct can_frame& frame) {
+    // Standard frame with 47 bits overhead, stuff bits estimated for random payload
+    uint32_t bits = 47 + 8 * frame.can_dlc + (34 + 8 * frame.can_dlc) / 5;
+    return (bits * 1000000uL + _bitrate - 1) / _bitrate;
+}
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs a simulated keypad, which stays powered off until powerOn() is called.
+ *
+ * @param nodeId The CAN node ID of the keypad.
+ * @param keyAmount Number of keys (up to 16).
+ * @param encoderAmount Number of rotary encoders (up to 2).
+ * @param wiredInAmount Number of wired inputs (up to 4).
+ */
+PkpSimulator::PkpSimulator(uint8_t nodeId, uint8_t keyAmount, uint8_t encoderAmount, uint8_t wiredInAmount)
+    : _encoderAmount(min(encoderAmount, (uint8_t)2)), _keyAmount(min(keyAmount, (uint8_t)16)), _nodeId(nodeId),
+      _wiredInAmount(min(wiredInAmount, (uint8_t)4)) {
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Returns the backlight brightness of the last backlight RPDO.
+ *
+ * @return The brightness (0 to 0x3F).
+ */
+uint8_t PkpSimulator::getBacklightBrightness() {
+    return _backlightBrightness;
+}
+
+/**
+ * @brief Returns the backlight color of the last backlight RPDO.
+ *
+ * @return The color as keyBacklight_e.
+ */
+uint8_t PkpSimulator::getBacklightColor() {
+    return _backlightColor;
+}
+
+/**
+ * @brief Returns the LED ring state of an encoder.
+ *
+ * @param encoderIndex The index of the encoder.
+ * @return One bit per LED of the last encoder LED RPDO.
+ */
+uint16_t PkpSimulator::getEncoderLeds(uint8_t encoderIndex) {
+    return encoderIndex < _encoderAmount ? _encoderLeds[encoderIndex] : 0;
+}
+
+/**
+ * @brief Returns the position of an encoder.
+ *
+ * @param encoderIndex The index of the encoder.
+ * @return The position, starting at the start value written by SDO.
+ */
+uint16_t PkpSimulator::getEncoderPosition(uint8_t encoderIndex) {
+    return encoderIndex < _encoderAmount ? _encoderPosition[encoderIndex] : 0;
+}
+
+/**
+ * @brief Returns the heartbeat producer time (object 0x1017).
+ *
+ * @return The heartbeat interval in milliseconds, 0 if disabled.
+ */
+uint16_t PkpSimulator::getHeartbeatTime() {
+    return _getObject(0x1017, 0x00);
+}
+
+/**
+ * @brief Returns the key brightness (object 0x2003 sub 1).
+ *
+ * @return The brightness (0 to 0x3F).
+ */
+uint8_t PkpSimulator::getKeyBrightness() {
+    return _getObject(0x2003, 0x01);
+}
+
+/**
+ * @brief Returns the key LED state of one color.
+ *
+ * @param color 0 for red, 1 for green, 2 for blue.
+ * @param blink False for the solid LEDs (RPDO1), true for the blinking LEDs (RPDO2).
+ * @return One bit per key.
+ */
+uint16_t PkpSimulator::getKeyLeds(uint8_t color, bool blink) {
+    return color < 3 ? _keyLeds[blink][color] : 0;
+}
+
+/**
+ * @brief Returns the time of the last LED RPDO that changed the LED state.
+ *
+ * @return The timestamp in microseconds (micros()).
+ */
+uint32_t PkpSimulator::getLedTimestamp() {
+    return _ledTimestamp;
+}
+
+/**
+ * @brief Returns the NMT state.
+ *
+ * @return The state as reported in the heartbeat (see Pkp::nmtState_e).
+ */
+uint8_t PkpSimulator::getNmtState() {
+    return _nmtState;
+}
+
+/**
+ * @brief Returns the CAN node ID.
+ *
+ * @return The node ID given to the constructor.
+ */
+uint8_t PkpSimulator::getNodeId() {
+    return _nodeId;
+}
+
+/**
+ * @brief Returns the number of SDO requests answered.
+ *
+ * @return The number of SDO requests since construction.
+ */
+uint32_t PkpSimulator::getSdoCount() {
+    return _sdoCount;
+}
+
+/**
+ * @brief Returns whether the keypad is powered.
+ *
+ * @return True between powerOn() and powerOff().
+ */
+bool PkpSimulator::isPowered() {
+    return _powered;
+}
+
+/**
+ * @brief Produces the heartbeat, has to be called cyclically.
+ */
+void PkpSimulator::poll() {
+    uint16_t interval = getHeartbeatTime();
+    if (!_powered || interval == 0) {
+        return;
+    }
+
+    uint32_t now = millis();
+    if (now - _heartbeatTimestamp >= interval) {
+        _heartbeatTimestamp = now;
+        _send(0x700, 1, &_nmtState);
+    }
+}
+
+/**
+ * @brief Disconnects the keypad from the bus, e.g. to simulate a broken cable or a power loss.
+ */
+void PkpSimulator::powerOff() {
+    _powered = false;
+}
+
+/**
+ * @brief Powers the keypad up.
+ *
+ * The keypad starts with its default configuration (no heartbeat, LEDs off), sends its boot-up message and
+ * enters the pre-operational state.
+ */
+void PkpSimulator::powerOn() {
+    _powered = true;
+    _resetNode();
+}
+
+/**
+ * @brief Processes a frame from the bus, called by the loopback.
+ *
+ * @param frame The received frame.
+ */
+void PkpSimulator::receive(const struct can_frame& frame) {
+    if (frame.can_id == 0x000) {
+        if (frame.can_dlc < 2 || (frame.data[1] != 0 && frame.data[1] != _nodeId)) {
+            return;
+        }
+        switch (frame.data[0]) {
+            case 0x01:
+                _nmtState = PkpBase::NMT_OPERATIONAL;
+                break;
+            case 0x02:
+                _nmtState = PkpBase::NMT_STOPPED;
+                break;
+            case 0x80:
+                _nmtState = PkpBase::NMT_PRE_OPERATIONAL;
+                break;
+            case 0x81:
+            case 0x82:
+                _resetNode();
+                break;
+        }
+        return;
+    }
+
+    if ((frame.can_id & 0x7F) != _nodeId || _nmtState == PkpBase::NMT_STOPPED) {
+        return;
+    }
+
+    uint32_t function = frame.can_id & 0x780;
+    if (function == 0x600) {
+        _receiveSdo(frame);
+        return;
+    }
+    if (_nmtState != PkpBase::NMT_OPERATIONAL) {
+        return;
+    }
+
+    switch (function) {
+        case 0x200:
+            _receiveKeyLeds(frame, false);
+            break;
+        case 0x300:
+            _receiveKeyLeds(frame, true);
+            break;
+        case 0x400:
+            for (uint8_t i = 0; i < _encoderAmount && frame.can_dlc >= 2 * (i + 1); i++) {
+                uint16_t leds = frame.data[2 * i] | (frame.data[2 * i + 1] << 8);
+                if (_encoderLeds[i] != leds) {
+                    _encoderLeds[i] = leds;
+                    _ledTimestamp   = micros();
+                }
+            }
+            break;
+        case 0x500:
+            if (frame.can_dlc >= 2 && (_backlightBrightness != frame.data[0] || _backlightColor != frame.data[1])) {
+                _backlightBrightness = frame.data[0];
+                _backlightColor      = frame.data[1];
+                _ledTimestamp        = micros();
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Sets the pressed keys and sends the key TPDO on a change.
+ *
+ * @param pressedMask One bit per pressed key.
+ */
+void PkpSimulator::setKeys(uint16_t pressedMask) {
+    pressedMask &= (1uL << _keyAmount) - 1;
+    if (pressedMask != _keysPressed) {
+        _keysPressed = pressedMask;
+        _sendKeys();
+    }
+}
+
+/**
+ * @brief Sets the value of a wired input and sends the wired input TPDO.
+ *
+ * @param inputIndex The index of the input.
+ * @param value The raw value, the library maps 0..500 to 0..255.
+ */
+void PkpSimulator::setWiredInput(uint8_t inputIndex, uint16_t value) {
+    if (inputIndex >= _wiredInAmount) {
+        return;
+    }
+    _wiredInput[inputIndex] = value;
+    _sendWiredInputs();
+}
+
+/**
+ * @brief Turns an encoder and sends the encoder TPDO.
+ *
+ * The position is limited to the top value (object 0x2000 sub 6/7, 0 for no limit).
+ *
+ * @param encoderIndex The index of the encoder.
+ * @param ticks Clockwise ticks, negative for counterclockwise.
+ */
+void PkpSimulator::turnEncoder(uint8_t encoderIndex, int8_t ticks) {
+    if (encoderIndex >= _encoderAmount || ticks == 0) {
+        return;
+    }
+    uint16_t topValue = _getObject(0x2000, 0x06 + encoderIndex);
+    int32_t  position = _encoderPosition[encoderIndex] + ticks;
+    if (topValue != 0) {
+        position = constrain(position, 0, topValue);
+    }
+    _encoderPosition[encoderIndex] = position;
+    _sendEncoder(encoderIndex, ticks);
+}
+
+//********** PRIVATE METHODS **********
+uint32_t PkpSimulator::_getObject(uint16_t index, uint8_t subIndex) {
+    auto entry = _objects.find(((uint32_t)index << 8) | subIndex);
+    return entry == _objects.end() ? 0 : entry->second.value;
+}
+
+void PkpSimulator::_receiveKeyLeds(const struct can_frame& frame, bool blink) {
+    uint8_t bytesPerColor = (_keyAmount + 7) / 8;
+    if (frame.can_dlc < 3 * bytesPerColor) {
+        return;
+    }
+    for (uint8_t c = 0; c < 3; c++) {
+        uint16_t leds = 0;
+        for (uint8_t b = 0; b < bytesPerColor; b++) {
+            leds |= frame.data[c * bytesPerColor + b] << (8 * b);
+        }
+        if (_keyLeds[blink][c] != leds) {
+            _keyLeds[blink][c] = leds;
+            _ledTimestamp      = micros();
+        }
+    }
+}
+
+void PkpSimulator::_receiveSdo(const struct can_frame& frame) {
+    // The library omits unused data bytes of expedited downloads, which the keypad accepts
+    if (frame.can_dlc < 4) {
+        return;
+    }
+    _sdoCount++;
+
+    uint16_t index       = frame.data[1] | (frame.data[2] << 8);
+    uint8_t  subIndex    = frame.data[3];
+    uint32_t key         = ((uint32_t)index << 8) | subIndex;
+    uint8_t  command     = frame.data[0] & 0xE0;
+    uint8_t  response[8] = {0, frame.data[1], frame.data[2], subIndex, 0, 0, 0, 0};
+
+    if (command == 0x20) {
+        // Only expedited downloads with size indication are supported
+        if ((frame.data[0] & 0x03) != 0x03) {
+            _sendSdoAbort(frame, SDO_ABORT_UNSUPPORTED);
+            return;
+        }
+        uint8_t  size  = 4 - ((frame.data[0] >> 2) & 0x03);
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < size; i++) {
+            value |= (uint32_t)frame.data[4 + i] << (8 * i);
+        }
+        _objects[key] = {value, size};
+
+        if (index == 0x2000 && (subIndex == 0x03 || subIndex == 0x05)) {
+            _encoderPosition[subIndex == 0x03 ? 0 : 1] = value;
+        }
+        if (index == 0x2002 && subIndex == 0x04) {
+            _encoderLeds[0] = value & 0xFFFF;
+            _encoderLeds[1] = value >> 16;
+            _ledTimestamp   = micros();
+        }
+        response[0] = 0x60;
+        _send(0x580, 8, response);
+        return;
+    }
+
+    if (command == 0x40) {
+        auto entry = _objects.find(key);
+        if (entry == _objects.end()) {
+            _sendSdoAbort(frame, SDO_ABORT_NOT_EXISTING);
+            return;
+        }
+        response[0] = 0x43 | ((4 - entry->second.size) << 2);
+        for (uint8_t i = 0; i < 4; i++) {
+            response[4 + i] = entry->second.value >> (8 * i);
+        }
+        _send(0x580, 8, response);
+        return;
+    }
+
+    if (command != 0x80) {
+        _sendSdoAbort(frame, SDO_ABORT_UNSUPPORTED);
+    }
+}
+
+void PkpSimulator::_resetNode() {
+    _objects.clear();
+    _objects[0x101802] = {0x3500, 4}; // product code
+    _objects[0x200006] = {0x10, 1};   // encoder top values
+    _objects[0x200007] = {0x10, 1};
+
+    memset(_keyLeds, 0, sizeof(_keyLeds));
+    memset(_encoderLeds, 0, sizeof(_encoderLeds));
+    memset(_encoderPosition, 0, sizeof(_encoderPosition));
+    _backlightBrightness = 0;
+    _backlightColor      = 0;
+    _heartbeatTimestamp  = millis();
+
+    _nmtState = PkpBase::NMT_BOOT_UP;
+    _send(0x700, 1, &_nmtState);
+    _nmtState = PkpBase::NMT_PRE_OPERATIONAL;
+}
+
+void PkpSimulator::_send(uint16_t canId, uint8_t dlc, const uint8_t* data) {
+    if (!_powered || _loopback == nullptr) {
+        return;
+    }
+    struct can_frame frame;
+    frame.can_id  = canId + _nodeId;
+    frame.can_dlc = dlc;
+    memcpy(frame.data, data, dlc);
+    _loopback->send(frame, this);
+}
+
+void PkpSimulator::_sendEncoder(uint8_t encoderIndex, int8_t ticks) {
+    if (_nmtState != PkpBase::NMT_OPERATIONAL) {
+        return;
+    }
+    uint8_t magnitude = min(abs(ticks), 0x7F);
+    uint8_t data[8]   = {};
+    data[0]           = magnitude | (ticks < 0 ? 0x80 : 0x00);
+    data[1]           = _encoderPosition[encoderIndex] & 0xFF;
+    data[2]           = _encoderPosition[encoderIndex] >> 8;
+    _send(encoderIndex == 0 ? 0x280 : 0x380, 8, data);
+}
+
+void PkpSimulator::_sendKeys() {
+    if (_nmtState != PkpBase::NMT_OPERATIONAL) {
+        return;
+    }
+    uint8_t data[8] = {};
+    data[0]         = _keysPressed & 0xFF;
+    data[1]         = _keysPressed >> 8;
+    _send(0x180, 8, data);
+}
+
+void PkpSimulator::_sendSdoAbort(const struct can_frame& request, uint32_t abortCode) {
+    uint8_t data[8] = {0x80, request.data[1], request.data[2], request.data[3]};
+    for (uint8_t i = 0; i < 4; i++) {
+        data[4 + i] = abortCode >> (8 * i);
+    }
+    _send(0x580, 8, data);
+}
+
+void PkpSimulator::_sendWiredInputs() {
+    if (_nmtState != PkpBase::NMT_OPERATIONAL) {
+        return;
+    }
+    uint8_t data[8] = {};
+    for (uint8_t i = 0; i < _wiredInAmount; i++) {
+        data[2 * i]     = _wiredInput[i] & 0xFF;
+        data[2 * i + 1] = _wiredInput[i] >> 8;
+    }
+    _send(0x480, 8, data);
+}
@@ -0,0 +1,137 @@
+/*
+ * Host simulation of Blink Marine KeyPads
+ *
+ * PkpSimulator implements the CANopen behavior of a keypad the library relies on: NMT state
+ * machine with boot-up message, heartbeat production (object 0x1017), key/encoder/wired input
+ * TPDOs, the key, backlight and encoder LED RPDOs and an expedited SDO server. The defaults
+ * describe a PKP-3500-SI-MT, other models are simulated by passing their input counts.
+ *
+ * PkpLoopback connects the library and any number of simulated keypads. Frames are serialized
+ * like on a real bus: one frame at a time, lowest COB-ID first, each occupying the bus for its
+ * bit time at the configured bitrate. Time is taken from micros(), so the loopback and the
+ * simulated keypads are normally driven by the virtual clock of the host shim.
+ *
+ * Host only, not part of the Arduino library.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_SIMULATOR
+#define BLINK_MARINE_CAN_OPEN_SIMULATOR
+
+#include <map>
+#include <vector>
+
+#include <BlinkMarinePkpCanOpen.h>
+
+class PkpSimulator;
+
+class PkpLoopback {
+  public:
+    // ------ Public Types ------
+    typedef void (*FrameSink)(const struct can_frame& frame);
+
+    // ------ Public Functions ------
+    explicit PkpLoopback(uint32_t bitrate = 250000);
+    void     attach(PkpSimulator& device);
+    uint64_t getBusyTime();
+    uint32_t getFrameCount();
+    uint32_t getPending();
+    void     poll();
+    uint8_t  send(const struct can_frame& frame, PkpSimulator* sender = nullptr);
+    void     setHostReceiver(FrameSink sink);
+
+  private:
+    // ------ Private Types ------
+    struct pendingFrame_t {
+        struct can_frame frame;
+        PkpSimulator*    sender;
+        uint32_t         sequence;
+    };
+
+    // ------ Private Variables ------
+    uint32_t                    _bitrate;
+    uint64_t                    _busyTime     = 0;
+    uint64_t                    _busyUntil    = 0;
+    bool                        _busActive    = false;
+    pendingFrame_t              _current;
+    std::vector<PkpSimulator*>  _devices;
+    uint32_t                    _frameCount   = 0;
+    FrameSink                   _hostReceiver = nullptr;
+    std::vector<pendingFrame_t> _pending;
+    uint32_t                    _sequence     = 0;
+
+    // ------ Private Functions ------
+    uint32_t _frameTime(const struct can_frame& frame);
+};
+
+class PkpSimulator {
+  public:
+    // ------ Public Functions ------
+    PkpSimulator(uint8_t nodeId, uint8_t keyAmount = 15, uint8_t encoderAmount = 2, uint8_t wiredInAmount = 4);
+    uint8_t  getBacklightBrightness();
+    uint8_t  getBacklightColor();
+    uint16_t getEncoderLeds(uint8_t encoderIndex);
+    uint16_t getEncoderPosition(uint8_t encoderIndex);
+    uint16_t getHeartbeatTime();
+    uint8_t  getKeyBrightness();
+    uint16_t getKeyLeds(uint8_t color, bool blink = false);
+    uint32_t getLedTimestamp();
+    uint8_t  getNmtState();
+    uint8_t  getNodeId();
+    uint32_t getSdoCount();
+    bool     isPowered();
+    void     poll();
+    void     powerOff();
+    void     powerOn();
+    void     receive(const struct can_frame& frame);
+    void     setKeys(uint16_t pressedMask);
+    void     setWiredInput(uint8_t inputIndex, uint16_t value);
+    void     turnEncoder(uint8_t encoderIndex, int8_t ticks);
+
+  private:
+    friend class PkpLoopback;
+
+    // ------ Private Constants ------
+    static constexpr uint32_t SDO_ABORT_NOT_EXISTING = 0x06020000;
+    static constexpr uint32_t SDO_ABORT_UNSUPPORTED  = 0x05040001;
+
+    // ------ Private Types ------
+    struct objectEntry_t {
+        uint32_t value;
+        uint8_t  size;
+    };
+
+    // ------ Private Variables ------
+    uint8_t                           _backlightBrightness = 0;
+    uint8_t                           _backlightColor      = 0;
+    uint16_t                          _encoderLeds[2]      = {};
+    uint8_t                           _encoderAmount;
+    uint16_t                          _encoderPosition[2]  = {};
+    uint32_t                          _heartbeatTimestamp  = 0;
+    uint8_t                           _keyAmount;
+    uint16_t                          _keyLeds[2][3]       = {}; // [solid, blink][R, G, B]
+    uint16_t                          _keysPressed         = 0;
+    uint32_t                          _ledTimestamp        = 0;
+    PkpLoopback*                      _loopback            = nullptr;
+    uint8_t                           _nmtState            = PkpBase::NMT_BOOT_UP;
+    uint8_t                           _nodeId;
+    std::map<uint32_t, objectEntry_t> _objects;
+    bool                              _powered             = false;
+    uint32_t                          _sdoCount            = 0;
+    uint16_t                          _wiredInput[4]       = {};
+    uint8_t                           _wiredInAmount;
+
+    // ------ Private Functions ------
+    uint32_t _getObject(uint16_t index, uint8_t subIndex);
+    void     _receiveKeyLeds(const struct can_frame& frame, bool blink);
+    void     _receiveSdo(const struct can_frame& frame);
+    void     _resetNode();
+    void     _send(uint16_t canId, uint8_t dlc, const uint8_t* data);
+    void     _sendEncoder(uint8_t encoderIndex, int8_t ticks);
+    void     _sendKeys();
+    void     _sendSdoAbort(const struct can_frame& request, uint32_t abortCode);
+    void     _sendWiredInputs();
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_SIMULATOR
@@ -0,0 +1,80 @@
+/**
+ * @brief   Brute-force check of the acceptance filter generator
+ * @author  Stefan Hirschenberger
+ *
+ * Generates the MCP2515 and SAME5x filters for pseudo-random sets of keypads and receive functions
+ * and checks them against all 2048 standard identifiers: every added COB-ID has to pass, and the
+ * reported number of accepted identifiers has to match the brute-force count. Registered with CTest.
+ *
+ * Usage: pkp_filter_test [sets]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <PkpFilter.h>
+
+static constexpr uint16_t BASE_IDS[]    = {0x180, 0x280, 0x380, 0x480, 0x580, 0x700};
+static constexpr uint8_t  SAME5X_FILTER = 64;
+
+static uint32_t randomState = 1;
+
+// Deterministic xorshift, so a failing set can be reproduced by its number
+static uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static bool checkSet(uint32_t set) {
+    PkpFilter filter;
+    uint8_t   nodes[PKP_BUS_MAX_NODES];
+    uint8_t   functions[PKP_BUS_MAX_NODES];
+    uint8_t   nodeCount = 1 + nextRandom() % PKP_BUS_MAX_NODES;
+    for (uint8_t i = 0; i < nodeCount; i++) {
+        nodes[i]     = 1 + nextRandom() % 127;
+        functions[i] = nextRandom() % 4 == 0 ? (uint8_t)PkpFilter::FN_ALL : 1 + nextRandom() % PkpFilter::FN_ALL;
+        filter.addNode(nodes[i], functions[i]);
+    }
+
+    PkpFilter::mcp2515Filters_t registers;
+    filter.getMcp2515Filters(registers);
+    uint32_t elements[SAME5X_FILTER];
+    uint16_t same5xAccepted;
+    uint8_t  elementCount = filter.getSame5xFilters(elements, SAME5X_FILTER, same5xAccepted);
+
+    bool ok = true;
+    for (uint8_t i = 0; i < nodeCount; i++) {
+        for (uint8_t f = 0; f < 6; f++) {
+            uint16_t id = BASE_IDS[f] + nodes[i];
+            if ((functions[i] >> f & 1) && !(PkpFilter::accepts(registers, id) && PkpFilter::acceptsSame5x(elements, elementCount, id))) {
+                printf("set %u: COB-ID 0x%03X is not accepted\n", set, id);
+                ok = false;
+            }
+        }
+    }
+
+    uint16_t mcp2515Count = 0;
+    uint16_t same5xCount  = 0;
+    for (uint16_t id = 0; id <= 0x7FF; id++) {
+        mcp2515Count += PkpFilter::accepts(registers, id);
+        same5xCount  += PkpFilter::acceptsSame5x(elements, elementCount, id);
+    }
+    if (mcp2515Count != registers.acceptedIds || same5xCount != same5xAccepted) {
+        printf("set %u: accepted MCP2515 %u reported %u, SAME5x %u reported %u\n", set, mcp2515Count,
+               registers.acceptedIds, same5xCount, same5xAccepted);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    uint32_t sets   = argc > 1 ? strtoul(argv[1], nullptr, 0) : 3000;
+    uint32_t failed = 0;
+    for (uint32_t set = 0; set < sets; set++) {
+        failed += !checkSet(set);
+    }
+    printf("%u of %u filter sets correct\n", sets - failed, sets);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/**
+ * @brief   Checks of the LED shadow of the keypad classes
+ * @author  Stefan Hirschenberger
+ *
+ * Drives a PKP-3500-SI-MT through the host shim. LED frames the keypad already shows must not be sent
+ * again, unless the refresh interval elapsed or the previous transmission failed. Requires the library
+ * built with PKP_LED_SHADOW. Registered with CTest.
+ *
+ * Usage: pkp_led_test
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include <BlinkMarinePkpCanOpen.h>
+
+static_assert(PKP_LED_SHADOW, "pkp_led_test checks the LED shadow, set PKP_LED_SHADOW");
+
+static constexpr uint8_t NODE_ID = 0x15;
+
+static std::vector<can_frame> transmitted;
+static uint8_t                transmitError = 0;
+static bool                   ok            = true;
+
+static uint8_t transmit(const can_frame& txMsg) {
+    if (transmitError != 0) {
+        return transmitError;
+    }
+    transmitted.push_back(txMsg);
+    return 0;
+}
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("failed: %s\n", what);
+        ok = false;
+    }
+}
+
+// Returns the number of frames with the given COB-ID transmitted after the frame at from
+static int countFrames(size_t from, uint32_t canId) {
+    int count = 0;
+    for (size_t i = from; i < transmitted.size(); i++) {
+        count += transmitted[i].can_id == canId;
+    }
+    return count;
+}
+
+// Starts a keypad and confirms its startup requests
+static void start(Pkp& keypad) {
+    transmitted.clear();
+    keypad.begin();
+    for (size_t i = 0; i < transmitted.size(); i++) {
+        can_frame request = transmitted[i];
+        if (request.can_id != 0x600u + NODE_ID) {
+            continue;
+        }
+        can_frame response = {};
+        response.can_id    = 0x580 + NODE_ID;
+        response.can_dlc   = 8;
+        response.data[0]   = 0x60;
+        memcpy(&response.data[1], &request.data[1], 3);
+        keypad.process(response);
+    }
+}
+
+static void testSuppression() {
+    Pkp keypad(NODE_ID, transmit);
+    start(keypad);
+
+    size_t from = transmitted.size();
+    keypad.setBacklight(Pkp::BACKLIGHT_WHITE, 50);
+    keypad.setBacklight(Pkp::BACKLIGHT_WHITE, 50);
+    check(countFrames(from, 0x500 + NODE_ID) == 1, "unchanged backlight suppressed");
+    keypad.setBacklight(Pkp::BACKLIGHT_WHITE, 80);
+    check(countFrames(from, 0x500 + NODE_ID) == 2, "changed backlight sent");
+
+    // Key states already at their defaults leave the key LED frames unchanged
+    from = transmitted.size();
+    keypad.applyDefaultKeyStates();
+    check(countFrames(from, 0x200 + NODE_ID) == 0 && countFrames(from, 0x300 + NODE_ID) == 0, "unchanged key LEDs suppressed");
+
+    from                    = transmitted.size();
+    const uint8_t colors[4] = {Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_RED, Pkp::KEY_COLOR_GREEN, Pkp::KEY_COLOR_BLUE};
+    const uint8_t blinks[4] = {Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK, Pkp::KEY_COLOR_BLANK};
+    keypad.setKeyColor(Pkp::KEY_1, colors, blinks);
+    int keyFrames = countFrames(from, 0x200 + NODE_ID);
+    keypad.setKeyColor(Pkp::KEY_1, colors, blinks);
+    check(countFrames(from, 0x200 + NODE_ID) == keyFrames, "unchanged key colors suppressed");
+    keypad.setKeyStateOverride(Pkp::KEY_1, 1);
+    check(countFrames(from, 0x200 + NODE_ID) == keyFrames + 1, "key color of a new key state sent");
+}
+
+static void testRefresh() {
+    Pkp keypad(NODE_ID, transmit);
+    start(keypad);
+    keypad.setLedRefreshInterval(100);
+
+    size_t from = transmitted.size();
+    keypad.setBacklight(Pkp::BACKLIGHT_GREEN, 30);
+    hostAdvanceClock(99000);
+    keypad.setBacklight(Pkp::BACKLIGHT_GREEN, 30);
+    check(countFrames(from, 0x500 + NODE_ID) == 1, "no refresh within the interval");
+    hostAdvanceClock(1000);
+    keypad.setBacklight(Pkp::BACKLIGHT_GREEN, 30);
+    check(countFrames(from, 0x500 + NODE_ID) == 2, "unchanged frame refreshed after the interval");
+    keypad.setBacklight(Pkp::BACKLIGHT_GREEN, 30);
+    check(countFrames(from, 0x500 + NODE_ID) == 2, "refresh restarts the interval");
+}
+
+static void testFailedTransmission() {
+    Pkp keypad(NODE_ID, transmit);
+    start(keypad);
+
+    size_t from = transmitted.size();
+    keypad.setBacklight(Pkp::BACKLIGHT_BLUE, 60);
+    transmitError = 1;
+    check(keypad.setBacklight(Pkp::BACKLIGHT_BLUE, 70) != PkpBase::RS_SUCCESS, "failed transmission reported");
+    transmitError = 0;
+    keypad.setBacklight(Pkp::BACKLIGHT_BLUE, 70);
+    check(countFrames(from, 0x500 + NODE_ID) == 2, "frame repeated after a failed transmission");
+    keypad.setBacklight(Pkp::BACKLIGHT_BLUE, 60);
+    check(countFrames(from, 0x500 + NODE_ID) == 3, "shadow follows the frame last acknowledged");
+}
+
+int main() {
+    hostUseVirtualClock(true);
+    testSuppression();
+    testRefresh();
+    testFailedTransmission();
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
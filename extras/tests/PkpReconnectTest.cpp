@@ -0,0 +1,208 @@
+/**
+ * @brief   Checks of the connection monitoring of the keypad classes
+ * @author  Stefan Hirschenberger
+ *
+ * Drives a PKP-3500-SI-MT through the host shim. A keypad falling silent is probed with a heartbeat
+ * producer write, unanswered probes are repeated with an exponential backoff. A confirmed probe is
+ * followed by the NMT start and the configuration burst, one stage per watchdog call. Boot-up
+ * and pre-operational heartbeats restart the keypad without waiting for the watchdog. Registered with
+ * CTest.
+ *
+ * Usage: pkp_reconnect_test
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include <BlinkMarinePkpCanOpen.h>
+
+static constexpr uint8_t NODE_ID = 0x15;
+
+static std::vector<can_frame> transmitted;
+static std::vector<uint32_t>  transmitTime; // millis() of each transmitted frame
+static size_t                 answered  = 0;
+static bool                   answerSdo = true;
+static bool                   ok        = true;
+
+static uint8_t transmit(const can_frame& txMsg) {
+    transmitted.push_back(txMsg);
+    transmitTime.push_back(millis());
+    return 0;
+}
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("failed: %s\n", what);
+        ok = false;
+    }
+}
+
+static void reset() {
+    transmitted.clear();
+    transmitTime.clear();
+    answered  = 0;
+    answerSdo = true;
+}
+
+// Confirms the SDO requests transmitted so far while answerSdo is set, others stay unanswered
+static void answerRequests(Pkp& keypad) {
+    while (answered < transmitted.size()) {
+        can_frame request = transmitted[answered++];
+        if (!answerSdo || request.can_id != 0x600u + NODE_ID) {
+            continue;
+        }
+        can_frame response = {};
+        response.can_id    = 0x580 + NODE_ID;
+        response.can_dlc   = 8;
+        response.data[0]   = (request.data[0] & 0xE0) == 0x40 ? 0x43 : 0x60;
+        memcpy(&response.data[1], &request.data[1], 3);
+        keypad.process(response);
+    }
+}
+
+// Runs the watchdog in 10 ms steps
+static void runFor(Pkp& keypad, uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        hostAdvanceClock(10000);
+        keypad.getStatus();
+        answerRequests(keypad);
+    }
+}
+
+static void heartbeat(Pkp& keypad, uint8_t state) {
+    can_frame frame = {};
+    frame.can_id    = 0x700 + NODE_ID;
+    frame.can_dlc   = 1;
+    frame.data[0]   = state;
+    keypad.process(frame);
+}
+
+static bool isProbe(const can_frame& frame) {
+    return frame.can_id == 0x600u + NODE_ID && (frame.data[0] & 0xE0) == 0x20 && frame.data[1] == 0x17 && frame.data[2] == 0x10;
+}
+
+static bool isNmtStart(const can_frame& frame) {
+    return frame.can_id == 0x000 && frame.data[0] == 0x01 && frame.data[1] == NODE_ID;
+}
+
+static bool isBrightnessWrite(const can_frame& frame) {
+    return frame.can_id == 0x600u + NODE_ID && frame.data[1] == 0x03 && frame.data[2] == 0x20;
+}
+
+// Returns the position of the first frame matching the predicate after the frame at from, -1 if there is none
+static int find(size_t from, bool (*predicate)(const can_frame&)) {
+    for (size_t i = from; i < transmitted.size(); i++) {
+        if (predicate(transmitted[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int findCanId(size_t from, uint32_t canId) {
+    for (size_t i = from; i < transmitted.size(); i++) {
+        if (transmitted[i].can_id == canId) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void testBackoff() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+
+    size_t from = transmitted.size();
+    answerSdo   = false;
+    runFor(keypad, 1190);
+    check(find(from, isProbe) < 0, "no probe before the watchdog time");
+    check(keypad.getStatus() == PkpBase::KPS_RX_WITHIN_LAST_SECOND, "connected before the watchdog time");
+    runFor(keypad, 10);
+    check(keypad.getStatus() == PkpBase::KPS_NO_RX_WITHIN_LAST_SECOND, "silent keypad detected");
+
+    // Every attempt is a probe and its two retries, the next attempt follows after 250 ms, then 500 ms
+    runFor(keypad, 2500);
+    std::vector<uint32_t> probes;
+    for (size_t i = from; i < transmitted.size(); i++) {
+        if (isProbe(transmitted[i])) {
+            probes.push_back(transmitTime[i]);
+        }
+    }
+    const uint32_t gaps[] = {200, 200, 450, 200, 200, 700};
+    check(probes.size() >= 7, "probes repeated");
+    for (size_t i = 0; i < 6 && i + 1 < probes.size(); i++) {
+        check(probes[i + 1] - probes[i] == gaps[i], "probe timing follows the backoff");
+    }
+    check(find(from, isNmtStart) < 0, "no NMT start without a confirmed probe");
+}
+
+static void testStages() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+
+    // The probe is confirmed right away, the confirmation starts the keypad and the next call configures it
+    size_t from = transmitted.size();
+    runFor(keypad, 1230);
+    int probe  = find(from, isProbe);
+    int start  = find(from, isNmtStart);
+    int config = find(from, isBrightnessWrite);
+    check(probe >= 0, "probe sent");
+    check(start > probe && transmitTime[start] == transmitTime[probe], "NMT start with the confirmation of the probe");
+    check(config > start && transmitTime[config] == transmitTime[start] + 10, "configuration in the call after the NMT start");
+    check(findCanId(start, 0x500 + NODE_ID) > start, "backlight after the NMT start");
+    check(findCanId(start, 0x200 + NODE_ID) > start, "key colors after the NMT start");
+
+    size_t done = transmitted.size();
+    runFor(keypad, 500);
+    check(find(done, isProbe) < 0 && find(done, isNmtStart) < 0, "reconnect finished");
+}
+
+static void testBootUp() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+    heartbeat(keypad, 0x05);
+
+    // A restarted keypad lost its configuration, it is probed, started and configured at once
+    size_t from = transmitted.size();
+    heartbeat(keypad, 0x00);
+    runFor(keypad, 30);
+    int probe = find(from, isProbe);
+    int start = find(from, isNmtStart);
+    check(probe >= 0 && start > probe, "boot-up probed and started");
+    check(find(start, isBrightnessWrite) > start, "boot-up reconfigured");
+    check(keypad.getNmtState() == PkpBase::NMT_BOOT_UP, "NMT state from the heartbeat");
+}
+
+static void testPreOperational() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+    heartbeat(keypad, 0x05);
+
+    // The SDO configuration is retained, only the start and the LED states are sent again
+    size_t from = transmitted.size();
+    heartbeat(keypad, 0x7F);
+    runFor(keypad, 30);
+    int start = find(from, isNmtStart);
+    check(find(from, isProbe) < 0, "pre-operational keypad not probed");
+    check(start >= 0, "pre-operational keypad started");
+    check(findCanId(start, 0x500 + NODE_ID) > start, "LED states resent");
+    check(find(from, isBrightnessWrite) < 0, "configuration not rewritten");
+}
+
+int main() {
+    hostUseVirtualClock(true);
+    testBackoff();
+    testStages();
+    testBootUp();
+    testPreOperational();
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+/**
+ * @brief   Checks of the SDO client of the keypad classes
+ * @author  Stefan Hirschenberger
+ *
+ * Drives a PKP-3500-SI-MT through the host shim and answers its SDO requests like a keypad would.
+ * Responses have to be matched to their requests by object index and sub-index, in any order.
+ * Unanswered requests are repeated before they time out, aborts are reported with their code and a
+ * write to an object with an outstanding write is coalesced. Configuration writes issued while all
+ * request slots are occupied have to reach the keypad once the confirmations free the slots.
+ * Registered with CTest.
+ *
+ * Usage: pkp_sdo_test
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include <BlinkMarinePkpCanOpen.h>
+
+static constexpr uint8_t NODE_ID = 0x15;
+
+static std::vector<can_frame> transmitted;
+static size_t                 answered       = 0;
+static uint8_t                confirmedReads = 0;
+static bool                   ok             = true;
+static PkpBase::sdoResult_t   results[4];
+static uint8_t                resultCount = 0;
+
+static uint8_t transmit(const can_frame& txMsg) {
+    transmitted.push_back(txMsg);
+    return 0;
+}
+
+static void countRead(const PkpBase::sdoResult_t& result) {
+    confirmedReads += result.status == PkpBase::SS_SUCCESS;
+}
+
+static void storeResult(const PkpBase::sdoResult_t& result) {
+    if (resultCount < sizeof(results) / sizeof(results[0])) {
+        results[resultCount] = result;
+    }
+    resultCount++;
+}
+
+static void reset() {
+    transmitted.clear();
+    answered    = 0;
+    resultCount = 0;
+}
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("failed: %s\n", what);
+        ok = false;
+    }
+}
+
+// Confirms every SDO request transmitted so far, also the ones sent in reaction to a confirmation
+static void answerRequests(Pkp& keypad) {
+    while (answered < transmitted.size()) {
+        can_frame request = transmitted[answered++];
+        if (request.can_id != 0x600u + NODE_ID) {
+            continue;
+        }
+        can_frame response = {};
+        response.can_id    = 0x580 + NODE_ID;
+        response.can_dlc   = 8;
+        response.data[0]   = (request.data[0] & 0xE0) == 0x40 ? 0x43 : 0x60;
+        memcpy(&response.data[1], &request.data[1], 3);
+        keypad.process(response);
+    }
+}
+
+static void respond(Pkp& keypad, uint8_t command, uint16_t index, uint8_t subIndex, uint32_t value) {
+    can_frame response = {};
+    response.can_id    = 0x580 + NODE_ID;
+    response.can_dlc   = 8;
+    response.data[0]   = command;
+    response.data[1]   = index & 0xFF;
+    response.data[2]   = index >> 8;
+    response.data[3]   = subIndex;
+    for (uint8_t b = 0; b < 4; b++) {
+        response.data[4 + b] = value >> (8 * b);
+    }
+    keypad.process(response);
+}
+
+// Returns the number of requests for the given object transmitted after the frame at from
+static int countRequests(size_t from, uint16_t index, uint8_t subIndex) {
+    int count = 0;
+    for (size_t i = from; i < transmitted.size(); i++) {
+        const can_frame& frame = transmitted[i];
+        count += frame.can_id == 0x600u + NODE_ID && frame.data[1] == (index & 0xFF) && frame.data[2] == index >> 8 &&
+                 frame.data[3] == subIndex;
+    }
+    return count;
+}
+
+// Returns the position of the download of the given object after the frame at from, -1 if there is none
+static int findDownload(size_t from, uint16_t index, uint8_t subIndex, uint32_t value) {
+    for (size_t i = from; i < transmitted.size(); i++) {
+        const can_frame& frame = transmitted[i];
+        uint32_t         data  = frame.data[4] | (frame.data[5] << 8) | ((uint32_t)frame.data[6] << 16);
+        if (frame.can_id == 0x600u + NODE_ID && (frame.data[0] & 0xE0) == 0x20 && frame.data[1] == (index & 0xFF) &&
+            frame.data[2] == index >> 8 && frame.data[3] == subIndex && data == value) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void testResponseMatching() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+
+    check(keypad.readSdo(0x1018, 0x01, storeResult) == PkpBase::RS_SUCCESS, "readSdo(vendor ID)");
+    check(keypad.readSdo(0x1018, 0x02, storeResult) == PkpBase::RS_SUCCESS, "readSdo(product code)");
+    answered = transmitted.size();
+
+    // Foreign objects are ignored, the answers arrive in reverse order
+    respond(keypad, 0x43, 0x1018, 0x04, 0x44);
+    check(resultCount == 0 && keypad.getSdoPending() == 2, "response to an object without request ignored");
+    respond(keypad, 0x43, 0x1018, 0x02, 0x22);
+    respond(keypad, 0x4F, 0x1018, 0x01, 0xFFFFFF11); // 1 byte indicated, the upper bytes are not part of the value
+    check(resultCount == 2, "both reads confirmed");
+    check(results[0].subIndex == 0x02 && results[0].value == 0x22 && results[0].status == PkpBase::SS_SUCCESS, "product code matched");
+    check(results[1].subIndex == 0x01 && results[1].value == 0x11 && results[1].status == PkpBase::SS_SUCCESS, "vendor ID matched, size honored");
+    check(results[0].nodeId == NODE_ID, "result carries the node ID");
+    check(keypad.getSdoPending() == 0, "slots released");
+}
+
+static void testRetries() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+
+    size_t from = transmitted.size();
+    check(keypad.readSdo(0x1018, 0x03, storeResult) == PkpBase::RS_SUCCESS, "readSdo(revision)");
+    answered = transmitted.size();
+
+    hostAdvanceClock(199000);
+    keypad.getStatus();
+    check(countRequests(from, 0x1018, 0x03) == 1, "no retry before the timeout");
+    for (int retry = 1; retry <= 2; retry++) {
+        hostAdvanceClock(201000);
+        keypad.getStatus();
+        check(countRequests(from, 0x1018, 0x03) == 1 + retry, "request repeated after the timeout");
+        check(resultCount == 0, "no result while retries remain");
+    }
+    hostAdvanceClock(201000);
+    keypad.getStatus();
+    check(countRequests(from, 0x1018, 0x03) == 3, "two retries only");
+    check(resultCount == 1 && results[0].status == PkpBase::SS_TIMEOUT, "timeout reported");
+    check(keypad.getSdoPending() == 0, "slot released after the timeout");
+}
+
+static void testAbort() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+
+    check(keypad.writeSdo(0x2003, 0x01, 0x20, 1, storeResult) == PkpBase::RS_SUCCESS, "writeSdo(key brightness)");
+    answered = transmitted.size();
+    respond(keypad, 0x80, 0x2003, 0x01, 0x06090011);
+    check(resultCount == 1 && results[0].status == PkpBase::SS_ABORTED, "abort reported");
+    check(results[0].value == 0x06090011, "abort code reported");
+    check(keypad.getSdoPending() == 0, "slot released after the abort");
+}
+
+static void testCoalescing() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    keypad.begin();
+    answerRequests(keypad);
+
+    size_t from = transmitted.size();
+    keypad.writeSdo(0x2003, 0x01, 0x10, 1, storeResult);
+    keypad.writeSdo(0x2003, 0x01, 0x18, 1, storeResult);
+    keypad.writeSdo(0x2003, 0x01, 0x20, 1, storeResult);
+    check(countRequests(from, 0x2003, 0x01) == 1, "writes to an object with an outstanding write coalesced");
+    check(keypad.getSdoPending() == 1, "coalesced writes share a slot");
+
+    answerRequests(keypad);
+    check(countRequests(from, 0x2003, 0x01) == 2, "latest value sent after the confirmation");
+    check(findDownload(from, 0x2003, 0x01, 0x20) > findDownload(from, 0x2003, 0x01, 0x10), "latest value sent last");
+    check(findDownload(from, 0x2003, 0x01, 0x18) < 0, "intermediate value skipped");
+    check(resultCount == 1 && results[0].status == PkpBase::SS_SUCCESS, "one result for the coalesced writes");
+}
+
+static void testDeferredConfiguration() {
+    reset();
+    Pkp keypad(NODE_ID, transmit);
+    check(keypad.begin() == PkpBase::RS_SUCCESS, "begin()");
+    answerRequests(keypad);
+    check(keypad.getSdoPending() == 0, "startup writes confirmed");
+
+    // Occupy every request slot with an unanswered read
+    uint8_t reads = 0;
+    while (keypad.readSdo(0x1018, 0x01 + reads, countRead) == PkpBase::RS_SUCCESS) {
+        reads++;
+    }
+    check(reads == PKP_SDO_MAX_PENDING, "all slots occupied");
+
+    size_t from = transmitted.size();
+    check(keypad.initializeEncoder(0, 10, 3) == PkpBase::RS_SUCCESS, "initializeEncoder(0) without free slot");
+    check(keypad.initializeEncoder(1, 0, 100) == PkpBase::RS_SUCCESS, "initializeEncoder(1) without free slot");
+    check(keypad.setKeyBrightness(40) == PkpBase::RS_SUCCESS, "setKeyBrightness() without free slot");
+    check(transmitted.size() == from, "nothing sent while the slots are occupied");
+
+    answerRequests(keypad);
+    check(keypad.getSdoPending() == 0, "deferred writes confirmed");
+    check(confirmedReads == reads, "reads confirmed");
+
+    int top0   = findDownload(from, 0x2000, 0x06, 10);
+    int start0 = findDownload(from, 0x2000, 0x03, 3);
+    int top1   = findDownload(from, 0x2000, 0x07, 0xFF);
+    int start1 = findDownload(from, 0x2000, 0x05, 100);
+    check(top0 >= 0 && start0 > top0, "encoder 1 top value followed by its start value");
+    check(top1 >= 0 && start1 > top1, "encoder 2 top value followed by its start value");
+
+    bool brightness = false;
+    for (size_t i = from; i < transmitted.size(); i++) {
+        brightness |= transmitted[i].can_id == 0x600u + NODE_ID && transmitted[i].data[1] == 0x03 && transmitted[i].data[2] == 0x20;
+    }
+    check(brightness, "key brightness sent");
+}
+
+int main() {
+    hostUseVirtualClock(true);
+    testResponseMatching();
+    testRetries();
+    testAbort();
+    testCoalescing();
+    testDeferredConfiguration();
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+/**
+ * @brief   Per-instance RAM guard for the keypad classes
+ * @author  Stefan Hirschenberger
+ *
+ * Several keypads have to fit into the 2 KB of an ATmega328, so sizeof(Pkp) on the host must stay
+ * within PKP_SIZE_BUDGET, the size of the keypad object before the add-ons were introduced. The
+ * budget is fixed: a change that grows the keypad state has to make room elsewhere, or put the new
+ * state behind a compile-time option that is off by default (like PKP_STATS or PKP_EVENTS).
+ * Registered with CTest, prints the size of every model.
+ *
+ * Every model also has a budget of its own. The key masks are sized by the key amount and models without
+ * encoders or wired inputs hold no state for them, so the smaller models stay below the PKP-3500-SI-MT.
+ *
+ * The test is always compiled with the optional features set to 0, whatever the library is built
+ * with. This way the budget applies to the default layout, including its padding, and a build with
+ * features enabled is not measured against an estimate of what they add.
+ *
+ * Usage: pkp_size_test
+ */
+
+#include <cstdio>
+
+#include <BlinkMarinePkpCanOpen.h>
+
+static constexpr size_t PKP_SIZE_BUDGET = 272;
+
+static_assert(!PKP_STATS, "The size budget applies to the build without PKP_STATS");
+static_assert(!PKP_ANIMATOR && !PKP_ENCODER_DYNAMICS && !PKP_EVENTS && !PKP_LED_SHADOW && !PKP_PDO_CONFIG && !PKP_WIRED_IN_FILTER,
+              "The size budget applies to the build without the optional features");
+
+template <typename Model>
+static bool checkSize(const char* name, size_t modelBudget) {
+    size_t size = sizeof(PkpKeypad<Model>);
+    bool   fits = size <= PKP_SIZE_BUDGET && size <= modelBudget;
+    printf("%-14s %4zu bytes, model budget %4zu bytes%s\n", name, size, modelBudget, fits ? "" : "  exceeded");
+    return fits;
+}
+
+int main() {
+    bool fits = true;
+    fits &= checkSize<Pkp2200Si>("PKP-2200-SI", 176);
+    fits &= checkSize<Pkp2300Si>("PKP-2300-SI", 176);
+    fits &= checkSize<Pkp2400Si>("PKP-2400-SI", 176);
+    fits &= checkSize<Pkp2500Si>("PKP-2500-SI", 208);
+    fits &= checkSize<Pkp2600Si>("PKP-2600-SI", 208);
+    fits &= checkSize<Pkp3500SiMt>("PKP-3500-SI-MT", PKP_SIZE_BUDGET);
+    printf("budget         %4zu bytes\n", PKP_SIZE_BUDGET);
+    return fits ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/**
+ * @brief   Checks of the transmit queue
+ * @author  Stefan Hirschenberger
+ *
+ * Queued frames to the same target have to be replaced by newer payloads, while frames to other
+ * targets are kept. The frames of one node leave the queue in order of arrival, between nodes the
+ * lowest COB-ID goes first. The budget limits the frames per millisecond and frames rejected by the
+ * transmit callback stay queued. Registered with CTest.
+ *
+ * Usage: pkp_tx_queue_test
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include <PkpTxQueue.h>
+
+static std::vector<can_frame> transmitted;
+static uint8_t                transmitError = 0;
+static bool                   ok            = true;
+
+static uint8_t transmit(const can_frame& txMsg) {
+    if (transmitError != 0) {
+        return transmitError;
+    }
+    transmitted.push_back(txMsg);
+    return 0;
+}
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("failed: %s\n", what);
+        ok = false;
+    }
+}
+
+static can_frame frame(uint32_t canId, uint8_t data0, uint8_t data1 = 0, uint8_t data2 = 0, uint8_t data3 = 0) {
+    can_frame txMsg;
+    txMsg.can_id  = canId;
+    txMsg.can_dlc = 8;
+    txMsg.data[0] = data0;
+    txMsg.data[1] = data1;
+    txMsg.data[2] = data2;
+    txMsg.data[3] = data3;
+    return txMsg;
+}
+
+// Checks that the frames were transmitted with the given COB-IDs and first data bytes, in this order
+static void checkOrder(const uint32_t canIds[], const uint8_t data0[], size_t count, const char* what) {
+    bool same = transmitted.size() == count;
+    for (size_t i = 0; same && i < count; i++) {
+        same = transmitted[i].can_id == canIds[i] && transmitted[i].data[0] == data0[i];
+    }
+    check(same, what);
+}
+
+static void testCoalescing() {
+    transmitted.clear();
+    PkpTxQueue queue(transmit);
+
+    queue.push(frame(0x215, 1));
+    queue.push(frame(0x315, 2));
+    queue.push(frame(0x215, 3));
+    check(queue.getPending() == 2, "PDO to the same target replaced");
+
+    // SDO requests are only replaced for the same object, NMT commands for the same node
+    queue.push(frame(0x615, 0x2F, 0x03, 0x20, 0x01));
+    queue.push(frame(0x615, 0x2F, 0x03, 0x20, 0x02));
+    queue.push(frame(0x615, 0x2F, 0x03, 0x20, 0x01));
+    queue.push(frame(0x615, 0x40, 0x03, 0x20, 0x01));
+    check(queue.getPending() == 5, "SDO requests replaced per object and command class");
+    queue.push(frame(0x000, 0x01, 0x15));
+    queue.push(frame(0x000, 0x01, 0x16));
+    queue.push(frame(0x000, 0x80, 0x15));
+    check(queue.getPending() == 7, "NMT commands replaced per node");
+
+    queue.poll();
+    check(queue.getPending() == 0, "queue drained without budget");
+    bool latest = false;
+    for (const can_frame& txMsg : transmitted) {
+        latest |= txMsg.can_id == 0x215 && txMsg.data[0] == 3;
+        check(!(txMsg.can_id == 0x215 && txMsg.data[0] == 1), "replaced payload not sent");
+    }
+    check(latest, "latest payload sent");
+}
+
+static void testOrder() {
+    transmitted.clear();
+    PkpTxQueue queue(transmit);
+
+    // Node 0x15: SDO before encoder LEDs in order of arrival, node 0x16: key colors, the replaced frame moves back
+    queue.push(frame(0x615, 1));
+    queue.push(frame(0x415, 2));
+    queue.push(frame(0x316, 3));
+    queue.push(frame(0x216, 4));
+    queue.push(frame(0x316, 5));
+    queue.poll();
+
+    const uint32_t canIds[] = {0x216, 0x316, 0x615, 0x415};
+    const uint8_t  data0[]  = {4, 5, 1, 2};
+    checkOrder(canIds, data0, 4, "per node in order of arrival, between nodes by COB-ID");
+}
+
+static void testBudget() {
+    transmitted.clear();
+    PkpTxQueue queue(transmit, 2);
+
+    for (uint8_t i = 0; i < 8; i++) {
+        queue.push(frame(0x200 + i + 1, i));
+    }
+    check(queue.poll() == 2, "budget limits the frames per millisecond");
+    check(queue.poll() == 0, "budget used up within the millisecond");
+    hostAdvanceClock(1000);
+    check(queue.poll() == 2, "budget refilled after a millisecond");
+    hostAdvanceClock(5000);
+    check(queue.poll() == 2, "unused budget not accumulated");
+
+    queue.setBudget(0);
+    for (uint8_t i = 0; i < 5; i++) {
+        queue.push(frame(0x200 + i + 1, i));
+    }
+    check(queue.poll() == 7, "no limit without budget");
+}
+
+static void testRejected() {
+    transmitted.clear();
+    PkpTxQueue queue(transmit);
+
+    queue.push(frame(0x215, 1));
+    queue.push(frame(0x216, 2));
+    transmitError = 1;
+    check(queue.poll() == 0, "nothing sent while the controller rejects frames");
+    check(queue.getPending() == 2, "rejected frames stay queued");
+    transmitError = 0;
+    check(queue.poll() == 2 && transmitted[0].can_id == 0x215, "rejected frames sent in order on the next poll");
+
+    for (uint8_t i = 0; i < PKP_TX_QUEUE_SIZE; i++) {
+        check(queue.push(frame(0x200 + i + 1, i)), "frame queued");
+    }
+    check(!queue.push(frame(0x300, 0)), "push fails when the queue is full");
+    check(queue.push(frame(0x201, 0xFF)), "replacing frame fits into the full queue");
+}
+
+int main() {
+    hostUseVirtualClock(true);
+    testCoalescing();
+    testOrder();
+    testBudget();
+    testRejected();
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -1,23 +1,34 @@
 
 #include "BlinkMarinePkpCanOpen.h"
+#include "PkpAnimator.h"
+#include "PkpBusLoad.h"
+#include "PkpRecorder.h"
+#include "PkpRxRing.h"
+#include "PkpTxQueue.h"
 
 //********** CONSTRUCTOR **********
 
+/**
+ * @brief Constructs the model independent part of a keypad.
+ *
+ * @param canId The CAN node ID of the keypad.
+ */
+PkpBase::PkpBase(uint8_t canId) : _canId(canId) {
+}
+
 /**
  * @brief Constructs a Pkp object with a specific CAN ID and transmission callback.
  *
  * This constructor initializes a keypad object, setting up the CAN ID and the message transmission callback.
- * Default states for override key states and encoder top values are also initialized.
+ * Default encoder top values are also initialized.
  *
  * @param canId The CAN ID to be used by the keypad.
  * @param callback The function to call for transmitting messages over the CAN bus.
  */
-Pkp::Pkp(uint8_t canId, CanMsgTxCallback callback, uint16_t heartBeatInterval)
-    : _canId(canId), _transmitMessage(callback), _canNodeHeartbeatInterval(heartBeatInterval) {
-    for (int i = 0; i < PKP_MAX_KEY_AMOUNT; i++) {
-        _overrideKeyState[i] = -1;
-    }
-    for (int i = 0; i < PKP_MAX_ROTARY_ENCODER_AMOUNT; i++) {
+template <typename Model>
+PkpKeypad<Model>::PkpKeypad(uint8_t canId, CanMsgTxCallback callback, uint16_t heartBeatInterval)
+    : PkpBase(canId), _transmitMessage(callback), _canNodeHeartbeatInterval(heartBeatInterval) {
+    for (int i = 0; i < ENCODER_AMOUNT; i++) {
         _encoderTopValue[i] = 16;
     }
 }
@@ -27,16 +38,103 @@ Pkp::Pkp(uint8_t canId, CanMsgTxCallback callback, uint16_t heartBeatInterval)
 /**
  * @brief Applies the default key states set via presetDefaultKeyStates() to physical keys.
  *
- * This function copies the internally stored default key states to the _keyState array and
+ * This function copies the internally stored default key states to the key state masks and
  * triggers an update to refresh the physical state of the LEDs on the keypad.
  *
  * @return A status code indicating success or the type of error encountered (e.g., communication errors).
  */
-Pkp::returnState_e Pkp::applyDefaultKeyStates() {
-    memcpy(_keyState, _defaultKeyState, sizeof(_keyState));
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::applyDefaultKeyStates() {
+    for (uint8_t i = 0; i < KEY_AMOUNT; i++) {
+        _setKeyState(i, _getKeyField(_defaultKeyStates, i));
+    }
     return _update(UT_KEY_LEDS);
 }
 
+/**
+ * @brief Enables deferred processing of received frames.
+ *
+ * The CAN receive interrupt only pushes frames into the ring (PkpRxRing::push()), decoding, LED updates and
+ * transmissions are done by poll() from the main loop. This keeps the interrupt short and avoids torn reads of the
+ * input state in the main loop.
+ *
+ * @param ring The ring to drain in poll(), nullptr to disable deferred processing.
+ */
+template <typename Model>
+void PkpKeypad<Model>::attachRxRing(PkpRxRing* ring) {
+    _rxRing = ring;
+}
+
+#if PKP_ANIMATOR
+/**
+ * @brief Attaches an animator whose LED image is laid over the LED state of the keypad.
+ *
+ * Each poll() renders the animator's image if a tick is due and transmits the LED frames differing from the last
+ * frames sent, at most PkpAnimator::getFramesPerTick() per tick. Frames triggered by the keypad API (e.g.
+ * setKeyColor()) include the image as well. An animator serves a single keypad.
+ * Only compiled in with PKP_ANIMATOR set to 1.
+ *
+ * @param animator The animator to use, nullptr to detach it and restore the LED state set through the keypad API.
+ */
+template <typename Model>
+void PkpKeypad<Model>::attachAnimator(PkpAnimator* animator) {
+    bool detached = _animator != nullptr && animator == nullptr;
+    _animator     = animator;
+    if (!detached || !_initialized) {
+        return;
+    }
+    setBacklight(_backlightColor, _backlightBrightness);
+    if (_keyBrightnessSent != 0x3F * _keyBrightness / 100) {
+        setKeyBrightness(_keyBrightness);
+    }
+    _update(UT_ALL);
+}
+#endif
+
+/**
+ * @brief Accounts the bus time of the frames of the keypad.
+ *
+ * All frames received from the keypad and all frames handed to the transmit callback are added to the meter. With
+ * a transmit queue, the transmitted frames are accounted by the meter of the queue when they leave it (see
+ * PkpTxQueue::attachBusLoad()), attach the same meter there or chain it with PkpBusLoad::attachTotal(). Frames of other nodes are not, use the same meter on a PkpBus or PkpBusLoad::add() for them. Behind a
+ * PkpBus, frames of the keypad's node ID the keypad does not decode go to the meter of the bus instead. While the
+ * budget of the meter is exceeded, periodic LED refreshes and animator frames are skipped.
+ *
+ * @param meter The meter to use, nullptr to stop accounting.
+ */
+template <typename Model>
+void PkpKeypad<Model>::attachBusLoad(PkpBusLoad* meter) {
+    _busLoad = meter;
+}
+
+/**
+ * @brief Logs the frames passed to process() and the frames transmitted to the keypad.
+ *
+ * Received frames are logged when they are handed to process() and carry the node ID of this keypad, transmitted
+ * frames when they are handed to the transmit callback or queue. So several keypads may share one recorder without
+ * logging a frame twice. Frames of other nodes are only logged by a recorder attached to a PkpBus.
+ *
+ * @param recorder The recorder to log to, nullptr to stop logging.
+ */
+template <typename Model>
+void PkpKeypad<Model>::attachRecorder(PkpRecorder* recorder) {
+    _recorder = recorder;
+}
+
+/**
+ * @brief Routes all frames of this keypad through a transmit queue.
+ *
+ * Once a queue is attached, frames are no longer passed to the transmit callback directly but pushed into the
+ * queue, which has to be drained by calling PkpTxQueue::poll() from the main loop. Several keypads may share one
+ * queue. The queue must not be filled from an interrupt while it is drained from the main loop.
+ *
+ * @param queue The queue to use, nullptr to transmit directly again.
+ */
+template <typename Model>
+void PkpKeypad<Model>::attachTxQueue(PkpTxQueue* queue) {
+    _txQueue = queue;
+}
+
 /**
  * @brief Initializes the keypad system.
  *
@@ -45,78 +143,224 @@ Pkp::returnState_e Pkp::applyDefaultKeyStates() {
  *
  * @return A status code indicating success or the type of error encountered (e.g., not initialized).
  */
-Pkp::returnState_e Pkp::begin() {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::begin() {
     return _initializeKeypad();
 }
 
+/**
+ * @brief Builds the frames that bring the keypad into its configured state.
+ *
+ * The frames are composed from the current configuration, e.g. after loadProfile(): NMT start, heartbeat producer,
+ * key brightness, encoder top and start values, backlight, key colors, key blink colors and encoder LEDs. begin() and
+ * the reconnect send the same frames in one burst. The SDO confirmations of frames sent by the application are not
+ * tracked.
+ *
+ * @param frames Receives the frames in transmission order.
+ * @return The number of frames, up to STARTUP_FRAME_AMOUNT.
+ */
+template <typename Model>
+uint8_t PkpKeypad<Model>::buildStartupFrames(struct can_frame frames[STARTUP_FRAME_AMOUNT]) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < STARTUP_FRAME_AMOUNT; i++) {
+        if (_composeStartupFrame(i, SP_START | SP_CONFIG | SP_LEDS, frames[count])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+#if PKP_ENCODER_DYNAMICS
+/**
+ * @brief Retrieves the acceleration of the specified encoder.
+ *
+ * The acceleration is the change between the last two velocity estimates, see getEncoderVelocity().
+ * Only compiled in with PKP_ENCODER_DYNAMICS set to 1.
+ *
+ * @param encoderIndex The index of the encoder (0 to ENCODER_AMOUNT - 1).
+ * @return The acceleration in ticks per second squared, fixed point with ENCODER_FIXED_ONE. 0 if the encoder is not
+ *         turned or the index is out of range.
+ */
+template <typename Model>
+int32_t PkpKeypad<Model>::getEncoderAcceleration(uint8_t encoderIndex) {
+    if (encoderIndex > ENCODER_AMOUNT - 1 || !_isEncoderMoving(encoderIndex)) {
+        return 0;
+    }
+    return _encoderAcceleration[encoderIndex];
+}
+#endif
+
+/**
+ * @brief Retrieves the accumulated tick count of the specified encoder.
+ *
+ * The count sums up the signed ticks of all encoder PDOs since construction. Unlike the position, it is not limited
+ * by the encoder top value and does not wrap for 2^31 ticks. The acceleration curve does not apply.
+ *
+ * @param encoderIndex The index of the encoder (0 to ENCODER_AMOUNT - 1).
+ * @return The accumulated ticks, or 0 if the index is out of range.
+ */
+template <typename Model>
+int32_t PkpKeypad<Model>::getEncoderCount(uint8_t encoderIndex) {
+    if (encoderIndex > ENCODER_AMOUNT - 1) {
+        return 0;
+    }
+    return _encoderCount[encoderIndex];
+}
+
 /**
  * @brief Retrieves the position of the specified encoder.
  *
  * This function returns the current position of the encoder specified by the encoderIndex parameter.
- * If the encoderIndex is out of range (greater than PKP_MAX_ROTARY_ENCODER_AMOUNT - 1), the function
+ * If the encoderIndex is out of range (greater than ENCODER_AMOUNT - 1), the function
  * returns 0.
  *
- * @param encoderIndex The index of the encoder (0 to PKP_MAX_ROTARY_ENCODER_AMOUNT - 1).
+ * @param encoderIndex The index of the encoder (0 to ENCODER_AMOUNT - 1).
  * @return The position of the specified encoder, or 0 if the index is out of range.
  */
-uint16_t Pkp::getEncoderPosition(uint8_t encoderIndex) {
-    if (encoderIndex > PKP_MAX_ROTARY_ENCODER_AMOUNT - 1) {
+template <typename Model>
+uint16_t PkpKeypad<Model>::getEncoderPosition(uint8_t encoderIndex) {
+    if (encoderIndex > ENCODER_AMOUNT - 1) {
         return 0;
     }
     return _encoderPosition[encoderIndex];
 }
 
+#if PKP_ENCODER_DYNAMICS
+/**
+ * @brief Retrieves the velocity of the specified encoder.
+ *
+ * The velocity is estimated from the timestamped encoder PDOs of the last 250 ms (at most PKP_ENCODER_SAMPLES) and
+ * drops to 0 once no PDO was received for 250 ms.
+ * Only compiled in with PKP_ENCODER_DYNAMICS set to 1.
+ *
+ * @param encoderIndex The index of the encoder (0 to ENCODER_AMOUNT - 1).
+ * @return The velocity in ticks per second, fixed point with ENCODER_FIXED_ONE, negative if turned counterclockwise.
+ *         0 if the encoder is not turned or the index is out of range.
+ */
+template <typename Model>
+int32_t PkpKeypad<Model>::getEncoderVelocity(uint8_t encoderIndex) {
+    if (encoderIndex > ENCODER_AMOUNT - 1 || !_isEncoderMoving(encoderIndex)) {
+        return 0;
+    }
+    return _encoderVelocity[encoderIndex];
+}
+#endif
+
 /**
  * @brief Checks if a key is pressed.
  *
  * This function checks if the key specified by the keyIndex parameter is currently pressed.
- * If the keyIndex is out of range (greater than PKP_MAX_KEY_AMOUNT - 1), the function
+ * If the keyIndex is out of range (greater than KEY_AMOUNT - 1), the function
  * returns false.
  *
- * @param keyIndex The index of the key (0 to PKP_MAX_KEY_AMOUNT - 1).
+ * @param keyIndex The index of the key (0 to KEY_AMOUNT - 1).
  * @return true if the specified key is pressed, false otherwise or if the index is out of range.
  */
-bool Pkp::getKeyPress(uint8_t keyIndex) {
-    if (keyIndex > PKP_MAX_KEY_AMOUNT - 1) {
+template <typename Model>
+bool PkpKeypad<Model>::getKeyPress(uint8_t keyIndex) {
+    if (keyIndex > KEY_AMOUNT - 1) {
         return false;
     }
-    return _keyPressed[keyIndex];
+    return checkBit(_keyPressedMask, keyIndex);
 }
 
 /**
  * @brief Retrieves the state of the specified key.
  *
  * This function returns the current state of the key specified by the keyIndex parameter.
- * If the keyIndex is out of range (greater than PKP_MAX_KEY_AMOUNT - 1), the function
+ * If the keyIndex is out of range (greater than KEY_AMOUNT - 1), the function
  * returns 0.
  *
- * @param keyIndex The index of the key (0 to PKP_MAX_KEY_AMOUNT - 1).
+ * @param keyIndex The index of the key (0 to KEY_AMOUNT - 1).
  * @return The state of the specified key, or 0 if the index is out of range.
  */
-uint8_t Pkp::getKeyState(uint8_t keyIndex) {
-    if (keyIndex > PKP_MAX_KEY_AMOUNT - 1) {
+template <typename Model>
+uint8_t PkpKeypad<Model>::getKeyState(uint8_t keyIndex) {
+    if (keyIndex > KEY_AMOUNT - 1) {
         return 0;
     }
-    return _keyState[keyIndex];
+    return _getKeyState(keyIndex);
+}
+
+/**
+ * @brief Returns the NMT state reported by the last heartbeat of the keypad.
+ *
+ * @return The NMT state, NMT_UNKNOWN if no heartbeat was received since the last communication loss.
+ */
+template <typename Model>
+PkpBase::nmtState_e PkpKeypad<Model>::getNmtState() {
+    return _nmtState;
 }
 
 /**
  * @brief Retrieves the state of the specified wired input.
  *
- * This function returns the state of the wired input specified by the inputIndex parameter.
- * If the inputIndex is out of range (greater than PKP_MAX_WIRED_IN_AMOUNT - 1), the function
+ * This function returns the state of the wired input specified by the inputIndex parameter, scaled to 0 to 255.
+ * If the inputIndex is out of range (greater than WIRED_IN_AMOUNT - 1), the function
  * returns 0.
  *
- * @param inputIndex The index of the wired input (0 to PKP_MAX_WIRED_IN_AMOUNT - 1).
+ * @param inputIndex The index of the wired input (0 to WIRED_IN_AMOUNT - 1).
  * @return The state of the specified wired input, or 0 if the index is out of range.
  */
-uint8_t Pkp::getWiredInput(uint8_t inputIndex) {
-    if (inputIndex > PKP_MAX_WIRED_IN_AMOUNT - 1) {
+template <typename Model>
+uint8_t PkpKeypad<Model>::getWiredInput(uint8_t inputIndex) {
+    if (inputIndex > WIRED_IN_AMOUNT - 1) {
+        return 0;
+    }
+    return _scaleWiredInput(_wiredInputValue[inputIndex]);
+}
+
+/**
+ * @brief Retrieves the filtered value of the specified wired input at full resolution.
+ *
+ * @param inputIndex The index of the wired input (0 to WIRED_IN_AMOUNT - 1).
+ * @return The value from 0 to WIRED_IN_RAW_MAX, or 0 if the index is out of range.
+ */
+template <typename Model>
+uint16_t PkpKeypad<Model>::getWiredInputRaw(uint8_t inputIndex) {
+    if (inputIndex > WIRED_IN_AMOUNT - 1) {
         return 0;
     }
     return _wiredInputValue[inputIndex];
 }
 
+/**
+ * @brief Returns the number of SDO requests waiting for a response.
+ *
+ * @return The number of outstanding SDO requests (0 to PKP_SDO_MAX_PENDING).
+ */
+template <typename Model>
+uint8_t PkpKeypad<Model>::getSdoPending() {
+    uint8_t count = 0;
+    for (uint8_t mask = _sdoPendingMask; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Retrieves the runtime counters and timings of the keypad.
+ *
+ * The statistics are only collected if the library is compiled with PKP_STATS set to 1. Interrupts are disabled
+ * while the statistics are copied, so the snapshot is consistent even if process() is called from an interrupt.
+ * The timings are measured with micros(), so their resolution is that of the board (e.g. 4 us on AVR).
+ *
+ * @param stats Receives the statistics since construction or the last resetStats(), zeroed without PKP_STATS.
+ * @return True if the statistics are collected, false if the library is compiled without PKP_STATS.
+ */
+template <typename Model>
+bool PkpKeypad<Model>::getStats(stats_t& stats) {
+#if PKP_STATS
+    noInterrupts();
+    stats = _stats;
+    interrupts();
+    return true;
+#else
+    memset(&stats, 0, sizeof(stats));
+    return false;
+#endif
+}
+
 /**
  * @brief Checks and returns the communication status of the keypad.
  *
@@ -125,7 +369,8 @@ uint8_t Pkp::getWiredInput(uint8_t inputIndex) {
  *
  * @return The current communication status as an enum, indicating if messages have been received recently or not.
  */
-Pkp::keypadCanStatus_e Pkp::getStatus() {
+template <typename Model>
+PkpBase::keypadCanStatus_e PkpKeypad<Model>::getStatus() {
     return _keypadStatusWatchdog(MSG_RECEIVED_NOTHING);
 }
 
@@ -134,16 +379,19 @@ Pkp::keypadCanStatus_e Pkp::getStatus() {
  *
  * This function returns the number of ticks that have occurred for a particular encoder and then resets the tick count.
  * This is useful for applications needing to measure increments or decrements in encoder position since the last poll.
+ * The ticks are scaled by the acceleration curve set via setEncoderAccelerationCurve(). Ticks exceeding the int16_t
+ * range are kept for the next call.
  *
  * @param encoderIndex The index of the encoder whose ticks are to be retrieved.
  * @return The number of ticks since the last retrieval. Returns 0 if an invalid encoder index is provided.
  */
-int16_t Pkp::getRelativeEncoderTicks(uint8_t encoderIndex) {
-    if (encoderIndex > PKP_MAX_ROTARY_ENCODER_AMOUNT - 1) {
+template <typename Model>
+int16_t PkpKeypad<Model>::getRelativeEncoderTicks(uint8_t encoderIndex) {
+    if (encoderIndex > ENCODER_AMOUNT - 1) {
         return 0;
     }
-    int16_t ticks                       = _relativeEncoderTicks[encoderIndex];
-    _relativeEncoderTicks[encoderIndex] = 0;
+    int16_t ticks                       = constrain(_relativeEncoderTicks[encoderIndex], INT16_MIN, INT16_MAX);
+    _relativeEncoderTicks[encoderIndex] -= ticks;
     return ticks;
 }
 
@@ -151,15 +399,21 @@ int16_t Pkp::getRelativeEncoderTicks(uint8_t encoderIndex) {
  * @brief Initializes a rotary encoder with specified limits and initial value.
  *
  * Configures an encoder's maximum value and its initial position. If the maximum value is set to zero, it is treated as the maximum possible value (0xFFFF).
- * This method also sends CAN frames to set the encoder's maximum and initial values.
+ * This method also sends CAN frames to set the encoder's maximum and initial values. Writes finding no free SDO request
+ * slot are sent by the watchdog as soon as confirmations free one, so both values always reach the keypad.
  *
  * @param index The index of the encoder to initialize.
  * @param topValue The maximum value the encoder can count to before wrapping around.
  * @param actValue The starting position of the encoder.
  * @return A status code indicating the success of the initialization or the reason for failure (e.g., keypad not initialized).
  */
-Pkp::returnState_e Pkp::initializeEncoder(uint8_t index, uint8_t topValue, uint16_t actValue) {
-    index    = constrain(index, 0, PKP_MAX_ROTARY_ENCODER_AMOUNT - 1);
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::initializeEncoder(uint8_t index, uint8_t topValue, uint16_t actValue) {
+    if (ENCODER_AMOUNT == 0) {
+        return RS_INVALID_ENCODER_INDEX;
+    }
+
+    index    = constrain(index, 0, ENCODER_AMOUNT - 1);
     topValue = constrain(topValue, 0, 0x10);
 
     uint16_t realTopValue    = (topValue == 0) ? 0xFFFF : topValue;
@@ -170,33 +424,116 @@ Pkp::returnState_e Pkp::initializeEncoder(uint8_t index, uint8_t topValue, uint1
         return RS_KEYPAD_NOT_INITIALIZED;
     }
 
-    // Initialize can frame for encoder top level (0 equals to 0xFFFF)
-    struct can_frame txMsg;
-    txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
-    txMsg.can_dlc = 5;
-    txMsg.data[0] = 0x2F;
-    txMsg.data[1] = 0x00;
-    txMsg.data[2] = 0x20;
-    txMsg.data[3] = 0x06 + index;
-    txMsg.data[4] = _encoderTopValue[index];
+    // Encoder top level (0 equals to 0xFFFF) and start value, in the order of the SP_CONFIG frames
+    _sdoConfigMask |= 0b11 << (1 + 2 * index);
+    return _transmitConfigFrames();
+}
 
-    returnState_e returnValue = _transmit(txMsg);
-    if (returnValue != RS_SUCCESS) {
-        return returnValue;
+/**
+ * @brief Replaces the configuration by a profile created with saveProfile().
+ *
+ * Key colors, key modes, default key states, key brightness, backlight and encoder top and start values are taken
+ * from the profile and the keys are set to their default states. Before begin(), the profile only replaces the
+ * configuration sent by begin(). Afterwards, the changed configuration is sent in one burst.
+ *
+ * @param profile The profile, e.g. read from EEPROM or flash.
+ * @return A status code indicating success, a profile of another version or model, a corrupted profile or a
+ * transmission error.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::loadProfile(const profile_t& profile) {
+    const uint8_t* cursor = profile.data;
+    uint16_t       crc    = profile.data[PROFILE_SIZE - 2] | (profile.data[PROFILE_SIZE - 1] << 8);
+
+    bool validHeader = cursor[0] == 'P' && cursor[1] == 'K' && cursor[2] == PROFILE_VERSION && cursor[3] == KEY_AMOUNT &&
+                       cursor[4] == ENCODER_AMOUNT && cursor[5] <= 100 && cursor[6] <= BACKLIGHT_YELLOWGREEN && cursor[7] <= 100;
+    if (!validHeader || crc != _crc16(profile.data, PROFILE_SIZE - 2)) {
+        return RS_INVALID_PROFILE;
+    }
+    _keyBrightness       = cursor[5];
+    _backlightColor      = cursor[6];
+    _backlightBrightness = cursor[7];
+    cursor              += 8;
+
+    const uint32_t keyFieldMask = (1uL << (2 * KEY_AMOUNT)) - 1;
+
+    noInterrupts();
+    for (uint8_t mode = 0; mode < 2; mode++) {
+        for (uint8_t m = 0; m < 4; m++) {
+            for (uint8_t c = 0; c < 3; c++) {
+                _keyColorPlane[mode][m][c] = _readLittleEndian(cursor, 2) & KEY_MASK_ALL;
+            }
+        }
+    }
+    _keyModes         = _readLittleEndian(cursor, 4) & keyFieldMask;
+    _defaultKeyStates = _readLittleEndian(cursor, 4) & keyFieldMask;
+    for (uint8_t i = 0; i < KEY_AMOUNT; i++) {
+        _setKeyState(i, _getKeyField(_defaultKeyStates, i));
+    }
+    interrupts();
+
+    for (uint8_t i = 0; i < PKP_MAX_ROTARY_ENCODER_AMOUNT; i++) {
+        uint8_t  topValue  = _readLittleEndian(cursor, 1);
+        uint16_t initValue = _readLittleEndian(cursor, 2);
+        if (i < ENCODER_AMOUNT) {
+            _encoderTopValue[i]  = topValue == 0xFF ? topValue : min(topValue, (uint8_t)0x10);
+            _encoderInitValue[i] = topValue == 0xFF ? initValue : min(initValue, (uint16_t)_encoderTopValue[i]);
+        }
     }
 
-    // Initialize can frame for encoder start value
-    memset(&txMsg, 0, sizeof(txMsg));
-    txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
-    txMsg.can_dlc = 6;
-    txMsg.data[0] = 0x2B;
-    txMsg.data[1] = 0x00;
-    txMsg.data[2] = 0x20;
-    txMsg.data[3] = (0 == index) ? 0x03 : 0x05;
-    txMsg.data[4] = _encoderInitValue[index] & 0xFF;
-    txMsg.data[5] = _encoderInitValue[index] >> 8;
+    if (!_initialized) {
+        return RS_SUCCESS;
+    }
+    return _transmitStartupFrames(SP_CONFIG | SP_LEDS);
+}
 
-    return _transmit(txMsg);
+#if PKP_EVENTS
+/**
+ * @brief Takes the oldest input event from the event queue.
+ *
+ * Key, encoder and wired input changes are recorded as timestamped events while frames are decoded. The queue holds
+ * up to PKP_EVENT_QUEUE_SIZE events, further events are dropped until the queue is drained. No events are queued
+ * while an event callback is registered.
+ * Only compiled in with PKP_EVENTS set to 1.
+ *
+ * @param event Receives the event.
+ * @return True if an event was available, false if the queue is empty.
+ */
+template <typename Model>
+bool PkpKeypad<Model>::nextEvent(event_t& event) {
+    uint8_t tail = _eventTail;
+    if (tail == __atomic_load_n(&_eventHead, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    event = _events[tail & (PKP_EVENT_QUEUE_SIZE - 1)];
+    __atomic_store_n(&_eventTail, (uint8_t)(tail + 1), __ATOMIC_RELEASE);
+    return true;
+}
+#endif
+
+/**
+ * @brief Decodes all frames received via the attached receive ring.
+ *
+ * Has to be called cyclically from the main loop if a ring is attached via attachRxRing() or an animator via
+ * attachAnimator(). Afterwards the LED frames of a due animation tick are transmitted.
+ *
+ * @return The number of frames taken from the ring.
+ */
+template <typename Model>
+uint8_t PkpKeypad<Model>::poll() {
+    uint8_t          count = 0;
+    struct can_frame rxMsg;
+    while (_rxRing != nullptr && _rxRing->pop(rxMsg)) {
+        process(rxMsg);
+        count++;
+    }
+#if PKP_ANIMATOR
+    if (_animator != nullptr) {
+        _serviceAnimator(millis());
+    }
+#endif
+    return count;
 }
 
 /**
@@ -209,9 +546,10 @@ Pkp::returnState_e Pkp::initializeEncoder(uint8_t index, uint8_t topValue, uint1
  * @param defaultStates Array of default states for each key.
  * @return A status code indicating whether the default states were set successfully or if there was an invalid state.
  */
-Pkp::returnState_e Pkp::presetDefaultKeyStates(const int8_t defaultStates[PKP_MAX_KEY_AMOUNT]) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::presetDefaultKeyStates(const int8_t defaultStates[KEY_AMOUNT]) {
     bool invalidKeyState = false;
-    for (int i = 0; i < PKP_MAX_KEY_AMOUNT; i++) {
+    for (int i = 0; i < KEY_AMOUNT; i++) {
         if (!inLimits(defaultStates[i], -1, 3)) {
             invalidKeyState = true;
             continue;
@@ -219,7 +557,7 @@ Pkp::returnState_e Pkp::presetDefaultKeyStates(const int8_t defaultStates[PKP_MA
         if (defaultStates[i] == -1) {
             continue;
         }
-        _defaultKeyState[i] = defaultStates[i];
+        _setKeyField(_defaultKeyStates, i, defaultStates[i]);
     }
     if (invalidKeyState) {
         return RS_INVALID_KEY_STATE;
@@ -238,32 +576,121 @@ Pkp::returnState_e Pkp::presetDefaultKeyStates(const int8_t defaultStates[PKP_MA
  * @param data The data payload of the CAN frame.
  * @return True if the message was relevant and processed, false if keypay has not been the transmitter.
  */
-bool Pkp::process(const struct can_frame& rxMsg) {
+template <typename Model>
+bool PkpKeypad<Model>::process(const struct can_frame& rxMsg) {
 
-    if (rxMsg.can_id == CAN_RX_BASE_ID_KEYS + _canId) {
-        _decodeKeyStates(rxMsg.data);
+    bool ownFrame = rxMsg.can_id <= 0x7FF && (rxMsg.can_id & 0x7F) == _canId;
 
-    } else if (rxMsg.can_id == CAN_RX_BASE_ID_ENCODER_1 + _canId) {
-        _decodeRotaryEncoder(rxMsg.data, 0);
-
-    } else if (rxMsg.can_id == CAN_RX_BASE_ID_ENCODER_2 + _canId) {
-        _decodeRotaryEncoder(rxMsg.data, 1);
-
-    } else if (rxMsg.can_id == CAN_RX_BASE_ID_WIRED_IN + _canId) {
-        _decodeWiredInputs(rxMsg.data);
+    // Logged before dispatching, so the frame precedes the responses it triggers
+    if (_recorder != nullptr && ownFrame) {
+        _recorder->record(rxMsg, false);
+    }
 
-    } else if (rxMsg.can_id == CAN_RX_BASE_ID_HEARTBEAT + _canId) {
-        //nothing to do here...
-    } else {
-        //control reachers else clause only in case the can frame did not come from the keypad
+    if (!ownFrame || !_dispatch(rxMsg.can_id & ~0x7FuL, rxMsg)) {
+        //control reaches this point only in case the can frame did not come from the keypad
+        if (ownFrame && _busLoad != nullptr) {
+            _busLoad->add(rxMsg);
+        }
+#if PKP_STATS
+        _stats.rxFrames[RX_FOREIGN]++;
+#endif
         _keypadStatusWatchdog(MSG_RECEIVED_NOTHING);
         return false;
     }
-
-    _keypadStatusWatchdog(MSG_RECEIVED_VALID);
     return true;
 }
 
+#if PKP_PDO_CONFIG
+/**
+ * @brief Reads the communication parameters of a transmit PDO.
+ *
+ * The transmission type, inhibit time and event timer are read via SDO, the callback is invoked from process()
+ * once all requests are answered. An inhibit time the keypad does not support is reported as 0. The wired input
+ * PDO is sent periodically only, its period (object 0x2006) is reported as event timer.
+ * Only compiled in with PKP_PDO_CONFIG set to 1.
+ *
+ * @param pdo The transmit PDO.
+ * @param callback The function receiving the parameters.
+ * @return A status code indicating success, a missing callback, a PDO the model does not have, no free request
+ * slot or a transmission error.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::readPdoConfig(tpdo_e pdo, PdoCallback callback) {
+    if (callback == nullptr) {
+        return RS_NULLPOINTER;
+    }
+    return _issuePdoRequests(pdo, nullptr, callback);
+}
+#endif
+
+/**
+ * @brief Reads an object from the keypad's object dictionary.
+ *
+ * The request is sent immediately, the function does not wait for the response. The callback is invoked from
+ * process() once the keypad answered, or with SS_TIMEOUT if no answer arrived after all retries. Only expedited
+ * transfers (objects of up to 4 bytes) are supported.
+ *
+ * @param index The object index.
+ * @param subIndex The object sub-index.
+ * @param callback The function receiving the value.
+ * @return A status code indicating success, a missing callback, no free request slot or a transmission error.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::readSdo(uint16_t index, uint8_t subIndex, SdoCallback callback) {
+    if (callback == nullptr) {
+        return RS_NULLPOINTER;
+    }
+    return _readSdo(index, subIndex, callback);
+}
+
+/**
+ * @brief Clears the runtime counters and timings returned by getStats().
+ */
+template <typename Model>
+void PkpKeypad<Model>::resetStats() {
+#if PKP_STATS
+    noInterrupts();
+    memset(&_stats, 0, sizeof(_stats));
+    interrupts();
+#endif
+}
+
+/**
+ * @brief Stores the configuration in a profile.
+ *
+ * The profile holds key colors, key modes, default key states, key brightness, backlight and encoder top and start
+ * values in a versioned byte image with checksum, which can be written to EEPROM or flash as is and restored with
+ * loadProfile().
+ *
+ * @param profile Receives the profile.
+ */
+template <typename Model>
+void PkpKeypad<Model>::saveProfile(profile_t& profile) {
+    uint8_t* cursor = profile.data;
+    *cursor++       = 'P';
+    *cursor++       = 'K';
+    *cursor++       = PROFILE_VERSION;
+    *cursor++       = KEY_AMOUNT;
+    *cursor++       = ENCODER_AMOUNT;
+    *cursor++       = _keyBrightness;
+    *cursor++       = _backlightColor;
+    *cursor++       = _backlightBrightness;
+    for (uint8_t mode = 0; mode < 2; mode++) {
+        for (uint8_t m = 0; m < 4; m++) {
+            for (uint8_t c = 0; c < 3; c++) {
+                _writeLittleEndian(cursor, _keyColorPlane[mode][m][c], 2);
+            }
+        }
+    }
+    _writeLittleEndian(cursor, _keyModes, 4);
+    _writeLittleEndian(cursor, _defaultKeyStates, 4);
+    for (uint8_t i = 0; i < PKP_MAX_ROTARY_ENCODER_AMOUNT; i++) {
+        _writeLittleEndian(cursor, i < ENCODER_AMOUNT ? _encoderTopValue[i] : 0, 1);
+        _writeLittleEndian(cursor, i < ENCODER_AMOUNT ? _encoderInitValue[i] : 0, 2);
+    }
+    _writeLittleEndian(cursor, _crc16(profile.data, PROFILE_SIZE - 2), 2);
+}
+
 /**
  * @brief Sets the backlight color and brightness for the keypad.
  *
@@ -274,7 +701,8 @@ bool Pkp::process(const struct can_frame& rxMsg) {
  * @param brightness The brightness level from 0 (off) to 100 (full brightness), constrained within these limits.
  * @return A status code indicating the success of setting the backlight or the reason for failure (e.g., invalid color).
  */
-Pkp::returnState_e Pkp::setBacklight(int8_t color, int8_t brightness) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setBacklight(int8_t color, int8_t brightness) {
 
     if (!inLimits(color, BACKLIGHT_DEFAULT, BACKLIGHT_YELLOWGREEN)) {
         return RS_INVALID_COLOR;
@@ -283,16 +711,42 @@ Pkp::returnState_e Pkp::setBacklight(int8_t color, int8_t brightness) {
     _backlightBrightness = constrain(brightness, 0, 100);
     _backlightColor      = color;
 
-    // Initialize can frame
     struct can_frame txMsg;
+    _composeBacklight(txMsg);
+    return _transmitLed(LC_BACKLIGHT, txMsg);
+}
 
-    txMsg.can_id  = CAN_TX_BASE_ID_KEY_BACKLIGHT + _canId;
-    txMsg.can_dlc = 2;
-    txMsg.data[0] = 0x3F * _backlightBrightness / 100;
-    txMsg.data[1] = _backlightColor;
+#if PKP_ENCODER_DYNAMICS
+/**
+ * @brief Sets the acceleration curve of an encoder, so fast turns change values in larger steps.
+ *
+ * Below threshold the ticks are passed unchanged. Above, each tick counts more, rising linearly up to maxFactor ticks
+ * at fullSpeed and beyond. The fractions of scaled ticks are carried over, so no ticks are lost. The curve applies to
+ * getRelativeEncoderTicks(), the input snapshot and EV_ENCODER events, not to getEncoderCount().
+ * Only compiled in with PKP_ENCODER_DYNAMICS set to 1.
+ *
+ * @param encoderIndex The index of the encoder (0 to ENCODER_AMOUNT - 1).
+ * @param threshold The velocity in ticks per second up to which ticks are not scaled.
+ * @param fullSpeed The velocity in ticks per second from which ticks are scaled by maxFactor, raised to threshold + 1
+ *                  if lower.
+ * @param maxFactor The maximum scale factor (1 to 64), 1 disables the curve.
+ * @return RS_SUCCESS, or RS_INVALID_ENCODER_INDEX if the index is out of range.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setEncoderAccelerationCurve(uint8_t encoderIndex, uint16_t threshold, uint16_t fullSpeed, uint8_t maxFactor) {
+    if (encoderIndex > ENCODER_AMOUNT - 1) {
+        return RS_INVALID_ENCODER_INDEX;
+    }
 
-    return _transmit(txMsg);
+    encoderCurve_t& curve = _encoderCurve[encoderIndex];
+    noInterrupts();
+    curve.threshold = min(threshold, (uint16_t)(UINT16_MAX - 1));
+    curve.fullSpeed = max(fullSpeed, (uint16_t)(curve.threshold + 1));
+    curve.maxFactor = constrain(maxFactor, 1, ENCODER_CURVE_MAX_FACTOR);
+    interrupts();
+    return RS_SUCCESS;
 }
+#endif
 
 /**
  * @brief Sets the LED states for all encoders.
@@ -302,9 +756,10 @@ Pkp::returnState_e Pkp::setBacklight(int8_t color, int8_t brightness) {
  * @param ledsEncoder Array of new LED states for each encoder.
  * @return A status code indicating the success of the operation or if no update was needed.
  */
-Pkp::returnState_e Pkp::setEncoderLeds(int32_t ledsEncoder[PKP_MAX_ROTARY_ENCODER_AMOUNT]) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setEncoderLeds(int32_t ledsEncoder[PKP_MAX_ROTARY_ENCODER_AMOUNT]) {
     bool writeEncoderLed = 0;
-    for (int i = 0; i < PKP_MAX_ROTARY_ENCODER_AMOUNT; i++) {
+    for (int i = 0; i < ENCODER_AMOUNT; i++) {
         if (ledsEncoder[i] >= 0 && _currentEncoderLed[i] != (uint16_t)ledsEncoder[i]) {
             _currentEncoderLed[i] = ledsEncoder[i];
             writeEncoderLed       = true;
@@ -316,54 +771,72 @@ Pkp::returnState_e Pkp::setEncoderLeds(int32_t ledsEncoder[PKP_MAX_ROTARY_ENCODE
     return RS_SUCCESS;
 }
 
+#if PKP_EVENTS
+/**
+ * @brief Registers a function that is called for every input event.
+ *
+ * The callback is invoked from the context that decodes the frames (process() or poll()). While a callback is
+ * registered, events are not stored in the event queue.
+ * Only compiled in with PKP_EVENTS set to 1.
+ *
+ * @param callback The function to call, nullptr to queue events for nextEvent() again.
+ */
+template <typename Model>
+void PkpKeypad<Model>::setEventCallback(EventCallback callback) {
+    _eventCallback = callback;
+}
+#endif
+
 /**
  * @brief Sets the brightness level for all keys on the keypad.
  *
  * This function sets a uniform brightness for all keys, sending a CAN frame to apply the setting across the keypad.
+ * If all SDO request slots are occupied, the watchdog sends the frame once a confirmation frees one.
  *
  * @param brightness Brightness level from 0 (off) to 100 (full brightness).
  * @return A status code indicating the success of setting the brightness.
  */
-Pkp::returnState_e Pkp::setKeyBrightness(uint8_t brightness) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setKeyBrightness(uint8_t brightness) {
     _keyBrightness = constrain(brightness, 0, 100);
 
-    // Initialize can frame
-    struct can_frame txMsg;
-    txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
-    txMsg.can_dlc = 5;
-    txMsg.data[0] = 0x2F;
-    txMsg.data[1] = 0x03;
-    txMsg.data[2] = 0x20;
-    txMsg.data[3] = 0x01;
-    txMsg.data[4] = 0x3F * _keyBrightness / 100;
-
-    return _transmit(txMsg);
+    // SP_CONFIG frame 0, the brightness is composed when the frame is sent
+    _sdoConfigMask |= 0b1;
+    return _transmitConfigFrames();
 }
 
 /**
  * @brief Sets the color and blink color for a specific key.
  *
  * Updates the solid and blink colors for a specified key. It checks for valid key indices and color ranges before applying the updates.
+ * Colors are stored as one R/G/B bitmask per key state, so a color outside of keyColor_e leaves the key's color for that state unchanged.
  *
  * @param keyIndex Index of the key to modify.
  * @param colors Array representing the new color values for solid state.
  * @param blinkColors Array representing the new color values for blinking state.
  * @return A status code that could be success, invalid key index, or invalid color if checks fail.
  */
-Pkp::returnState_e Pkp::setKeyColor(uint8_t keyIndex, const uint8_t colors[4], const uint8_t blinkColors[4]) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setKeyColor(uint8_t keyIndex, const uint8_t colors[4], const uint8_t blinkColors[4]) {
 
     bool invalidColor = false;
 
-    if (!inLimits(keyIndex, 0, PKP_MAX_KEY_AMOUNT - 1)) {
+    if (!inLimits(keyIndex, 0, KEY_AMOUNT - 1)) {
         return RS_INVALID_KEY_INDEX;
     }
+    uint16_t keyBit = 1u << keyIndex;
     for (int i = 0; i < 4; i++) {
-        if (!inLimits(keyIndex, 0, PKP_MAX_KEY_AMOUNT - 1)) {
+        if (colors[i] > KEY_COLOR_WHITE || blinkColors[i] > KEY_COLOR_WHITE) {
             invalidColor = true;
             continue;
         }
-        _keyColor[i][keyIndex]      = colors[i];
-        _keyBlinkColor[i][keyIndex] = blinkColors[i];
+        for (int c = 0; c < 3; c++) {
+            uint8_t   colorBit = 0b100 >> c; // R, G, B
+            keyMask_t* solid    = &_keyColorPlane[CM_SOLID][i][c];
+            keyMask_t* blink    = &_keyColorPlane[CM_BLINK][i][c];
+            *solid              = (colors[i] & colorBit) ? (*solid | keyBit) : (*solid & ~keyBit);
+            *blink              = (blinkColors[i] & colorBit) ? (*blink | keyBit) : (*blink & ~keyBit);
+        }
     }
 
     returnState_e returnValue = RS_SUCCESS;
@@ -384,14 +857,15 @@ Pkp::returnState_e Pkp::setKeyColor(uint8_t keyIndex, const uint8_t colors[4], c
  * @param keyMode Mode to set for the key, defined by keyMode_e.
  * @return A status code indicating the success of the operation or reasons for failure such as invalid key index or mode.
  */
-Pkp::returnState_e Pkp::setKeyMode(uint8_t keyIndex, uint8_t keyMode) {
-    if (0 == inLimits(keyIndex, 0, PKP_MAX_KEY_AMOUNT - 1)) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setKeyMode(uint8_t keyIndex, uint8_t keyMode) {
+    if (0 == inLimits(keyIndex, 0, KEY_AMOUNT - 1)) {
         return RS_INVALID_KEY_INDEX;
     }
     if (0 == inLimits(keyMode, KEY_MODE_MOMENTARY, KEY_MODE_CYCLE4)) {
         return RS_INVALID_KEY_MODE;
     }
-    _keyMode[keyIndex] = keyMode;
+    _setKeyField(_keyModes, keyIndex, keyMode);
     return RS_SUCCESS;
 }
 
@@ -404,8 +878,9 @@ Pkp::returnState_e Pkp::setKeyMode(uint8_t keyIndex, uint8_t keyMode) {
  * @param overrideKeyState The state to enforce on the key; -1 to disable override.
  * @return A status code indicating the success of the operation or reasons for failure such as invalid key index or state.
  */
-Pkp::returnState_e Pkp::setKeyStateOverride(uint8_t keyIndex, int8_t overrideKeyState) {
-    if (keyIndex >= PKP_MAX_KEY_AMOUNT) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setKeyStateOverride(uint8_t keyIndex, int8_t overrideKeyState) {
+    if (keyIndex >= KEY_AMOUNT) {
         return RS_INVALID_KEY_INDEX;
     }
 
@@ -413,255 +888,1584 @@ Pkp::returnState_e Pkp::setKeyStateOverride(uint8_t keyIndex, int8_t overrideKey
         return RS_INVALID_KEY_STATE;
     }
 
-    _overrideKeyState[keyIndex] = overrideKeyState;
-    if (overrideKeyState >= 0) {
-        _keyState[keyIndex] = overrideKeyState;
+    if (overrideKeyState < 0) {
+        _overrideKeyMask &= ~(1u << keyIndex);
+    } else {
+        _overrideKeyMask |= 1u << keyIndex;
+        _setKeyField(_overrideKeyStates, keyIndex, overrideKeyState);
+        _setKeyState(keyIndex, overrideKeyState);
     }
     return _update(UT_KEY_LEDS);
 }
 
-//********** PRIVATE METHODS **********
-Pkp::returnState_e Pkp::_decodeKeyStates(const uint8_t data[8]) {
-
-    for (int i = 0; i < PKP_MAX_KEY_AMOUNT; i++) {
-        _keyPressed[i] = checkBit(data[i > 7 ? 1 : 0], i % 8);
-        if (_lastKeyPressed[i] != _keyPressed[i]) {
-            if (_keyMode[i] == KEY_MODE_MOMENTARY) {
-                _keyState[i] = _keyPressed[i];
-            } else if (_keyPressed[i] == true) {
-                switch (_keyMode[i]) {
-                    case KEY_MODE_TOGGLE:
-                        _keyState[i] = !_keyState[i];
-                        break;
-                    case KEY_MODE_CYCLE3:
-                        if (_keyState[i] < 2) {
-                            _keyState[i]++;
-                        } else {
-                            _keyState[i] = 0;
-                        }
-                        break;
-                    case KEY_MODE_CYCLE4:
-                        if (_keyState[i] < 3) {
-                            _keyState[i]++;
-                        } else {
-                            _keyState[i] = 0;
-                        }
-                        break;
-                }
-            }
-            _lastKeyPressed[i] = _keyPressed[i];
-        }
-        if (_overrideKeyState[i] >= 0) {
-            _keyState[i] = (uint8_t)_overrideKeyState[i];
+#if PKP_LED_SHADOW
+/**
+ * @brief Sets the interval in which unchanged LED frames are transmitted again.
+ *
+ * LED frames (key colors, key blinking, encoder LEDs and backlight) are only transmitted if their payload differs
+ * from the last frame acknowledged by the transmit callback. With a refresh interval greater than zero, an unchanged
+ * frame is sent again once the interval has elapsed since its last transmission, e.g. to recover from lost frames.
+ * Only compiled in with PKP_LED_SHADOW set to 1.
+ *
+ * @param interval Refresh interval in milliseconds; 0 disables forced refreshes (default).
+ */
+template <typename Model>
+void PkpKeypad<Model>::setLedRefreshInterval(uint16_t interval) {
+    _ledRefreshInterval = interval;
+}
+#endif
+
+#if PKP_WIRED_IN_FILTER
+/**
+ * @brief Sets the filter applied to a wired input.
+ *
+ * All getters, the snapshot and the threshold events use the filtered value. The filter restarts with the next
+ * received value.
+ * Only compiled in with PKP_WIRED_IN_FILTER set to 1.
+ *
+ * @param inputIndex The index of the wired input (0 to WIRED_IN_AMOUNT - 1).
+ * @param filter WF_NONE, WF_IIR or WF_AVERAGE.
+ * @param order Filter strength, the IIR time constant (1 to 7) or the average window (up to PKP_WIRED_IN_AVERAGE_SIZE
+ *              values) as a power of two. Larger values are limited.
+ * @return A status code indicating success or an invalid input index.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setWiredInputFilter(uint8_t inputIndex, wiredInputFilter_e filter, uint8_t order) {
+    if (inputIndex >= WIRED_IN_AMOUNT) {
+        return RS_INVALID_INPUT_INDEX;
+    }
+
+    uint8_t maxOrder = 0;
+    if (filter == WF_IIR) {
+        maxOrder = WIRED_IN_IIR_MAX_ORDER;
+    } else if (filter == WF_AVERAGE) {
+        while ((1 << (maxOrder + 1)) <= PKP_WIRED_IN_AVERAGE_SIZE) {
+            maxOrder++;
         }
     }
+    order = min(order, maxOrder);
 
-    return _update(UT_KEY_LEDS);
+    noInterrupts();
+    _wiredInputFilter[inputIndex] = order > 0 ? filter << 4 | order : WF_NONE;
+    _wiredInputPrimedMask         &= ~(1 << inputIndex);
+    interrupts();
+    return RS_SUCCESS;
 }
+#endif
 
-Pkp::returnState_e Pkp::_decodeRotaryEncoder(const uint8_t data[8], uint8_t encoderIndex) {
-    if (!inLimits(encoderIndex, 0, PKP_MAX_ROTARY_ENCODER_AMOUNT - 1)) {
-        return RS_INVALID_ENCODER_INDEX;
+/**
+ * @brief Sets the threshold for wired input events.
+ *
+ * An EV_WIRED_INPUT_HIGH event is generated when the input value rises to or above the threshold, an
+ * EV_WIRED_INPUT_LOW event when it falls below again.
+ *
+ * @param inputIndex The index of the wired input (0 to WIRED_IN_AMOUNT - 1).
+ * @param threshold Threshold on the scale of getWiredInput() (0 to 255), 0 disables events for this input.
+ * @return A status code indicating success or an invalid input index.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setWiredInputThreshold(uint8_t inputIndex, uint8_t threshold) {
+    // Smallest raw value which getWiredInput() reports as threshold or above
+    uint16_t rawThreshold = 0;
+    while (threshold > 0 && _scaleWiredInput(rawThreshold) < threshold) {
+        rawThreshold++;
     }
+    return setWiredInputThreshold(inputIndex, rawThreshold, (uint8_t)0);
+}
 
-    int8_t ticks                        = data[0] & 0x7F;
-    bool   ccWise                       = checkBit(data[0], 7);
-    _relativeEncoderTicks[encoderIndex] += ccWise ? -ticks : ticks;
+/**
+ * @brief Sets the threshold and hysteresis for wired input events at full resolution.
+ *
+ * An EV_WIRED_INPUT_HIGH event is generated when the filtered value rises to or above the threshold, an
+ * EV_WIRED_INPUT_LOW event only once it falls below threshold - hysteresis. Noise smaller than the hysteresis
+ * therefore does not cause events.
+ *
+ * @param inputIndex The index of the wired input (0 to WIRED_IN_AMOUNT - 1).
+ * @param threshold Threshold on the scale of getWiredInputRaw() (0 to WIRED_IN_RAW_MAX), 0 disables events for this
+ *                  input.
+ * @param hysteresis Distance of the falling threshold below the rising one (0 to 255), limited to the threshold.
+ * @return A status code indicating success or an invalid input index.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::setWiredInputThreshold(uint8_t inputIndex, uint16_t threshold, uint8_t hysteresis) {
+    if (inputIndex >= WIRED_IN_AMOUNT) {
+        return RS_INVALID_INPUT_INDEX;
+    }
+    noInterrupts();
+    _wiredInputThreshold[inputIndex]  = threshold;
+    _wiredInputHysteresis[inputIndex] = min(hysteresis, threshold);
+    _wiredInputHighMask               &= ~(1 << inputIndex);
+    interrupts();
+    return RS_SUCCESS;
+}
 
-    _encoderPosition[encoderIndex] = data[1] | data[2] << 8;
+/**
+ * @brief Takes a consistent snapshot of all input states.
+ *
+ * Interrupts are disabled while the state is copied, so the snapshot is consistent even if process() is called
+ * from an interrupt. Like getRelativeEncoderTicks(), the snapshot consumes the relative encoder ticks: they count
+ * from the previous snapshot or getRelativeEncoderTicks() call, whichever was last. encoderCount is not reset and
+ * suits several readers.
+ *
+ * @param snapshot Receives the key, encoder and wired input states and the communication status.
+ */
+template <typename Model>
+void PkpKeypad<Model>::takeInputSnapshot(inputSnapshot_t& snapshot) {
+    noInterrupts();
+    snapshot.status     = _keypadCanStatus;
+    snapshot.keyPressed = _keyPressedMask;
+    for (uint8_t i = 0; i < KEY_AMOUNT; i++) {
+        snapshot.keyState[i] = _getKeyState(i);
+    }
+    for (uint8_t i = 0; i < ENCODER_AMOUNT; i++) {
+        snapshot.encoderCount[i]         = _encoderCount[i];
+        snapshot.encoderPosition[i]      = _encoderPosition[i];
+#if PKP_ENCODER_DYNAMICS
+        snapshot.encoderVelocity[i]      = _isEncoderMoving(i) ? _encoderVelocity[i] : 0;
+#else
+        snapshot.encoderVelocity[i]      = 0;
+#endif
+        snapshot.relativeEncoderTicks[i] = constrain(_relativeEncoderTicks[i], INT16_MIN, INT16_MAX);
+        _relativeEncoderTicks[i]         -= snapshot.relativeEncoderTicks[i];
+    }
+    for (uint8_t i = 0; i < WIRED_IN_AMOUNT; i++) {
+        snapshot.wiredInput[i]    = _scaleWiredInput(_wiredInputValue[i]);
+        snapshot.wiredInputRaw[i] = _wiredInputValue[i];
+    }
+    interrupts();
+}
 
-    return RS_SUCCESS;
+#if PKP_PDO_CONFIG
+/**
+ * @brief Writes the communication parameters of a transmit PDO.
+ *
+ * The transmission type must be TT_SYNC to TT_SYNC_MAX or TT_EVENT_DRIVEN. The inhibit time is not documented
+ * for the keypads and only written if it is not 0. The wired input PDO is sent periodically only: it accepts
+ * TT_EVENT_DRIVEN without inhibit time and an event timer of 80 to 2000 ms, which is written as period in 10 ms
+ * steps to object 0x2006. The callback is invoked from process() once all requests are confirmed.
+ * Only compiled in with PKP_PDO_CONFIG set to 1.
+ *
+ * @param pdo The transmit PDO.
+ * @param config The parameters to write.
+ * @param callback The function receiving the result, nullptr if the result is not of interest.
+ * @return A status code indicating success, a PDO the model does not have, invalid parameters, no free request
+ * slot or a transmission error.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::writePdoConfig(tpdo_e pdo, const pdoConfig_t& config, PdoCallback callback) {
+    bool validType = inLimits(config.transmissionType, TT_SYNC, TT_SYNC_MAX) || config.transmissionType == TT_EVENT_DRIVEN;
+    if (pdo == TPDO_WIRED_IN) {
+        validType = config.transmissionType == TT_EVENT_DRIVEN && config.inhibitTime == 0 &&
+                    inLimits(config.eventTimer, WIRED_IN_PERIOD_MIN, WIRED_IN_PERIOD_MAX);
+    }
+    if (!validType) {
+        return _isPdoAvailable(pdo) ? RS_INVALID_PDO_CONFIG : RS_INVALID_PDO;
+    }
+    return _issuePdoRequests(pdo, &config, callback);
 }
+#endif
 
-Pkp::returnState_e Pkp::_decodeWiredInputs(const uint8_t data[8]) {
+/**
+ * @brief Writes an object of the keypad's object dictionary.
+ *
+ * The request is sent immediately, the function does not wait for the confirmation. Up to PKP_SDO_MAX_PENDING
+ * requests may be outstanding at the same time. If a write to the same object is still outstanding, no second
+ * request is queued: the new value is sent once the previous write is confirmed and the callback reports the
+ * result of the last value only.
+ *
+ * @param index The object index.
+ * @param subIndex The object sub-index.
+ * @param value The value to write.
+ * @param size The size of the object in bytes (1 to 4).
+ * @param callback The function receiving the result, nullptr if the result is not of interest.
+ * @return A status code indicating success, an invalid size, no free request slot or a transmission error.
+ */
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::writeSdo(uint16_t index, uint8_t subIndex, uint32_t value, uint8_t size, SdoCallback callback) {
+    return _writeSdo(index, subIndex, value, size, callback, false);
+}
 
-    uint32_t value;
-    for (int i = 0; i < PKP_MAX_WIRED_IN_AMOUNT; i++) {
-        value               = data[i * 2] | (data[i * 2 + 1] << 8);
-        value               = min(value, 500);
-        _wiredInputValue[i] = (uint8_t)(value * 255uL / 500uL);
+//********** PRIVATE METHODS **********
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_beginStartup(bool broadcastStart) {
+
+    // The keypad may have lost its LED states, so nothing must be suppressed
+    _invalidateLedShadow(LED_CHANNEL_MASK_ALL);
+#if PKP_STATS
+    _stats.initializations++;
+#endif
+
+    if (broadcastStart) {
+        struct can_frame txMsg;
+        _composeNmtStart(txMsg);
+        txMsg.data[1]             = 0x00; // node 0 addresses all nodes
+        returnState_e returnValue = _transmit(txMsg, true);
+        if (returnValue != RS_SUCCESS) {
+            return returnValue;
+        }
     }
 
+    // The remaining frames are sent by _serviceStartup(), the keypad has the watchdog time to answer them
+    _initialized           = true;
+    _lastCanFrameTimestamp = millis();
+    _reconnectStage        = RC_IDLE;
+    _reconnectSdoMask      = 0;
+    _startupFrame          = 1;
+    _startupParts          = SP_START | SP_CONFIG | SP_LEDS;
     return RS_SUCCESS;
 }
 
-Pkp::returnState_e Pkp::_initializeKeypad() {
+template <typename Model>
+void PkpKeypad<Model>::_checkSdoTimeouts(uint16_t now) {
+    if (_sdoPendingMask == 0) {
+        return;
+    }
 
-    // Send startup message to keypad
-    struct can_frame txMsg;
+    for (uint8_t slot = 0; slot < PKP_SDO_MAX_PENDING; slot++) {
+        if (!checkBit(_sdoPendingMask, slot) || (uint16_t)(now - _sdoRequest[slot].timestamp) < SDO_TIMEOUT) {
+            continue;
+        }
+        if (_sdoRequest[slot].retries == 0) {
+            _finishSdo(slot, SS_TIMEOUT, 0);
+            continue;
+        }
+        _sdoRequest[slot].retries--;
+        _sendSdo(slot);
+    }
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_composeBacklight(struct can_frame& txMsg) {
+#if PKP_ANIMATOR
+    int8_t brightness = _animator != nullptr ? _animator->getImage().backlightBrightness : -1;
+#else
+    int8_t brightness = -1;
+#endif
+
+    txMsg.can_id  = CAN_TX_BASE_ID_KEY_BACKLIGHT + _canId;
+    txMsg.can_dlc = 2;
+    txMsg.data[0] = 0x3F * (brightness >= 0 ? brightness : _backlightBrightness) / 100;
+    txMsg.data[1] = _backlightColor;
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_composeEncoderLeds(struct can_frame& txMsg) {
+    uint16_t leds[PKP_MAX_ROTARY_ENCODER_AMOUNT] = {0};
+    for (uint8_t i = 0; i < ENCODER_AMOUNT; i++) {
+        leds[i] = _currentEncoderLed[i];
+#if PKP_ANIMATOR
+        if (_animator != nullptr) {
+            const PkpAnimator::ledImage_t& image = _animator->getImage();
+            leds[i]                              = (leds[i] & ~image.encoderMask[i]) | (image.encoderLeds[i] & image.encoderMask[i]);
+        }
+#endif
+    }
+
+    txMsg.can_id  = CAN_TX_BASE_ID_ENCODER_LED + _canId;
+    txMsg.can_dlc = 4;
+    txMsg.data[0] = leds[0] & 0xFF;
+    txMsg.data[1] = leds[0] >> 8;
+    txMsg.data[2] = leds[1] & 0xFF;
+    txMsg.data[3] = leds[1] >> 8;
+}
+
+template <typename Model>
+uint8_t PkpKeypad<Model>::_composeKeyBrightness() {
+#if PKP_ANIMATOR
+    // A running brightness fade takes precedence
+    int8_t animated = _animator != nullptr ? _animator->getImage().keyBrightness : -1;
+    return 0x3F * (animated >= 0 ? animated : _keyBrightness) / 100;
+#else
+    return 0x3F * _keyBrightness / 100;
+#endif
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_composeKeyLeds(bool mode, struct can_frame& txMsg) {
+    txMsg.can_id  = mode ? CAN_TX_BASE_ID_KEY_BLINK : CAN_TX_BASE_ID_KEY_COLOR;
+    txMsg.can_id  += _canId;
+    txMsg.can_dlc = 3 * KEY_LED_BYTES;
+
+    // Every key is in exactly one state, so the color of all keys is the union of the per state color planes.
+    // In blink mode, the solid color is only added for states that have both a solid and a blink color.
+    uint16_t red   = 0;
+    uint16_t green = 0;
+    uint16_t blue  = 0;
+    for (int m = 0; m < 4; m++) {
+        const uint16_t   keys  = _keyStateMask[m];
+        const keyMask_t* solid = _keyColorPlane[CM_SOLID][m];
+        if (mode == CM_SOLID) {
+            red   |= keys & solid[0];
+            green |= keys & solid[1];
+            blue  |= keys & solid[2];
+            continue;
+        }
+        const keyMask_t* blink = _keyColorPlane[CM_BLINK][m];
+        const uint16_t   both  = (solid[0] | solid[1] | solid[2]) & (blink[0] | blink[1] | blink[2]);
+        red   |= keys & ((both & solid[0]) | blink[0]);
+        green |= keys & ((both & solid[1]) | blink[1]);
+        blue  |= keys & ((both & solid[2]) | blink[2]);
+    }
+
+#if PKP_ANIMATOR
+    // Animated keys take their colors from the animator image, combined the same way
+    if (_animator != nullptr && _animator->getImage().keyMask != 0) {
+        const PkpAnimator::ledImage_t& image = _animator->getImage();
+        const uint16_t                 keys  = image.keyMask;
+        const uint16_t*                solid = image.keyColor[CM_SOLID];
+        const uint16_t*                blink = image.keyColor[CM_BLINK];
+        const uint16_t                 both  = mode ? (solid[0] | solid[1] | solid[2]) & (blink[0] | blink[1] | blink[2]) : 0xFFFF;
+        const uint16_t                 extra = mode ? 0xFFFF : 0;
+        red   = (red & ~keys) | (keys & ((both & solid[0]) | (extra & blink[0])));
+        green = (green & ~keys) | (keys & ((both & solid[1]) | (extra & blink[1])));
+        blue  = (blue & ~keys) | (keys & ((both & solid[2]) | (extra & blink[2])));
+    }
+#endif
+
+    // KEY_LED_BYTES per color, e.g. for 15 keys BYTE 0 (R8 R7 R6 R5 - R4 R3 R2 R1), BYTE 1 (- R15 ... R9), BYTE 2/3 green,
+    // BYTE 4/5 blue and for up to 8 keys BYTE 0 red, BYTE 1 green, BYTE 2 blue
+    const uint16_t colors[3] = {red, green, blue};
+    for (uint8_t c = 0; c < 3; c++) {
+        for (uint8_t b = 0; b < KEY_LED_BYTES; b++) {
+            txMsg.data[c * KEY_LED_BYTES + b] = colors[c] >> (8 * b);
+        }
+    }
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_composeNmtStart(struct can_frame& txMsg) {
     txMsg.can_id  = 0x00;
     txMsg.can_dlc = 2;
     txMsg.data[0] = 0x01;
     txMsg.data[1] = _canId;
+}
 
-    returnState_e returnValue = _transmit(txMsg, true);
-    if (returnValue != RS_SUCCESS) {
-        return returnValue;
+template <typename Model>
+void PkpKeypad<Model>::_composeSdoDownload(struct can_frame& txMsg, uint16_t index, uint8_t subIndex, uint32_t value, uint8_t size) {
+    txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
+    txMsg.can_dlc = 4 + size;
+    txMsg.data[0] = 0x23 | ((4 - size) << 2);
+    txMsg.data[1] = index & 0xFF;
+    txMsg.data[2] = index >> 8;
+    txMsg.data[3] = subIndex;
+    for (uint8_t b = 0; b < 4; b++) {
+        txMsg.data[4 + b] = value >> (8 * b);
     }
+}
 
-    if (_canNodeHeartbeatInterval > 0) {
-        // Activate heartbeat production
-        memset(&txMsg, 0, sizeof(txMsg));
-        txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
-        txMsg.can_dlc = 6;
-        txMsg.data[0] = 0x2B;
-        txMsg.data[1] = 0x17;
-        txMsg.data[2] = 0x10;
-        txMsg.data[3] = 0x00;
-        txMsg.data[4] = _canNodeHeartbeatInterval & 0xFF;
-        txMsg.data[5] = _canNodeHeartbeatInterval >> 8;
-        returnValue   = _transmit(txMsg, true);
-        if (returnValue != RS_SUCCESS) {
-            return returnValue;
+template <typename Model>
+bool PkpKeypad<Model>::_composeStartupFrame(uint8_t frameIndex, uint8_t parts, struct can_frame& txMsg) {
+    // SP_START: NMT start and heartbeat producer
+    if (frameIndex < 2) {
+        if (!(parts & SP_START) || (frameIndex == 1 && _canNodeHeartbeatInterval == 0)) {
+            return false;
         }
+        if (frameIndex == 0) {
+            _composeNmtStart(txMsg);
+        } else {
+            _composeSdoDownload(txMsg, 0x1017, 0x00, _canNodeHeartbeatInterval, 2);
+        }
+        return true;
     }
+    frameIndex -= 2;
 
-    _initialized = true;
+    // SP_CONFIG: key brightness, top and start value per encoder
+    if (frameIndex < 1 + 2 * ENCODER_AMOUNT) {
+        if (!(parts & SP_CONFIG)) {
+            return false;
+        }
+        uint8_t i = (frameIndex - 1) / 2;
+        if (frameIndex == 0) {
+            _composeSdoDownload(txMsg, 0x2003, 0x01, _composeKeyBrightness(), 1);
+        } else if (frameIndex % 2 == 1) {
+            // Like initializeEncoder(), a top value of 0 is sent as maximum
+            _composeSdoDownload(txMsg, 0x2000, 0x06 + i, _encoderTopValue[i] == 0 ? 0xFF : _encoderTopValue[i], 1);
+        } else {
+            _composeSdoDownload(txMsg, 0x2000, (0 == i) ? 0x03 : 0x05, _encoderInitValue[i], 2);
+        }
+        return true;
+    }
+    frameIndex -= 1 + 2 * ENCODER_AMOUNT;
 
-    returnValue = setBacklight(_backlightColor, _backlightBrightness);
-    if (returnValue != RS_SUCCESS) {
-        return returnValue;
+    // SP_LEDS: backlight, key colors, key blink colors and encoder LEDs
+    if (!(parts & SP_LEDS)) {
+        return false;
+    }
+    switch (frameIndex) {
+        case 0:
+            _composeBacklight(txMsg);
+            return true;
+        case 1:
+        case 2:
+            _composeKeyLeds(frameIndex == 2 ? CM_BLINK : CM_SOLID, txMsg);
+            return true;
+        case 3: {
+            if (ENCODER_AMOUNT == 0) {
+                return false;
+            }
+            uint32_t blinkLeds = _getEncoderBlinkLeds();
+            if (blinkLeds != 0) {
+                // The blink setting replaces the solid encoder LEDs
+                _composeSdoDownload(txMsg, 0x2002, 0x04, blinkLeds, 4);
+            } else {
+                _composeEncoderLeds(txMsg);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+template <typename Model>
+uint16_t PkpKeypad<Model>::_crc16(const uint8_t* data, uint8_t length) {
+    // CRC-16/CCITT-FALSE
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+template <typename Model>
+bool PkpKeypad<Model>::_dispatch(uint32_t baseId, const struct can_frame& rxMsg) {
+#if PKP_STATS
+    uint32_t start = micros();
+#endif
+    switch (baseId) {
+        case CAN_RX_BASE_ID_KEYS:
+            _decodeKeyStates(rxMsg.data);
+            break;
+        // The model constants are known at compile time, so the decoders of missing inputs are optimized out
+        case CAN_RX_BASE_ID_ENCODER_1:
+            if (ENCODER_AMOUNT < 1) {
+                return false;
+            }
+            _decodeRotaryEncoder(rxMsg.data, 0);
+            break;
+        case CAN_RX_BASE_ID_ENCODER_2:
+            if (ENCODER_AMOUNT < 2) {
+                return false;
+            }
+            _decodeRotaryEncoder(rxMsg.data, 1);
+            break;
+        case CAN_RX_BASE_ID_WIRED_IN:
+            if (WIRED_IN_AMOUNT < 1) {
+                return false;
+            }
+            _decodeWiredInputs(rxMsg.data);
+            break;
+        case CAN_RX_BASE_ID_HEARTBEAT:
+            _decodeHeartbeat(rxMsg.data);
+            break;
+        case CAN_RX_BASE_ID_SDO:
+            _decodeSdoResponse(rxMsg.data);
+            break;
+        default:
+            return false;
+    }
+
+    // Rejected frames are accounted by the caller, so a meter shared with a PkpBus counts them once
+    if (_busLoad != nullptr) {
+        _busLoad->add(rxMsg);
+    }
+    _keypadStatusWatchdog(MSG_RECEIVED_VALID);
+#if PKP_STATS
+    _stats.rxFrames[_getRxFrameType(baseId)]++;
+    _recordTiming(_stats.processTime, start);
+#endif
+    return true;
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_decodeHeartbeat(const uint8_t data[8]) {
+    _nmtState = (nmtState_e)(data[0] & 0x7F);
+
+    if (!_initialized) {
+        return;
+    }
+
+    switch (_nmtState) {
+        case NMT_BOOT_UP:
+            // The keypad restarted and lost its complete configuration, even if a reconnect is in progress
+            _reconnectStage   = RC_PROBE;
+            _reconnectConfig  = true;
+            _reconnectDelay   = 0;
+            _reconnectSdoMask = 0;
+            break;
+        case NMT_STOPPED:
+        case NMT_PRE_OPERATIONAL:
+            // The SDO configuration is retained, but PDOs sent while not operational were dropped
+            if (_reconnectStage == RC_IDLE || _reconnectStage == RC_BACKOFF) {
+                _reconnectStage  = RC_START;
+                _reconnectConfig = false;
+                _reconnectDelay  = 0;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_decodeKeyStates(const uint8_t data[8]) {
+
+    uint32_t timestamp = micros();
+    uint16_t pressed   = (data[0] | (data[1] << 8)) & KEY_MASK_ALL;
+    uint16_t changed   = pressed ^ _keyPressedMask;
+    _keyPressedMask    = pressed;
+
+    for (int i = 0; changed != 0; i++, changed >>= 1) {
+        if (!checkBit(changed, 0)) {
+            continue;
+        }
+        bool keyPressed = checkBit(pressed, i);
+        _pushEvent(keyPressed ? EV_KEY_DOWN : EV_KEY_UP, i, 0, timestamp);
+
+        uint8_t lastKeyState = _getKeyState(i);
+        uint8_t keyState     = lastKeyState;
+        uint8_t keyMode      = _getKeyField(_keyModes, i);
+        if (keyMode == KEY_MODE_MOMENTARY) {
+            keyState = keyPressed;
+        } else if (keyPressed == true) {
+            switch (keyMode) {
+                case KEY_MODE_TOGGLE:
+                    keyState = !keyState;
+                    break;
+                case KEY_MODE_CYCLE3:
+                    if (keyState < 2) {
+                        keyState++;
+                    } else {
+                        keyState = 0;
+                    }
+                    break;
+                case KEY_MODE_CYCLE4:
+                    if (keyState < 3) {
+                        keyState++;
+                    } else {
+                        keyState = 0;
+                    }
+                    break;
+            }
+        }
+        if (checkBit(_overrideKeyMask, i)) {
+            keyState = _getKeyField(_overrideKeyStates, i);
+        }
+        if (keyState != lastKeyState) {
+            _pushEvent(EV_KEY_STATE, i, keyState, timestamp);
+        }
+        _setKeyState(i, keyState);
+    }
+
+    // Overridden keys keep their state regardless of any other state change
+    for (uint8_t i = 0; i < KEY_AMOUNT; i++) {
+        if (checkBit(_overrideKeyMask, i)) {
+            _setKeyState(i, _getKeyField(_overrideKeyStates, i));
+        }
+    }
+
+    return _update(UT_KEY_LEDS);
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_decodeRotaryEncoder(const uint8_t data[8], uint8_t encoderIndex) {
+    if (!inLimits(encoderIndex, 0, ENCODER_AMOUNT - 1)) {
+        return RS_INVALID_ENCODER_INDEX;
     }
-    returnValue = setKeyBrightness(_keyBrightness);
+
+    int8_t ticks                   = data[0] & 0x7F;
+    bool   ccWise                  = checkBit(data[0], 7);
+    _encoderPosition[encoderIndex] = data[1] | data[2] << 8;
+    if (ticks == 0) {
+        return RS_SUCCESS;
+    }
+
+    uint32_t timestamp                  = micros();
+    _encoderCount[encoderIndex]         += ccWise ? -ticks : ticks;
+#if PKP_ENCODER_DYNAMICS
+    _updateEncoderEstimate(encoderIndex, timestamp);
+    int16_t scaledTicks                 = _scaleEncoderTicks(encoderIndex, ccWise ? -ticks : ticks);
+#else
+    int16_t scaledTicks                 = ccWise ? -ticks : ticks;
+#endif
+    _relativeEncoderTicks[encoderIndex] += scaledTicks;
+    _pushEvent(EV_ENCODER, encoderIndex, scaledTicks, timestamp);
+
+    return RS_SUCCESS;
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_decodeSdoResponse(const uint8_t data[8]) {
+    uint16_t index    = data[1] | (data[2] << 8);
+    uint8_t  subIndex = data[3];
+    uint8_t  command  = data[0] & 0xE0;
+    uint32_t value    = data[4] | ((uint32_t)data[5] << 8) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+
+    for (uint8_t slot = 0; slot < PKP_SDO_MAX_PENDING; slot++) {
+        sdoRequest_t& request = _sdoRequest[slot];
+        if (!checkBit(_sdoPendingMask, slot) || request.index != index || request.subIndex != subIndex) {
+            continue;
+        }
+
+        bool upload = request.command == SDO_CCS_UPLOAD;
+        if (command == SDO_CS_ABORT) {
+            _finishSdo(slot, SS_ABORTED, value);
+            return;
+        }
+        if (command == SDO_SCS_DOWNLOAD && !upload) {
+            if (checkBit(_sdoDirtyMask, slot)) {
+                // The value changed while the previous write was outstanding
+                request.retries = SDO_RETRIES;
+                _sendSdo(slot);
+                return;
+            }
+            _finishSdo(slot, SS_SUCCESS, 0);
+            return;
+        }
+        if (command == SDO_SCS_UPLOAD && upload) {
+            if (!checkBit(data[0], 1)) {
+                // Segmented transfers are not supported, release the keypad's SDO server
+                struct can_frame txMsg;
+                txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
+                txMsg.can_dlc = 8;
+                txMsg.data[0] = SDO_CS_ABORT;
+                txMsg.data[1] = data[1];
+                txMsg.data[2] = data[2];
+                txMsg.data[3] = data[3];
+                txMsg.data[4] = SDO_ABORT_UNSUPPORTED & 0xFF;
+                txMsg.data[5] = (SDO_ABORT_UNSUPPORTED >> 8) & 0xFF;
+                txMsg.data[6] = (SDO_ABORT_UNSUPPORTED >> 16) & 0xFF;
+                txMsg.data[7] = SDO_ABORT_UNSUPPORTED >> 24;
+                _transmit(txMsg);
+                _finishSdo(slot, SS_ABORTED, SDO_ABORT_UNSUPPORTED);
+                return;
+            }
+            if (checkBit(data[0], 0)) {
+                // Size indicated, bits 2 and 3 hold the number of unused bytes
+                value &= 0xFFFFFFFFuL >> (8 * ((data[0] >> 2) & 0x03));
+            }
+            _finishSdo(slot, SS_SUCCESS, value);
+            return;
+        }
+    }
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_decodeWiredInputs(const uint8_t data[8]) {
+
+    uint32_t timestamp = micros();
+    uint16_t value;
+    for (uint8_t i = 0; i < WIRED_IN_AMOUNT; i++) {
+        value               = data[i * 2] | (data[i * 2 + 1] << 8);
+        value               = min(value, WIRED_IN_RAW_MAX);
+#if PKP_WIRED_IN_FILTER
+        value               = _filterWiredInput(i, value);
+#endif
+        _wiredInputValue[i] = value;
+
+        if (_wiredInputThreshold[i] == 0) {
+            continue;
+        }
+        uint8_t inputBit = 1 << i;
+        bool    wasHigh  = (_wiredInputHighMask & inputBit) != 0;
+        bool    high     = wasHigh ? value + _wiredInputHysteresis[i] >= _wiredInputThreshold[i] : value >= _wiredInputThreshold[i];
+        if (high != wasHigh) {
+            _wiredInputHighMask ^= inputBit;
+            _pushEvent(high ? EV_WIRED_INPUT_HIGH : EV_WIRED_INPUT_LOW, i, value, timestamp);
+        }
+    }
+#if PKP_WIRED_IN_FILTER
+    _wiredInputAverageHead = (_wiredInputAverageHead + 1) & (PKP_WIRED_IN_AVERAGE_SIZE - 1);
+#endif
+
+    return RS_SUCCESS;
+}
+
+#if PKP_WIRED_IN_FILTER
+template <typename Model>
+uint16_t PkpKeypad<Model>::_filterWiredInput(uint8_t inputIndex, uint16_t value) {
+    if (inputIndex >= WIRED_IN_AMOUNT) {
+        return value;
+    }
+    uint8_t   order  = _wiredInputFilter[inputIndex] & 0x0F;
+    uint16_t& state  = _wiredInputFilterState[inputIndex];
+    uint8_t   bit    = 1 << inputIndex;
+    bool      primed = (_wiredInputPrimedMask & bit) != 0;
+    _wiredInputPrimedMask |= bit;
+
+    switch (_wiredInputFilter[inputIndex] >> 4) {
+        case WF_IIR: {
+            // Shifts only, the rounding keeps the state from settling below the input
+            if (!primed) {
+                state = value << WIRED_IN_IIR_SHIFT;
+            }
+            int16_t delta = (int16_t)((value << WIRED_IN_IIR_SHIFT) - state);
+            state         += (delta + (1 << (order - 1))) >> order;
+            return (state + (1 << (WIRED_IN_IIR_SHIFT - 1))) >> WIRED_IN_IIR_SHIFT;
+        }
+        case WF_AVERAGE: {
+            uint16_t* ring = _wiredInputAverage[inputIndex];
+            uint8_t   head = _wiredInputAverageHead;
+            if (!primed) {
+                for (uint8_t i = 0; i < PKP_WIRED_IN_AVERAGE_SIZE; i++) {
+                    ring[i] = value;
+                }
+                state = value << order;
+            }
+            // The running sum drops the value leaving the window of 2^order values
+            state      += value - ring[(head - (1 << order)) & (PKP_WIRED_IN_AVERAGE_SIZE - 1)];
+            ring[head] = value;
+            return (state + (1 << (order - 1))) >> order;
+        }
+        default:
+            return value;
+    }
+}
+#endif
+
+template <typename Model>
+void PkpKeypad<Model>::_finishSdo(uint8_t slot, sdoStatus_e status, uint32_t value) {
+    const sdoRequest_t& request  = _sdoRequest[slot];
+    SdoCallback         callback = request.callback;
+
+    sdoResult_t result;
+    result.nodeId   = _canId;
+    result.index    = request.index;
+    result.subIndex = request.subIndex;
+    result.status   = status;
+    result.value    = value;
+
+    // Release the slot first, so the callback may issue new requests
+    _sdoPendingMask &= ~(1 << slot);
+    _sdoDirtyMask   &= ~(1 << slot);
+
+    if (checkBit(_reconnectSdoMask, slot)) {
+        _reconnectSdoMask &= ~(1 << slot);
+        if (status == SS_TIMEOUT) {
+            // Aborts prove that the keypad is present, only a missing response fails the attempt
+            _scheduleReconnect(millis());
+        }
+    }
+#if PKP_PDO_CONFIG
+    if (checkBit(_pdoSdoMask, slot)) {
+        _pdoSdoMask &= ~(1 << slot);
+        _finishPdoRequest(result, request.command == SDO_CCS_UPLOAD);
+    }
+#endif
+    if (callback != nullptr) {
+        callback(result);
+    }
+}
+
+#if PKP_PDO_CONFIG
+template <typename Model>
+void PkpKeypad<Model>::_finishPdoRequest(const sdoResult_t& result, bool upload) {
+    pdoConfig_t& config = _pdoResult.config;
+
+    if (result.status != SS_SUCCESS) {
+        if (upload && result.index != OD_WIRED_IN_PERIOD && result.subIndex == 0x03) {
+            // The inhibit time is optional, a keypad without it simply has none
+            config.inhibitTime = 0;
+        } else if (_pdoResult.status == SS_SUCCESS) {
+            _pdoResult.status    = result.status;
+            _pdoResult.abortCode = result.status == SS_ABORTED ? result.value : 0;
+        }
+    } else if (upload && result.index == OD_WIRED_IN_PERIOD) {
+        config.eventTimer = result.value * 10;
+    } else if (upload && result.subIndex == 0x02) {
+        config.transmissionType = result.value;
+    } else if (upload && result.subIndex == 0x03) {
+        config.inhibitTime = result.value;
+    } else if (upload && result.subIndex == 0x05) {
+        config.eventTimer = result.value;
+    }
+
+    if (_pdoSdoMask == 0 && _pdoCallback != nullptr) {
+        // Release the request first, so the callback may issue a new one
+        PdoCallback callback = _pdoCallback;
+        _pdoCallback         = nullptr;
+        callback(_pdoResult);
+    }
+}
+#endif
+
+// Blink patterns of all encoders as written to object 0x2002 sub-index 4, 16 bits per encoder
+template <typename Model>
+uint32_t PkpKeypad<Model>::_getEncoderBlinkLeds() {
+    uint32_t blinkLeds = 0;
+    for (uint8_t i = 0; i < ENCODER_AMOUNT; i++) {
+        blinkLeds |= (uint32_t)_currentEncoderBlinkLed[i] << (16 * i);
+    }
+    return blinkLeds;
+}
+
+template <typename Model>
+uint8_t PkpKeypad<Model>::_getKeyField(uint32_t fields, uint8_t keyIndex) {
+    return (fields >> (2 * keyIndex)) & 0b11;
+}
+
+template <typename Model>
+uint8_t PkpKeypad<Model>::_getKeyState(uint8_t keyIndex) {
+    uint16_t keyBit = 1u << keyIndex;
+    for (uint8_t m = 1; m < 4; m++) {
+        if (_keyStateMask[m] & keyBit) {
+            return m;
+        }
+    }
+    return 0;
+}
+
+#if PKP_STATS
+template <typename Model>
+uint8_t PkpKeypad<Model>::_getRxFrameType(uint32_t baseId) {
+    switch (baseId) {
+        case CAN_RX_BASE_ID_KEYS:
+            return RX_KEYS;
+        case CAN_RX_BASE_ID_ENCODER_1:
+        case CAN_RX_BASE_ID_ENCODER_2:
+            return RX_ENCODER;
+        case CAN_RX_BASE_ID_WIRED_IN:
+            return RX_WIRED_IN;
+        case CAN_RX_BASE_ID_HEARTBEAT:
+            return RX_HEARTBEAT;
+        case CAN_RX_BASE_ID_SDO:
+            return RX_SDO;
+        default:
+            return RX_FOREIGN;
+    }
+}
+#endif
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_initializeKeypad() {
+
+    // The keypad may have lost its LED states, so nothing must be suppressed
+    _invalidateLedShadow(LED_CHANNEL_MASK_ALL);
+
+#if PKP_STATS
+    _stats.initializations++;
+#endif
+
+    // Start the keypad and activate heartbeat production
+    returnState_e returnValue = _transmitStartupFrames(SP_START);
     if (returnValue != RS_SUCCESS) {
         return returnValue;
     }
-    for (int i = 0; i < PKP_MAX_ROTARY_ENCODER_AMOUNT; i++) {
-        returnValue = initializeEncoder(i, _encoderTopValue[i], _encoderInitValue[i]);
-        if (returnValue != RS_SUCCESS) {
-            return returnValue;
+
+    _initialized = true;
+
+    return _transmitStartupFrames(SP_CONFIG | SP_LEDS);
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_invalidateLedShadow(uint8_t channelMask) {
+#if PKP_LED_SHADOW
+    for (uint8_t channel = 0; channel < LC_AMOUNT; channel++) {
+        if (checkBit(channelMask, channel)) {
+            _ledShadow[channel].dlc = 0;
         }
     }
-    return _update(UT_ALL);
+#else
+    (void)channelMask;
+#endif
+}
+
+template <typename Model>
+bool PkpKeypad<Model>::_isLedFrameDue(ledChannel_e channel, const struct can_frame& txMsg, uint16_t now) {
+#if !PKP_LED_SHADOW
+    // Without the shadow, every LED frame is sent
+    (void)channel;
+    (void)txMsg;
+    (void)now;
+    return true;
+#else
+    const ledShadow_t& shadow     = _ledShadow[channel];
+    bool               unchanged  = shadow.dlc == txMsg.can_dlc && 0 == memcmp(shadow.data, txMsg.data, txMsg.can_dlc);
+    bool               refreshDue = _ledRefreshInterval > 0 && (uint16_t)(now - shadow.timestamp) >= _ledRefreshInterval;
+    if (!unchanged) {
+        return true;
+    }
+
+    // A refresh is optional traffic, it waits while the budget of the bus load meter is exceeded
+    return refreshDue && (_busLoad == nullptr || !_busLoad->isOverBudget());
+#endif
 }
 
-Pkp::keypadCanStatus_e Pkp::_keypadStatusWatchdog(const keypadStatusUpdate_e action) {
+#if PKP_ENCODER_DYNAMICS
+template <typename Model>
+bool PkpKeypad<Model>::_isEncoderMoving(uint8_t encoderIndex) {
+    if (encoderIndex >= ENCODER_AMOUNT) {
+        return false;
+    }
+    // The 16 bit sample timestamps wrap after about 1 s, the full width time of the newest sample does not
+    return micros() - _encoderSampleTime[encoderIndex] < ENCODER_WINDOW * 16uL;
+}
+#endif
+
+#if PKP_PDO_CONFIG
+template <typename Model>
+bool PkpKeypad<Model>::_isPdoAvailable(tpdo_e pdo) {
+    switch (pdo) {
+        case TPDO_KEYS:
+            return true;
+        case TPDO_ENCODER_1:
+            return ENCODER_AMOUNT >= 1;
+        case TPDO_ENCODER_2:
+            return ENCODER_AMOUNT >= 2;
+        case TPDO_WIRED_IN:
+            return WIRED_IN_AMOUNT >= 1;
+        default:
+            return false;
+    }
+}
+#endif
+
+#if PKP_PDO_CONFIG
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_issuePdoRequests(tpdo_e pdo, const pdoConfig_t* config, PdoCallback callback) {
+    if (!_isPdoAvailable(pdo)) {
+        return RS_INVALID_PDO;
+    }
+    if (!_initialized) {
+        return RS_KEYPAD_NOT_INITIALIZED;
+    }
+
+    bool     wiredIn  = pdo == TPDO_WIRED_IN;
+    uint16_t index    = wiredIn ? OD_WIRED_IN_PERIOD : OD_TPDO_COMMUNICATION + pdo;
+    uint8_t  required = wiredIn ? 1 : 3;
+    if (config != nullptr && !wiredIn && config->inhibitTime == 0) {
+        required = 2;
+    }
+
+    // All requests must be issued at once and none may be coalesced with an outstanding request of the application
+    uint8_t freeSlots = 0;
+    for (uint8_t slot = 0; slot < PKP_SDO_MAX_PENDING; slot++) {
+        if (!checkBit(_sdoPendingMask, slot)) {
+            freeSlots++;
+        } else if (_sdoRequest[slot].index == index) {
+            return RS_SDO_BUSY;
+        }
+    }
+    if (_pdoSdoMask != 0 || freeSlots < required) {
+        return RS_SDO_BUSY;
+    }
+
+    _pdoResult        = {};
+    _pdoResult.nodeId = _canId;
+    _pdoResult.pdo    = pdo;
+    _pdoResult.status = SS_SUCCESS;
+    if (config != nullptr) {
+        _pdoResult.config = *config;
+    } else if (wiredIn) {
+        _pdoResult.config.transmissionType = TT_EVENT_DRIVEN;
+    }
+
+    uint8_t       pendingMask = _sdoPendingMask;
+    returnState_e returnValue = RS_SUCCESS;
+    if (wiredIn && config != nullptr) {
+        returnValue = _writeSdo(index, 0x00, config->eventTimer / 10, 1, nullptr, false);
+    } else if (wiredIn) {
+        returnValue = _readSdo(index, 0x00, nullptr);
+    } else if (config != nullptr) {
+        returnValue = _writeSdo(index, 0x02, config->transmissionType, 1, nullptr, false);
+        if (returnValue == RS_SUCCESS && config->inhibitTime != 0) {
+            returnValue = _writeSdo(index, 0x03, config->inhibitTime, 2, nullptr, false);
+        }
+        if (returnValue == RS_SUCCESS) {
+            returnValue = _writeSdo(index, 0x05, config->eventTimer, 2, nullptr, false);
+        }
+    } else {
+        returnValue = _readSdo(index, 0x02, nullptr);
+        if (returnValue == RS_SUCCESS) {
+            returnValue = _readSdo(index, 0x03, nullptr);
+        }
+        if (returnValue == RS_SUCCESS) {
+            returnValue = _readSdo(index, 0x05, nullptr);
+        }
+    }
+
+    // Requests already sent before a failure complete without being reported
+    if (returnValue == RS_SUCCESS) {
+        _pdoSdoMask  = _sdoPendingMask & ~pendingMask;
+        _pdoCallback = callback;
+    }
+    return returnValue;
+}
+#endif
+
+template <typename Model>
+bool PkpKeypad<Model>::_isStartupReady() {
+    return _initialized && _startupFrame >= STARTUP_FRAME_AMOUNT && _reconnectStage == RC_IDLE && _reconnectSdoMask == 0;
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_pushEvent(eventType_e type, uint8_t index, int16_t value, uint32_t timestamp) {
+#if PKP_EVENTS
+    event_t event;
+    event.timestamp = timestamp;
+    event.type      = type;
+    event.index     = index;
+    event.value     = value;
+
+    if (_eventCallback != nullptr) {
+        _eventCallback(event);
+        return;
+    }
+
+    uint8_t head = _eventHead;
+    if ((uint8_t)(head - __atomic_load_n(&_eventTail, __ATOMIC_ACQUIRE)) >= PKP_EVENT_QUEUE_SIZE) {
+        return;
+    }
+    _events[head & (PKP_EVENT_QUEUE_SIZE - 1)] = event;
+    __atomic_store_n(&_eventHead, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+#else
+    (void)type;
+    (void)index;
+    (void)value;
+    (void)timestamp;
+#endif
+}
+
+template <typename Model>
+PkpBase::keypadCanStatus_e PkpKeypad<Model>::_keypadStatusWatchdog(const keypadStatusUpdate_e action) {
     unsigned long currentMillis = millis();
 
+    _checkSdoTimeouts(currentMillis);
+
     switch (action) {
         case MSG_RECEIVED_VALID:
             _lastCanFrameTimestamp = currentMillis;
             _keypadCanStatus       = KPS_RX_WITHIN_LAST_SECOND;
+
+            // The keypad is talking again, so there is no reason to wait for the next attempt
+            if (_reconnectStage == RC_BACKOFF) {
+                _reconnectStage = RC_PROBE;
+            }
             break;
         case MSG_RECEIVED_NOTHING:
         default:
             if ((currentMillis - _lastCanFrameTimestamp) >= _canNodeWatchdogTime) {
+#if PKP_STATS
+                _stats.watchdogTrips += _keypadCanStatus != KPS_NO_RX_WITHIN_LAST_SECOND;
+#endif
                 _keypadCanStatus = KPS_NO_RX_WITHIN_LAST_SECOND;
 
                 // set all key states back to default key states as a safety feature
-                for (int i = 0; i < PKP_MAX_KEY_AMOUNT; i++) {
-                    _keyState[i] = _defaultKeyState[i];
+                for (uint8_t i = 0; i < KEY_AMOUNT; i++) {
+                    _setKeyState(i, _getKeyField(_defaultKeyStates, i));
                 }
 
-                if (currentMillis - _lastReconnectTry > _canNodeReconnectInterval) {
-
-                    _initializeKeypad();
-                    _lastReconnectTry = currentMillis;
+                _nmtState = NMT_UNKNOWN;
+                if (_reconnectStage == RC_IDLE) {
+                    _reconnectStage  = RC_PROBE;
+                    _reconnectConfig = true;
+                    _reconnectDelay  = 0;
                 }
             }
             break;
     }
+
+    _serviceReconnect(currentMillis);
+    if (_startupParts & SP_DEFERRED) {
+        while (_serviceStartup() == ST_SENT) {
+        }
+    }
+    if (_sdoConfigMask != 0) {
+        _transmitConfigFrames();
+    }
     return _keypadCanStatus;
 }
 
-Pkp::returnState_e Pkp::_transmit(const struct can_frame& txMsg, bool initMsg) {
+#if PKP_ENCODER_DYNAMICS
+template <typename Model>
+int32_t PkpKeypad<Model>::_multiplyFixed(int32_t value, uint32_t factor) {
+    // Saturates instead of overflowing, factor is fixed point with 4 fractional bits
+    int32_t limit = INT32_MAX / (int32_t)factor;
+    if (value > limit || value < -limit) {
+        return value > 0 ? INT32_MAX : -INT32_MAX;
+    }
+    return value * (int32_t)factor / 16;
+}
+#endif
 
-    if (!_initialized && !initMsg) {
+template <typename Model>
+uint32_t PkpKeypad<Model>::_readLittleEndian(const uint8_t*& cursor, uint8_t size) {
+    uint32_t value = 0;
+    for (uint8_t b = 0; b < size; b++) {
+        value |= (uint32_t)*cursor++ << (8 * b);
+    }
+    return value;
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_readSdo(uint16_t index, uint8_t subIndex, SdoCallback callback) {
+    if (!_initialized) {
         return RS_KEYPAD_NOT_INITIALIZED;
     }
 
-    if (_transmitMessage == nullptr) {
-        return RS_NULLPOINTER;
+    uint8_t freeSlot = PKP_SDO_MAX_PENDING;
+    for (uint8_t slot = 0; slot < PKP_SDO_MAX_PENDING; slot++) {
+        sdoRequest_t& request = _sdoRequest[slot];
+        if (!checkBit(_sdoPendingMask, slot)) {
+            freeSlot = min(freeSlot, slot);
+        } else if (request.command == SDO_CCS_UPLOAD && request.index == index && request.subIndex == subIndex) {
+            // The same object is already being read, only an identical request can share the response
+            return request.callback == callback ? RS_SUCCESS : RS_SDO_BUSY;
+        }
     }
+    if (freeSlot == PKP_SDO_MAX_PENDING) {
+        return RS_SDO_BUSY;
+    }
+
+    sdoRequest_t& request = _sdoRequest[freeSlot];
+    request.index         = index;
+    request.subIndex      = subIndex;
+    request.command       = SDO_CCS_UPLOAD;
+    request.retries       = SDO_RETRIES;
+    request.callback      = callback;
+    memset(request.data, 0, sizeof(request.data));
+    _sdoPendingMask |= 1 << freeSlot;
 
-    if (0 != _transmitMessage(txMsg)) {
-        return RS_CAN_TX_ERROR;
+    returnState_e returnValue = _sendSdo(freeSlot);
+    if (returnValue != RS_SUCCESS) {
+        _sdoPendingMask &= ~(1 << freeSlot);
     }
-    return RS_SUCCESS;
+    return returnValue;
 }
 
-Pkp::returnState_e Pkp::_writeEncoderLeds() {
-    bool writeBlinking = false;
+#if PKP_STATS
+template <typename Model>
+void PkpKeypad<Model>::_recordTiming(timing_t& timing, uint32_t start) {
+    uint32_t us  = micros() - start;
+    uint8_t  bin = 0;
+    for (uint32_t v = us >> 1; v != 0 && bin < TIMING_BINS - 1; v >>= 1) {
+        bin++;
+    }
+    timing.min = (timing.count == 0 || us < timing.min) ? us : timing.min;
+    timing.max = max(timing.max, us);
+    timing.count++;
+    timing.histogram[bin]++;
+}
+#endif
 
-    for (int i = 0; i < PKP_MAX_ROTARY_ENCODER_AMOUNT; i++) {
-        if (_currentEncoderBlinkLed[i] > 0) {
-            writeBlinking         = true;
-            _currentEncoderLed[i] = 0;
+#if PKP_ENCODER_DYNAMICS
+template <typename Model>
+int16_t PkpKeypad<Model>::_scaleEncoderTicks(uint8_t encoderIndex, int16_t ticks) {
+    if (encoderIndex >= ENCODER_AMOUNT) {
+        return ticks;
+    }
+    const encoderCurve_t& curve    = _encoderCurve[encoderIndex];
+    int32_t               velocity = _encoderVelocity[encoderIndex];
+    int32_t               factor   = ENCODER_FIXED_ONE;
+    uint32_t              speed    = (uint32_t)(velocity < 0 ? -velocity : velocity) / ENCODER_FIXED_ONE;
+    if (curve.maxFactor > 1 && speed > curve.threshold) {
+        uint32_t span   = curve.fullSpeed - curve.threshold;
+        uint32_t excess = min(speed - curve.threshold, span);
+        factor          += (uint32_t)(curve.maxFactor - 1) * ENCODER_FIXED_ONE * excess / span;
+    }
+
+    // A remainder of the opposite direction is dropped, so reversing always moves at least one step
+    int16_t& remainder = _encoderRemainder[encoderIndex];
+    if ((ticks < 0) != (remainder < 0)) {
+        remainder = 0;
+    }
+    int32_t total  = ticks * factor + remainder;
+    int16_t scaled = total / ENCODER_FIXED_ONE;
+    remainder      = total - scaled * ENCODER_FIXED_ONE;
+    return scaled;
+}
+#endif
+
+template <typename Model>
+uint8_t PkpKeypad<Model>::_scaleWiredInput(uint16_t value) {
+    // 131 / 256 approximates 255 / 500 without a division, 500 maps to 255
+    return (uint16_t)(value * 131u) >> 8;
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_scheduleReconnect(uint32_t now) {
+    _reconnectStage     = RC_BACKOFF;
+    _reconnectSdoMask   = 0;
+    _reconnectTimestamp = now;
+    _reconnectDelay     = constrain(_reconnectDelay * 2, RECONNECT_DELAY_MIN, RECONNECT_DELAY_MAX);
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_sendSdo(uint8_t slot, bool initMsg) {
+    sdoRequest_t& request = _sdoRequest[slot];
+
+    struct can_frame txMsg;
+    txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
+    txMsg.can_dlc = (request.command == SDO_CCS_UPLOAD) ? 8 : 8 - ((request.command >> 2) & 0x03);
+    txMsg.data[0] = request.command;
+    txMsg.data[1] = request.index & 0xFF;
+    txMsg.data[2] = request.index >> 8;
+    txMsg.data[3] = request.subIndex;
+    memcpy(&txMsg.data[4], request.data, sizeof(request.data));
+
+    // A failed transmission is repeated like a lost response after the timeout
+    request.timestamp = millis();
+    _sdoDirtyMask     &= ~(1 << slot);
+    return _transmit(txMsg, initMsg);
+}
+
+#if PKP_ANIMATOR
+template <typename Model>
+void PkpKeypad<Model>::_serviceAnimator(uint32_t now) {
+    // Frames of a reconnect must not be interleaved, its last stage sends the LED state including the image.
+    // Animations pause while the budget of the bus load meter is exceeded.
+    if (!_initialized || _reconnectStage != RC_IDLE || (_busLoad != nullptr && _busLoad->isOverBudget()) || !_animator->render(now)) {
+        return;
+    }
+
+    // Channels are checked round robin, starting after the one sent last, so no channel starves within the budget
+    uint8_t budget = _animator->getFramesPerTick();
+    uint8_t first  = _animatorChannel;
+    for (uint8_t i = 0; i < ANIMATOR_CHANNELS && budget > 0; i++) {
+        uint8_t          channel = (first + i) % ANIMATOR_CHANNELS;
+        struct can_frame txMsg;
+        switch (channel) {
+            case LC_KEY_COLOR:
+            case LC_KEY_BLINK:
+                _composeKeyLeds(channel == LC_KEY_BLINK, txMsg);
+                break;
+            case LC_ENCODER:
+                // An encoder blink pattern is replaced by any encoder LED frame
+                if (ENCODER_AMOUNT == 0 || _getEncoderBlinkLeds() != 0) {
+                    continue;
+                }
+                _composeEncoderLeds(txMsg);
+                break;
+            case LC_BACKLIGHT:
+                _composeBacklight(txMsg);
+                break;
+            default: {
+                int8_t  brightness = _animator->getImage().keyBrightness;
+                uint8_t raw        = 0x3F * (brightness >= 0 ? brightness : _keyBrightness) / 100;
+                if (raw == _keyBrightnessSent) {
+                    continue;
+                }
+                if (writeSdo(0x2003, 0x01, raw, 1) == RS_SUCCESS) {
+                    _keyBrightnessSent = raw;
+                }
+                budget--;
+                _animatorChannel = (channel + 1) % ANIMATOR_CHANNELS;
+                continue;
+            }
+        }
+
+        if (!_isLedFrameDue((ledChannel_e)channel, txMsg, now)) {
+            continue;
+        }
+        _transmitLed((ledChannel_e)channel, txMsg);
+        budget--;
+        _animatorChannel = (channel + 1) % ANIMATOR_CHANNELS;
+    }
+}
+#endif
+
+template <typename Model>
+void PkpKeypad<Model>::_serviceReconnect(uint32_t now) {
+    // One stage per call, each stage waits for the confirmation of its SDO requests
+    if (_reconnectStage == RC_IDLE || _reconnectSdoMask != 0) {
+        return;
+    }
+    if (_reconnectStage == RC_BACKOFF) {
+        if (now - _reconnectTimestamp < _reconnectDelay) {
+            return;
+        }
+        _reconnectStage = RC_PROBE;
+    }
+
+    uint8_t       pendingMask = _sdoPendingMask;
+    returnState_e returnValue = RS_SUCCESS;
+    switch (_reconnectStage) {
+        case RC_PROBE:
+            returnValue = _writeSdo(0x1017, 0x00, _canNodeHeartbeatInterval, 2, nullptr, true);
+            break;
+        case RC_START:
+            returnValue = _transmitNmtStart(true);
+            if (returnValue == RS_SUCCESS) {
+                _initialized = true;
+            }
+            break;
+        case RC_CONFIG:
+            // The keypad may have lost its LED states, so nothing must be suppressed
+            _invalidateLedShadow(LED_CHANNEL_MASK_ALL);
+            returnValue = _transmitStartupFrames(_reconnectConfig ? SP_CONFIG | SP_LEDS : SP_LEDS);
+#if PKP_STATS
+            _stats.reconfigurations++;
+#endif
+            break;
+        default:
+            break;
+    }
+
+    if (returnValue != RS_SUCCESS) {
+        _scheduleReconnect(now);
+        return;
+    }
+
+    // Only requests issued by this stage are awaited, a write coalesced into an older request is not
+    _reconnectSdoMask = _sdoPendingMask & ~pendingMask;
+    for (uint8_t slot = 0; slot < PKP_SDO_MAX_PENDING && _reconnectStage == RC_PROBE; slot++) {
+        // Except for the probe, only a confirmation proves that the keypad is present
+        if (checkBit(_sdoPendingMask, slot) && _sdoRequest[slot].index == 0x1017) {
+            _reconnectSdoMask |= 1 << slot;
         }
     }
+    if (_reconnectStage == RC_CONFIG) {
+        // Done, a timeout of the configuration requests still restarts the reconnect
+        _reconnectStage = RC_IDLE;
+        return;
+    }
+    _reconnectStage = (reconnectStage_e)(_reconnectStage + 1);
+}
+
+template <typename Model>
+PkpBase::startupStep_e PkpKeypad<Model>::_serviceStartup() {
+    if (_reconnectStage != RC_IDLE) {
+        // A reconnect configures the keypad from scratch
+        _startupFrame = STARTUP_FRAME_AMOUNT;
+    }
 
     struct can_frame txMsg;
+    for (; _startupFrame < STARTUP_FRAME_AMOUNT; _startupFrame++) {
+        if (!_composeStartupFrame(_startupFrame, _startupParts, txMsg)) {
+            continue;
+        }
 
-    if (writeBlinking) {
-        txMsg.can_id  = CAN_TX_BASE_ID_SDO + _canId;
-        txMsg.can_dlc = 8;
-        txMsg.data[0] = 0x23;
-        txMsg.data[1] = 0x02;
-        txMsg.data[2] = 0x20;
-        txMsg.data[3] = 0x04;
-        txMsg.data[4] = _currentEncoderBlinkLed[0] & 0xFF;
-        txMsg.data[5] = _currentEncoderBlinkLed[0] >> 8;
-        txMsg.data[6] = _currentEncoderBlinkLed[1] & 0xFF;
-        txMsg.data[7] = _currentEncoderBlinkLed[1] >> 8;
+        uint8_t       pendingMask = _sdoPendingMask;
+        returnState_e returnValue = _transmitStartupFrame(txMsg);
+        if (returnValue == RS_SDO_BUSY) {
+            return ST_WAITING;
+        }
+
+        // The startup requests are awaited like those of a reconnect, a timeout starts one
+        _reconnectSdoMask |= _sdoPendingMask & ~pendingMask;
+        _startupFrame++;
+        if (returnValue != RS_SUCCESS) {
+            _startupFrame = STARTUP_FRAME_AMOUNT;
+            _scheduleReconnect(millis());
+        }
+        return ST_SENT;
+    }
+    _startupParts = 0;
+    return ST_DONE;
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_setKeyField(uint32_t& fields, uint8_t keyIndex, uint8_t value) {
+    fields &= ~(0b11uL << (2 * keyIndex));
+    fields |= (uint32_t)(value & 0b11) << (2 * keyIndex);
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_setKeyState(uint8_t keyIndex, uint8_t keyState) {
+    uint16_t keyBit = 1u << keyIndex;
+    for (uint8_t m = 0; m < 4; m++) {
+        _keyStateMask[m] &= ~keyBit;
+    }
+    _keyStateMask[keyState & 0b11] |= keyBit;
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_transmit(const struct can_frame& txMsg, bool initMsg) {
+
+    if (!_initialized && !initMsg) {
+        return RS_KEYPAD_NOT_INITIALIZED;
+    }
+
+    if (_txQueue != nullptr) {
+        if (!_txQueue->push(txMsg)) {
+#if PKP_STATS
+            _stats.txErrors++;
+#endif
+            return RS_TX_QUEUE_FULL;
+        }
     } else {
-        txMsg.can_id  = CAN_TX_BASE_ID_ENCODER_LED + _canId;
-        txMsg.can_dlc = 4;
-        txMsg.data[0] = _currentEncoderLed[0] & 0xFF;
-        txMsg.data[1] = _currentEncoderLed[0] >> 8;
-        txMsg.data[2] = _currentEncoderLed[1] & 0xFF;
-        txMsg.data[3] = _currentEncoderLed[1] >> 8;
+        if (_transmitMessage == nullptr) {
+            return RS_NULLPOINTER;
+        }
+
+        if (0 != _transmitMessage(txMsg)) {
+#if PKP_STATS
+            _stats.txErrors++;
+#endif
+            return RS_CAN_TX_ERROR;
+        }
+    }
+#if PKP_STATS
+    _stats.txFrames++;
+#endif
+
+    if (_recorder != nullptr) {
+        _recorder->record(txMsg, true);
+    }
+    // Queued frames are accounted by the meter of the queue once sent, a replaced payload never reaches the bus
+    if (_busLoad != nullptr && _txQueue == nullptr) {
+        _busLoad->add(txMsg);
     }
+    return RS_SUCCESS;
+}
 
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_transmitLed(ledChannel_e channel, const struct can_frame& txMsg) {
+#if PKP_LED_SHADOW
+    ledShadow_t& shadow = _ledShadow[channel];
+    uint16_t     now    = millis();
+
+    if (!_isLedFrameDue(channel, txMsg, now)) {
+#if PKP_STATS
+        _stats.ledSuppressed++;
+#endif
+        return RS_SUCCESS;
+    }
+
+    returnState_e returnValue = _transmit(txMsg);
+    if (returnValue != RS_SUCCESS || txMsg.can_dlc > sizeof(shadow.data)) {
+        shadow.dlc = 0;
+        return returnValue;
+    }
+
+    shadow.dlc       = txMsg.can_dlc;
+    shadow.timestamp = now;
+    memcpy(shadow.data, txMsg.data, txMsg.can_dlc);
+    return RS_SUCCESS;
+#else
+    (void)channel;
     return _transmit(txMsg);
+#endif
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_transmitNmtStart(bool initMsg) {
+    struct can_frame txMsg;
+    _composeNmtStart(txMsg);
+    return _transmit(txMsg, initMsg);
 }
 
-Pkp::returnState_e Pkp::_writeKeyLeds(bool mode) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_transmitStartupFrame(const struct can_frame& txMsg) {
+    switch (txMsg.can_id == 0 ? 0 : txMsg.can_id - _canId) {
+        case CAN_TX_BASE_ID_SDO: {
+            // Issued through the SDO client, so the confirmations are tracked
+            uint16_t      index       = txMsg.data[1] | (txMsg.data[2] << 8);
+            uint32_t      value       = txMsg.data[4] | ((uint32_t)txMsg.data[5] << 8) | ((uint32_t)txMsg.data[6] << 16) | ((uint32_t)txMsg.data[7] << 24);
+            returnState_e returnValue = _writeSdo(index, txMsg.data[3], value, txMsg.can_dlc - 4, nullptr, true);
+#if PKP_ANIMATOR
+            if (returnValue == RS_SUCCESS && index == 0x2003) {
+                _keyBrightnessSent = value;
+            }
+#endif
+            return returnValue;
+        }
+        case CAN_TX_BASE_ID_KEY_BACKLIGHT:
+            return _transmitLed(LC_BACKLIGHT, txMsg);
+        case CAN_TX_BASE_ID_KEY_COLOR:
+            return _transmitLed(LC_KEY_COLOR, txMsg);
+        case CAN_TX_BASE_ID_KEY_BLINK:
+            return _transmitLed(LC_KEY_BLINK, txMsg);
+        case CAN_TX_BASE_ID_ENCODER_LED:
+            return _transmitLed(LC_ENCODER, txMsg);
+        default:
+            return _transmit(txMsg, true);
+    }
+}
 
-    mode = constrain(mode, CM_SOLID, CM_BLINK);
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_transmitConfigFrames() {
+    if (!_initialized) {
+        return RS_KEYPAD_NOT_INITIALIZED;
+    }
+
+    returnState_e returnValue = RS_SUCCESS;
+    for (uint8_t i = 0; i < 1 + 2 * ENCODER_AMOUNT && returnValue == RS_SUCCESS; i++) {
+        struct can_frame txMsg;
+        if (!checkBit(_sdoConfigMask, i) || !_composeStartupFrame(2 + i, SP_CONFIG, txMsg)) {
+            continue;
+        }
+        returnValue = _transmitStartupFrame(txMsg);
+        if (returnValue == RS_SDO_BUSY) {
+            // Stays pending, the watchdog retries as confirmations free request slots
+            return RS_SUCCESS;
+        }
+        _sdoConfigMask &= ~(1 << i);
+    }
+    return returnValue;
+}
 
-    // Initialize can frame
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_transmitStartupFrames(uint8_t parts) {
+    returnState_e    returnValue = RS_SUCCESS;
     struct can_frame txMsg;
-    txMsg.can_id  = mode ? CAN_TX_BASE_ID_KEY_BLINK : CAN_TX_BASE_ID_KEY_COLOR;
-    txMsg.can_id  += _canId;
-    txMsg.can_dlc = 6;
 
-    bool pColArray[PKP_MAX_KEY_AMOUNT][3] = {0};
+    if (parts & SP_CONFIG) {
+        // The complete configuration supersedes single postponed writes
+        _sdoConfigMask = 0;
+    }
 
-    // setting up current colors array
-    for (int m = 0; m < 4; m++) {
-        for (int k = 0; k < PKP_MAX_KEY_AMOUNT; k++) {
-            if (_keyState[k] == m) {
-                if (mode == CM_SOLID || (_keyColor[m][k] != 0 && _keyBlinkColor[m][k] != 0)) {
-                    pColArray[k][0] = (_keyColor[m][k] >> 2) & 0b1; // RED bit solid
-                    pColArray[k][1] = (_keyColor[m][k] >> 1) & 0b1; // GREEN bit solid
-                    pColArray[k][2] = (_keyColor[m][k]) & 0b1;      // BLUE bit solid
-                    if (mode == CM_SOLID) {
-                        continue;
-                    }
-                }
-                pColArray[k][0] |= (_keyBlinkColor[m][k] >> 2) & 0b1; // RED bit blinking
-                pColArray[k][1] |= (_keyBlinkColor[m][k] >> 1) & 0b1; // GREEN bit blinking
-                pColArray[k][2] |= (_keyBlinkColor[m][k]) & 0b1;      // BLUE bit blinking
-            }
+    if (_startupParts & SP_DEFERRED) {
+        // Frames are still waiting for request slots, the sequence starts over with the new parts included (writes to
+        // objects with an outstanding request are coalesced)
+        _startupParts |= parts;
+        _startupFrame  = 0;
+        return RS_SUCCESS;
+    }
+
+    for (uint8_t i = 0; i < STARTUP_FRAME_AMOUNT && returnValue == RS_SUCCESS; i++) {
+        if (_composeStartupFrame(i, parts, txMsg)) {
+            returnValue = _transmitStartupFrame(txMsg);
+        }
+        if (returnValue == RS_SDO_BUSY) {
+            // The remaining frames follow from _keypadStatusWatchdog() as confirmations free request slots
+            _startupFrame = i;
+            _startupParts = parts | SP_DEFERRED;
+            return RS_SUCCESS;
         }
     }
+    return returnValue;
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_writeEncoderLeds() {
+    bool writeBlinking = false;
 
-    // Reorganizing colors array into proper byte format for the keypad can message
-    // BYTE 0 (R8 R7 R6 R5 - R4 R3 R2 R1)
-    for (int i = 0; i < PKP_MAX_KEY_AMOUNT; i++) {
-        uint8_t redByte       = 0 + (i > 7);
-        uint8_t greenByte     = 2 + (i > 7);
-        uint8_t blueByte      = 4 + (i > 7);
-        uint8_t bitIdx        = i % 8;
-        txMsg.data[redByte]   |= pColArray[i][0] << bitIdx;
-        txMsg.data[greenByte] |= pColArray[i][1] << bitIdx;
-        txMsg.data[blueByte]  |= pColArray[i][2] << bitIdx;
+    for (int i = 0; i < ENCODER_AMOUNT; i++) {
+        if (_currentEncoderBlinkLed[i] > 0) {
+            writeBlinking         = true;
+            _currentEncoderLed[i] = 0;
+        }
     }
 
-    return _transmit(txMsg);
+    if (writeBlinking) {
+        // The blink setting replaces the solid encoder LEDs, which have to be sent again afterwards
+        _invalidateLedShadow(1 << LC_ENCODER);
+        return writeSdo(0x2002, 0x04, _getEncoderBlinkLeds(), 4);
+    }
+
+    struct can_frame txMsg;
+    _composeEncoderLeds(txMsg);
+    return _transmitLed(LC_ENCODER, txMsg);
 }
 
-Pkp::returnState_e Pkp::_update(updateType_e updateType) {
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_writeKeyLeds(bool mode) {
+    mode = constrain(mode, CM_SOLID, CM_BLINK);
+
+    struct can_frame txMsg;
+    _composeKeyLeds(mode, txMsg);
+    return _transmitLed(mode ? LC_KEY_BLINK : LC_KEY_COLOR, txMsg);
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_update(updateType_e updateType) {
+#if PKP_STATS
+    uint32_t start = micros();
+#endif
     returnState_e returnValue = RS_SUCCESS;
 
     if (updateType & UT_KEY_LEDS) {
@@ -669,9 +2473,130 @@ Pkp::returnState_e Pkp::_update(updateType_e updateType) {
         returnValue = max(returnValue, _writeKeyLeds(CM_BLINK));
     }
 
-    if (updateType & UT_ENCODER_LEDS) {
+    if ((updateType & UT_ENCODER_LEDS) && ENCODER_AMOUNT > 0) {
         returnValue = max(returnValue, _writeEncoderLeds());
     }
 
+#if PKP_STATS
+    _recordTiming(_stats.updateTime, start);
+#endif
+    return returnValue;
+}
+
+template <typename Model>
+void PkpKeypad<Model>::_writeLittleEndian(uint8_t*& cursor, uint32_t value, uint8_t size) {
+    for (uint8_t b = 0; b < size; b++) {
+        *cursor++ = value >> (8 * b);
+    }
+}
+
+template <typename Model>
+PkpBase::returnState_e PkpKeypad<Model>::_writeSdo(uint16_t index, uint8_t subIndex, uint32_t value, uint8_t size, SdoCallback callback, bool initMsg) {
+    if (!inLimits(size, 1, 4)) {
+        return RS_INVALID_SDO_SIZE;
+    }
+    if (!_initialized && !initMsg) {
+        return RS_KEYPAD_NOT_INITIALIZED;
+    }
+
+    uint8_t command = 0x23 | ((4 - size) << 2);
+    uint8_t data[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+
+    uint8_t freeSlot = PKP_SDO_MAX_PENDING;
+    for (uint8_t slot = 0; slot < PKP_SDO_MAX_PENDING; slot++) {
+        sdoRequest_t& request = _sdoRequest[slot];
+        if (!checkBit(_sdoPendingMask, slot)) {
+            freeSlot = min(freeSlot, slot);
+        } else if (request.command != SDO_CCS_UPLOAD && request.index == index && request.subIndex == subIndex) {
+            // Coalesce with the outstanding write, the new value is sent after its confirmation
+            if (request.command != command || 0 != memcmp(request.data, data, sizeof(data))) {
+                request.command = command;
+                memcpy(request.data, data, sizeof(data));
+                _sdoDirtyMask |= 1 << slot;
+            }
+            request.callback = callback;
+            return RS_SUCCESS;
+        }
+    }
+    if (freeSlot == PKP_SDO_MAX_PENDING) {
+        return RS_SDO_BUSY;
+    }
+
+    sdoRequest_t& request = _sdoRequest[freeSlot];
+    request.index         = index;
+    request.subIndex      = subIndex;
+    request.command       = command;
+    request.retries       = SDO_RETRIES;
+    request.callback      = callback;
+    memcpy(request.data, data, sizeof(data));
+    _sdoPendingMask |= 1 << freeSlot;
+
+    returnState_e returnValue = _sendSdo(freeSlot, initMsg);
+    if (returnValue != RS_SUCCESS) {
+        _sdoPendingMask &= ~(1 << freeSlot);
+    }
     return returnValue;
 }
+
+#if PKP_ENCODER_DYNAMICS
+template <typename Model>
+void PkpKeypad<Model>::_updateEncoderEstimate(uint8_t encoderIndex, uint32_t now) {
+    if (encoderIndex >= ENCODER_AMOUNT) {
+        return;
+    }
+    encoderSample_t* samples   = _encoderSamples[encoderIndex];
+    uint8_t          head      = _encoderSampleHead[encoderIndex];
+    uint16_t         timestamp = now >> 4;
+    int16_t          count     = _encoderCount[encoderIndex];
+
+    // After a full window without ticks, the timestamps may have wrapped. The samples are replaced by the count at the
+    // window start, so consecutive samples are always less than a window apart and no sample walked below can wrap.
+    if (now - _encoderSampleTime[encoderIndex] >= ENCODER_WINDOW * 16uL) {
+        int16_t restCount = samples[head].count;
+        for (uint8_t i = 0; i < PKP_ENCODER_SAMPLES; i++) {
+            samples[i].timestamp = timestamp - ENCODER_WINDOW;
+            samples[i].count     = restCount;
+        }
+    }
+    _encoderSampleTime[encoderIndex] = now;
+
+    // Ticks since the oldest sample within the velocity window. A sample outside the window holds the count at the
+    // window start, as no ticks were received in between.
+    uint16_t elapsed = 0;
+    int16_t  ticks   = 0;
+    for (uint8_t age = 0; age < PKP_ENCODER_SAMPLES; age++) {
+        const encoderSample_t& sample    = samples[(head - age) & (PKP_ENCODER_SAMPLES - 1)];
+        uint16_t               sampleAge = timestamp - sample.timestamp;
+        ticks                            = count - sample.count;
+        if (sampleAge >= ENCODER_WINDOW) {
+            elapsed = ENCODER_WINDOW;
+            break;
+        }
+        elapsed = sampleAge;
+    }
+
+    uint16_t lastElapsed = timestamp - samples[head].timestamp;
+    if (lastElapsed >= ENCODER_WINDOW) {
+        _encoderVelocity[encoderIndex] = 0; // at rest before this sample
+    }
+
+    // 2^8 * 10^6 / 16: ticks per timestamp unit to ticks per second with 8 fractional bits
+    int32_t velocity                   = ticks * (int32_t)(16000000uL / max(elapsed, ENCODER_MIN_ELAPSED));
+    uint16_t accelerationTime          = constrain(lastElapsed, ENCODER_MIN_ELAPSED, ENCODER_WINDOW);
+    _encoderAcceleration[encoderIndex] = _multiplyFixed(velocity - _encoderVelocity[encoderIndex], 1000000uL / accelerationTime);
+    _encoderVelocity[encoderIndex]     = velocity;
+
+    head                             = (head + 1) & (PKP_ENCODER_SAMPLES - 1);
+    samples[head].timestamp          = timestamp;
+    samples[head].count              = count;
+    _encoderSampleHead[encoderIndex] = head;
+}
+#endif
+
+//********** TEMPLATE INSTANTIATIONS **********
+template class PkpKeypad<Pkp2200Si>;
+template class PkpKeypad<Pkp2300Si>;
+template class PkpKeypad<Pkp2400Si>;
+template class PkpKeypad<Pkp2500Si>;
+template class PkpKeypad<Pkp2600Si>;
+template class PkpKeypad<Pkp3500SiMt>;
@@ -15,6 +15,8 @@
 
 #include <Arduino.h>
 
+#include "PkpModels.h"
+
 //Inline functions as alternative to pre-processor macros
 inline bool inLimits(int32_t value, int32_t low, int32_t high) {
     return value >= low && value <= high;
@@ -24,10 +26,70 @@ inline bool checkBit(int32_t value, uint8_t pos) {
     return (value & (1 << pos)) != 0;
 }
 
+// Maximum over all models in PkpModels.h
 constexpr size_t PKP_MAX_KEY_AMOUNT            = 15;
 constexpr size_t PKP_MAX_WIRED_IN_AMOUNT       = 4;
 constexpr size_t PKP_MAX_ROTARY_ENCODER_AMOUNT = 2;
 
+#ifndef PKP_EVENT_QUEUE_SIZE
+#define PKP_EVENT_QUEUE_SIZE 8
+#endif
+
+// Every request slot holds a callback pointer, so only two are reserved by default. Startup frames that find no free
+// slot are sent as soon as confirmations free one.
+#ifndef PKP_SDO_MAX_PENDING
+#define PKP_SDO_MAX_PENDING 2
+#endif
+
+#ifndef PKP_ENCODER_SAMPLES
+#define PKP_ENCODER_SAMPLES 4
+#endif
+
+#ifndef PKP_WIRED_IN_AVERAGE_SIZE
+#define PKP_WIRED_IN_AVERAGE_SIZE 4
+#endif
+
+// 1 enables the runtime counters and timings of getStats(), at the cost of sizeof(stats_t) per keypad and two
+// micros() calls per received frame and LED update
+#ifndef PKP_STATS
+#define PKP_STATS 0
+#endif
+
+// Optional features, set to 1 in the build flags to compile them in (e.g. -DPKP_EVENTS=1). Without them, a keypad
+// only holds the state of the basic API, see extras/tests/PkpSizeTest.cpp.
+#ifndef PKP_ANIMATOR
+#define PKP_ANIMATOR 0 // attachAnimator(), requires PKP_LED_SHADOW
+#endif
+
+#ifndef PKP_ENCODER_DYNAMICS
+#define PKP_ENCODER_DYNAMICS 0 // encoder velocity, acceleration and acceleration curve
+#endif
+
+#ifndef PKP_EVENTS
+#define PKP_EVENTS 0 // input event queue, nextEvent() and setEventCallback()
+#endif
+
+#ifndef PKP_LED_SHADOW
+#define PKP_LED_SHADOW 0 // suppression of LED frames the keypad already shows, setLedRefreshInterval()
+#endif
+
+#ifndef PKP_PDO_CONFIG
+#define PKP_PDO_CONFIG 0 // readPdoConfig() and writePdoConfig(), requires PKP_SDO_MAX_PENDING of at least 3
+#endif
+
+#ifndef PKP_WIRED_IN_FILTER
+#define PKP_WIRED_IN_FILTER 0 // setWiredInputFilter()
+#endif
+
+static_assert(PKP_SDO_MAX_PENDING >= 1 && PKP_SDO_MAX_PENDING <= 8, "PKP_SDO_MAX_PENDING must be between 1 and 8");
+static_assert(!PKP_ANIMATOR || PKP_LED_SHADOW, "PKP_ANIMATOR diffs its frames against the LED shadow, set PKP_LED_SHADOW");
+static_assert(!PKP_PDO_CONFIG || PKP_SDO_MAX_PENDING >= 3, "PKP_PDO_CONFIG issues up to three requests at once");
+static_assert((PKP_EVENT_QUEUE_SIZE & (PKP_EVENT_QUEUE_SIZE - 1)) == 0 && PKP_EVENT_QUEUE_SIZE <= 128, "PKP_EVENT_QUEUE_SIZE must be a power of two up to 128");
+static_assert((PKP_ENCODER_SAMPLES & (PKP_ENCODER_SAMPLES - 1)) == 0 && PKP_ENCODER_SAMPLES >= 2 && PKP_ENCODER_SAMPLES <= 16,
+              "PKP_ENCODER_SAMPLES must be a power of two from 2 to 16");
+static_assert((PKP_WIRED_IN_AVERAGE_SIZE & (PKP_WIRED_IN_AVERAGE_SIZE - 1)) == 0 && PKP_WIRED_IN_AVERAGE_SIZE >= 2 && PKP_WIRED_IN_AVERAGE_SIZE <= 16,
+              "PKP_WIRED_IN_AVERAGE_SIZE must be a power of two from 2 to 16");
+
 struct can_frame {
     uint32_t can_id;                              // Identifier for CAN frame
     uint8_t  can_dlc;                             // Data length code
@@ -41,8 +103,28 @@ struct can_frame {
 //Definition for message transmitting callback function(pointer)
 typedef uint8_t (*CanMsgTxCallback)(const can_frame& txMsg);
 
+class PkpBus;
+class PkpAnimator;
+class PkpBusLoad;
+class PkpRecorder;
+class PkpRxRing;
+class PkpTxQueue;
+
+// Unsigned type with one bit per key for the given number of key LED bytes
+template <uint8_t Bytes>
+struct PkpKeyMask {
+    typedef uint16_t type;
+};
+
+template <>
+struct PkpKeyMask<1> {
+    typedef uint8_t type;
+};
+
 //Class definitions
-class Pkp {
+class PkpBase {
+    friend class PkpBus;
+
   public:
     // ------ Public Type Definitions ------
     enum keypadCanStatus_e : int8_t {
@@ -51,6 +133,14 @@ class Pkp {
         KPS_NO_RX_WITHIN_LAST_SECOND = 1
     };
 
+    enum nmtState_e : uint8_t {
+        NMT_BOOT_UP         = 0x00,
+        NMT_STOPPED         = 0x04,
+        NMT_OPERATIONAL     = 0x05,
+        NMT_PRE_OPERATIONAL = 0x7F,
+        NMT_UNKNOWN         = 0xFF // no heartbeat received since the last communication loss
+    };
+
     enum keyMode_e : uint8_t {
         KEY_MODE_MOMENTARY = 0,
         KEY_MODE_TOGGLE    = 1,
@@ -114,7 +204,16 @@ class Pkp {
         RS_INVALID_KEY_MODE,
         RS_INVALID_COLOR,
         RS_CAN_TX_ERROR,
-        RS_NULLPOINTER
+        RS_NULLPOINTER,
+        RS_INVALID_NODE_ID,
+        RS_NODE_TABLE_FULL,
+        RS_TX_QUEUE_FULL,
+        RS_INVALID_INPUT_INDEX,
+        RS_SDO_BUSY,
+        RS_INVALID_SDO_SIZE,
+        RS_INVALID_PDO,
+        RS_INVALID_PDO_CONFIG,
+        RS_INVALID_PROFILE
     };
 
     enum updateType_e {
@@ -123,25 +222,234 @@ class Pkp {
         UT_ALL          = UT_KEY_LEDS | UT_ENCODER_LEDS
     };
 
+    enum eventType_e : uint8_t {
+        EV_KEY_DOWN         = 0, // index: key
+        EV_KEY_UP           = 1, // index: key
+        EV_KEY_STATE        = 2, // index: key, value: new key state
+        EV_ENCODER          = 3, // index: encoder, value: signed ticks, scaled by the acceleration curve
+        EV_WIRED_INPUT_HIGH = 4, // index: wired input, value: filtered raw value, input rose to its threshold
+        EV_WIRED_INPUT_LOW  = 5  // index: wired input, value: filtered raw value, input fell below threshold - hysteresis
+    };
+
+    enum wiredInputFilter_e : uint8_t {
+        WF_NONE    = 0,
+        WF_IIR     = 1, // exponential moving average, new = old + (raw - old) / 2^order
+        WF_AVERAGE = 2  // moving average over the last 2^order values
+    };
+
+    struct event_t {
+        uint32_t    timestamp; // micros() when the frame causing the event was decoded
+        eventType_e type;
+        uint8_t     index;
+        int16_t     value;
+    };
+
+    typedef void (*EventCallback)(const event_t& event);
+
+    enum sdoStatus_e : uint8_t {
+        SS_SUCCESS = 0,
+        SS_ABORTED = 1, // rejected by the keypad, value holds the abort code
+        SS_TIMEOUT = 2  // no response after all retries
+    };
+
+    struct sdoResult_t {
+        uint8_t     nodeId;
+        uint16_t    index;
+        uint8_t     subIndex;
+        sdoStatus_e status;
+        uint32_t    value; // uploaded value or abort code
+    };
+
+    typedef void (*SdoCallback)(const sdoResult_t& result);
+
+    enum tpdo_e : uint8_t {
+        TPDO_KEYS      = 0,
+        TPDO_ENCODER_1 = 1,
+        TPDO_ENCODER_2 = 2,
+        TPDO_WIRED_IN  = 3
+    };
+
+    enum transmissionType_e : uint8_t {
+        TT_SYNC         = 0x01, // TT_SYNC to TT_SYNC_MAX: sent with every n-th SYNC
+        TT_SYNC_MAX     = 0xF0,
+        TT_EVENT_DRIVEN = 0xFE  // sent on change and, if the event timer is set, periodically
+    };
+
+    struct pdoConfig_t {
+        uint8_t  transmissionType; // transmissionType_e
+        uint16_t inhibitTime;      // minimum time between two PDOs in 100 us, 0 for none
+        uint16_t eventTimer;       // periodic transmission in ms, 0 disables it
+    };
+
+    struct pdoResult_t {
+        uint8_t     nodeId;
+        tpdo_e      pdo;
+        sdoStatus_e status;
+        uint32_t    abortCode; // abort code of the first failed request if status is SS_ABORTED
+        pdoConfig_t config;    // read or written parameters
+    };
+
+    typedef void (*PdoCallback)(const pdoResult_t& result);
+
+    // Little endian: magic "PK", version, key and encoder amount, key brightness, backlight color and brightness,
+    // key color planes, key modes, default key states, top and start value per encoder, CRC-16 of the preceding bytes
+    static constexpr uint8_t PROFILE_SIZE    = 72;
+    static constexpr uint8_t PROFILE_VERSION = 1;
+
+    struct profile_t {
+        uint8_t data[PROFILE_SIZE]; // byte image, can be stored as is (e.g. EEPROM.put())
+    };
+
+    struct inputSnapshot_t {
+        keypadCanStatus_e status;
+        uint16_t          keyPressed; // bit n set if key n is pressed
+        uint8_t           keyState[PKP_MAX_KEY_AMOUNT];
+        int32_t           encoderCount[PKP_MAX_ROTARY_ENCODER_AMOUNT];
+        uint16_t          encoderPosition[PKP_MAX_ROTARY_ENCODER_AMOUNT];
+        int32_t           encoderVelocity[PKP_MAX_ROTARY_ENCODER_AMOUNT]; // ticks per second, fixed point with ENCODER_FIXED_ONE, 0 without PKP_ENCODER_DYNAMICS
+        int16_t           relativeEncoderTicks[PKP_MAX_ROTARY_ENCODER_AMOUNT];
+        uint8_t           wiredInput[PKP_MAX_WIRED_IN_AMOUNT];
+        uint16_t          wiredInputRaw[PKP_MAX_WIRED_IN_AMOUNT]; // filtered, 0 to WIRED_IN_RAW_MAX
+    };
+
+    enum rxFrameType_e : uint8_t {
+        RX_KEYS        = 0,
+        RX_ENCODER     = 1,
+        RX_WIRED_IN    = 2,
+        RX_HEARTBEAT   = 3,
+        RX_SDO         = 4,
+        RX_FOREIGN     = 5, // passed to process() but not sent by the keypad or not decoded
+        RX_TYPE_AMOUNT = 6
+    };
+
+    static constexpr uint8_t TIMING_BINS = 10;
+
+    struct timing_t {
+        uint32_t count;
+        uint32_t min;                    // microseconds, valid if count > 0
+        uint32_t max;                    // microseconds
+        uint32_t histogram[TIMING_BINS]; // bin 0: below 2 us, bin n: 2^n to 2^(n+1) - 1 us, last bin: 512 us and more
+    };
+
+    struct stats_t {
+        uint32_t rxFrames[RX_TYPE_AMOUNT]; // received frames per rxFrameType_e
+        uint32_t txFrames;                 // frames passed to the transmit callback or queue
+        uint32_t txErrors;                 // RS_CAN_TX_ERROR and RS_TX_QUEUE_FULL
+        uint32_t ledSuppressed;            // LED frames not sent because the keypad already shows them
+        uint16_t watchdogTrips;            // communication losses detected by the watchdog
+        uint16_t initializations;          // begin() and PkpBus::begin()
+        uint16_t reconfigurations;         // configurations restored by the reconnect
+        timing_t processTime;              // decoding of a frame from the keypad, including the watchdog
+        timing_t updateTime;               // composing and sending the LED frames after a change
+    };
+
+    // ------ Public Functions ------
+    virtual keypadCanStatus_e getStatus() = 0;
+
+  protected:
+    // ------ Protected Type Definitions ------
+    enum startupStep_e : uint8_t {
+        ST_SENT    = 0, // a startup frame was transmitted
+        ST_WAITING = 1, // no free SDO request slot, try again later
+        ST_DONE    = 2  // no startup frames left
+    };
+
+    // ------ Protected Variables ------
+    uint8_t _canId = 0x15;
+
+    // ------ Protected Functions ------
+    explicit PkpBase(uint8_t canId);
+    virtual returnState_e _beginStartup(bool broadcastStart) = 0;
+    virtual bool          _dispatch(uint32_t baseId, const struct can_frame& rxMsg) = 0;
+    virtual bool          _isStartupReady()                  = 0;
+    virtual startupStep_e _serviceStartup()                  = 0;
+};
+
+template <typename Model>
+class PkpKeypad final : public PkpBase {
+  public:
+    // ------ Public Constants ------
+    static constexpr uint8_t  KEY_AMOUNT        = Model::KEY_AMOUNT;
+    static constexpr uint8_t  ENCODER_AMOUNT    = Model::ENCODER_AMOUNT;
+    static constexpr uint8_t  WIRED_IN_AMOUNT   = Model::WIRED_IN_AMOUNT;
+    static constexpr int32_t  ENCODER_FIXED_ONE = 256; // 1.0 in encoder velocities and accelerations
+    static constexpr uint16_t WIRED_IN_RAW_MAX  = 500; // full scale of the raw wired input values
+
+    // NMT start, heartbeat, key brightness, encoder top and start values, backlight, key colors, key blink, encoder LEDs
+    static constexpr uint8_t STARTUP_FRAME_AMOUNT = 6 + 2 * ENCODER_AMOUNT + (ENCODER_AMOUNT > 0 ? 1 : 0);
+
+    static_assert(KEY_AMOUNT >= 1 && KEY_AMOUNT <= PKP_MAX_KEY_AMOUNT, "Unsupported key amount");
+    static_assert(ENCODER_AMOUNT <= PKP_MAX_ROTARY_ENCODER_AMOUNT, "Unsupported encoder amount");
+    static_assert(WIRED_IN_AMOUNT <= PKP_MAX_WIRED_IN_AMOUNT, "Unsupported wired input amount");
+
     // ------ Public Functions ------
-    Pkp(uint8_t canId, CanMsgTxCallback callback, uint16_t heartBeatInterval = 500);
+    PkpKeypad(uint8_t canId, CanMsgTxCallback callback, uint16_t heartBeatInterval = 500);
     returnState_e     applyDefaultKeyStates();
+#if PKP_ANIMATOR
+    void              attachAnimator(PkpAnimator* animator);
+#endif
+    void              attachBusLoad(PkpBusLoad* meter);
+    void              attachRecorder(PkpRecorder* recorder);
+    void              attachRxRing(PkpRxRing* ring);
+    void              attachTxQueue(PkpTxQueue* queue);
     returnState_e     begin();
+    uint8_t           buildStartupFrames(struct can_frame frames[STARTUP_FRAME_AMOUNT]);
+#if PKP_ENCODER_DYNAMICS
+    int32_t           getEncoderAcceleration(uint8_t encoderIndex);
+#endif
+    int32_t           getEncoderCount(uint8_t encoderIndex);
     uint16_t          getEncoderPosition(uint8_t encoderIndex);
+#if PKP_ENCODER_DYNAMICS
+    int32_t           getEncoderVelocity(uint8_t encoderIndex);
+#endif
     bool              getKeyPress(uint8_t keyIndex);
     uint8_t           getKeyState(uint8_t keyIndex);
+    nmtState_e        getNmtState();
     uint8_t           getWiredInput(uint8_t inputIndex);
+    uint16_t          getWiredInputRaw(uint8_t inputIndex);
     int16_t           getRelativeEncoderTicks(uint8_t encoderIndex);
-    keypadCanStatus_e getStatus();
+    uint8_t           getSdoPending();
+    bool              getStats(stats_t& stats);
+    keypadCanStatus_e getStatus() override;
     returnState_e     initializeEncoder(uint8_t encoderIndex, uint8_t topValue, uint16_t actValue);
-    returnState_e     presetDefaultKeyStates(const int8_t defaultStates[PKP_MAX_KEY_AMOUNT]);
+    returnState_e     loadProfile(const profile_t& profile);
+#if PKP_EVENTS
+    bool              nextEvent(event_t& event);
+#endif
+    uint8_t           poll();
+    returnState_e     presetDefaultKeyStates(const int8_t defaultStates[KEY_AMOUNT]);
     bool              process(const struct can_frame& rxMsg);
+#if PKP_PDO_CONFIG
+    returnState_e     readPdoConfig(tpdo_e pdo, PdoCallback callback);
+#endif
+    returnState_e     readSdo(uint16_t index, uint8_t subIndex, SdoCallback callback);
+    void              resetStats();
+    void              saveProfile(profile_t& profile);
     returnState_e     setBacklight(int8_t color, int8_t brightness);
+#if PKP_ENCODER_DYNAMICS
+    returnState_e     setEncoderAccelerationCurve(uint8_t encoderIndex, uint16_t threshold, uint16_t fullSpeed, uint8_t maxFactor);
+#endif
     returnState_e     setEncoderLeds(int32_t ledsEncoder[PKP_MAX_ROTARY_ENCODER_AMOUNT]);
+#if PKP_EVENTS
+    void              setEventCallback(EventCallback callback);
+#endif
     returnState_e     setKeyBrightness(uint8_t brightness);
     returnState_e     setKeyColor(uint8_t keyIndex, const uint8_t colors[4], const uint8_t blinkColors[4]);
     returnState_e     setKeyMode(uint8_t keyIndex, uint8_t keyMode);
     returnState_e     setKeyStateOverride(uint8_t keyIndex, int8_t _keyState);
+#if PKP_LED_SHADOW
+    void              setLedRefreshInterval(uint16_t interval);
+#endif
+#if PKP_WIRED_IN_FILTER
+    returnState_e     setWiredInputFilter(uint8_t inputIndex, wiredInputFilter_e filter, uint8_t order);
+#endif
+    returnState_e     setWiredInputThreshold(uint8_t inputIndex, uint8_t threshold);
+    returnState_e     setWiredInputThreshold(uint8_t inputIndex, uint16_t threshold, uint8_t hysteresis);
+    void              takeInputSnapshot(inputSnapshot_t& snapshot);
+#if PKP_PDO_CONFIG
+    returnState_e     writePdoConfig(tpdo_e pdo, const pdoConfig_t& config, PdoCallback callback = nullptr);
+#endif
+    returnState_e     writeSdo(uint16_t index, uint8_t subIndex, uint32_t value, uint8_t size, SdoCallback callback = nullptr);
 
 
   private:
@@ -156,58 +464,263 @@ class Pkp {
         MSG_RECEIVED_NOTHING = 1
     };
 
+    enum ledChannel_e : uint8_t {
+        LC_KEY_COLOR = 0,
+        LC_KEY_BLINK = 1,
+        LC_ENCODER   = 2,
+        LC_BACKLIGHT = 3,
+        LC_AMOUNT    = 4
+    };
+
+    enum reconnectStage_e : uint8_t {
+        RC_IDLE    = 0, // connected or never started
+        RC_BACKOFF = 1, // waiting before the next attempt
+        RC_PROBE   = 2, // heartbeat producer write, its confirmation proves the keypad is present
+        RC_START   = 3,
+        RC_CONFIG  = 4  // startup frames without NMT start and heartbeat in one burst
+    };
+
+    enum startupPart_e : uint8_t {
+        SP_START    = 0b0001, // NMT start and heartbeat producer
+        SP_CONFIG   = 0b0010, // key brightness and encoder SDOs
+        SP_LEDS     = 0b0100, // backlight, key and encoder LEDs
+        SP_DEFERRED = 0b1000  // frames postponed for lack of SDO request slots, continued by the keypad itself
+    };
+
+    typedef typename PkpKeyMask<(KEY_AMOUNT + 7) / 8>::type keyMask_t; // one bit per key, KEY_LED_BYTES wide
+
+    struct sdoRequest_t {
+        uint16_t    index;
+        uint8_t     subIndex;
+        uint8_t     command;   // client command specifier of the request
+        uint8_t     data[4];   // download payload
+        uint8_t     retries;   // remaining retransmissions
+        uint16_t    timestamp; // millis() of the last transmission (lower 16 bits)
+        SdoCallback callback;
+    };
+
+#if PKP_ENCODER_DYNAMICS
+    struct encoderCurve_t {
+        uint16_t threshold; // ticks per second below which ticks are not scaled
+        uint16_t fullSpeed; // ticks per second from which ticks are scaled by maxFactor
+        uint8_t  maxFactor; // 1 disables the curve
+    };
+
+    struct encoderSample_t {
+        uint16_t timestamp; // micros() / 16 when the encoder PDO was decoded (lower 16 bits)
+        int16_t  count;     // accumulated ticks after the PDO (lower 16 bits)
+    };
+#endif
+
+#if PKP_LED_SHADOW
+    struct ledShadow_t {
+        uint8_t  dlc;       // 0 marks an invalid shadow
+        uint8_t  data[6];   // LED frames carry at most 6 bytes
+        uint16_t timestamp; // millis() of the last acknowledged transmission (lower 16 bits)
+    };
+#endif
+
     // ------ Private Constants ------
+    static constexpr uint8_t  ANIMATOR_CHANNELS            = LC_AMOUNT + 1; // LED frames and the key brightness SDO
     static constexpr uint16_t CAN_RX_BASE_ID_ENCODER_1     = 0x280;
     static constexpr uint16_t CAN_RX_BASE_ID_ENCODER_2     = 0x380;
     static constexpr uint16_t CAN_RX_BASE_ID_HEARTBEAT     = 0x700;
     static constexpr uint16_t CAN_RX_BASE_ID_KEYS          = 0x180;
+    static constexpr uint16_t CAN_RX_BASE_ID_SDO           = 0x580;
     static constexpr uint16_t CAN_RX_BASE_ID_WIRED_IN      = 0x480;
     static constexpr uint16_t CAN_TX_BASE_ID_ENCODER_LED   = 0x400;
     static constexpr uint16_t CAN_TX_BASE_ID_KEY_BACKLIGHT = 0x500;
     static constexpr uint16_t CAN_TX_BASE_ID_KEY_BLINK     = 0x300;
     static constexpr uint16_t CAN_TX_BASE_ID_KEY_COLOR     = 0x200;
     static constexpr uint16_t CAN_TX_BASE_ID_SDO           = 0x600;
+    static constexpr uint8_t  ENCODER_CURVE_MAX_FACTOR     = 64;
+    static constexpr uint16_t ENCODER_MIN_ELAPSED          = 1000 / 16; // 1 ms in encoderSample_t timestamp units
+    static constexpr uint16_t ENCODER_WINDOW               = 250000 / 16; // 250 ms velocity window in timestamp units
+    static constexpr uint8_t  KEY_LED_BYTES                = (KEY_AMOUNT + 7) / 8; // bytes per color in the key LED PDOs
+    static constexpr uint16_t KEY_MASK_ALL                 = (1u << KEY_AMOUNT) - 1;
+    static constexpr uint8_t  LED_CHANNEL_MASK_ALL         = (1 << LC_AMOUNT) - 1;
+    static constexpr uint16_t OD_TPDO_COMMUNICATION        = 0x1800; // + TPDO number, sub-indices 2, 3 and 5
+    static constexpr uint16_t OD_WIRED_IN_PERIOD           = 0x2006; // wired input TPDO period in 10 ms
+    static constexpr uint16_t RECONNECT_DELAY_MAX          = 16000;
+    static constexpr uint16_t RECONNECT_DELAY_MIN          = 250;
+    static constexpr uint8_t  WIRED_IN_IIR_MAX_ORDER       = 7;
+    static constexpr uint8_t  WIRED_IN_IIR_SHIFT           = 6; // fractional bits of the IIR state, 500 << 6 fits 16 bits
+    static constexpr uint16_t WIRED_IN_PERIOD_MAX          = 2000;
+    static constexpr uint16_t WIRED_IN_PERIOD_MIN          = 80;
+    static constexpr uint32_t SDO_ABORT_UNSUPPORTED        = 0x05040001; // command specifier not valid or unknown
+    static constexpr uint8_t  SDO_CCS_UPLOAD               = 0x40;
+    static constexpr uint8_t  SDO_CS_ABORT                 = 0x80;
+    static constexpr uint8_t  SDO_RETRIES                  = 2;
+    static constexpr uint8_t  SDO_SCS_DOWNLOAD             = 0x60;
+    static constexpr uint8_t  SDO_SCS_UPLOAD               = 0x40;
+    static constexpr uint16_t SDO_TIMEOUT                  = 200;
 
     // ------ Private Variables ------
-    uint16_t          _canNodeHeartbeatInterval                              = 0;
-    uint16_t          _canNodeReconnectInterval                              = 2000;
-    uint16_t          _canNodeWatchdogTime                                   = 1200;
-    uint8_t           _backlightBrightness                                   = 10;
-    uint8_t           _backlightColor                                        = BACKLIGHT_AMBER;
-    uint8_t           _canId                                                 = 0x15;
-    uint16_t          _currentEncoderBlinkLed[PKP_MAX_ROTARY_ENCODER_AMOUNT] = {0};
-    uint16_t          _currentEncoderLed[PKP_MAX_ROTARY_ENCODER_AMOUNT]      = {0};
-    uint8_t           _defaultKeyState[PKP_MAX_KEY_AMOUNT]                   = {0};
-    uint16_t          _encoderInitValue[PKP_MAX_ROTARY_ENCODER_AMOUNT]       = {0};
-    uint16_t          _encoderPosition[PKP_MAX_ROTARY_ENCODER_AMOUNT]        = {0};
-    uint8_t           _encoderTopValue[PKP_MAX_ROTARY_ENCODER_AMOUNT]        = {0};
-    bool              _initialized                                           = false;
-    uint8_t           _keyBlinkColor[4][PKP_MAX_KEY_AMOUNT]                  = {0};
-    uint8_t           _keyBrightness                                         = 50;
-    uint8_t           _keyColor[4][PKP_MAX_KEY_AMOUNT]                       = {0};
-    bool              _keyPressed[PKP_MAX_KEY_AMOUNT]                        = {0};
-    uint8_t           _keyState[PKP_MAX_KEY_AMOUNT]                          = {0};
-    keypadCanStatus_e _keypadCanStatus                                       = KPS_FRESH;
-    uint8_t           _keyMode[PKP_MAX_KEY_AMOUNT]                           = {0};
-    bool              _lastKeyPressed[PKP_MAX_KEY_AMOUNT]                    = {0};
-    uint32_t          _lastCanFrameTimestamp                                 = 0;
-    uint32_t          _lastReconnectTry                                      = 0;
-    int8_t            _overrideKeyState[PKP_MAX_KEY_AMOUNT]                  = {0};
-    int8_t            _relativeEncoderTicks[PKP_MAX_ROTARY_ENCODER_AMOUNT]   = {0};
-    uint8_t           _wiredInputValue[PKP_MAX_WIRED_IN_AMOUNT]              = {0};
+    // Ordered by alignment, so the compiler inserts no padding. Optional features follow in their own blocks.
+    PkpBusLoad*       _busLoad                                = nullptr;
+    PkpRecorder*      _recorder                               = nullptr;
+    PkpRxRing*        _rxRing                                 = nullptr;
+    sdoRequest_t      _sdoRequest[PKP_SDO_MAX_PENDING];
     CanMsgTxCallback  _transmitMessage;
+    PkpTxQueue*       _txQueue                                = nullptr;
+    uint32_t          _defaultKeyStates                       = 0; // 2 bits per key
+    int32_t           _encoderCount[ENCODER_AMOUNT]           = {};
+    uint32_t          _keyModes                               = 0; // 2 bits per key
+    uint32_t          _lastCanFrameTimestamp                  = 0;
+    uint32_t          _overrideKeyStates                      = 0; // 2 bits per key
+    uint32_t          _reconnectTimestamp                     = 0;
+    int32_t           _relativeEncoderTicks[ENCODER_AMOUNT]   = {}; // scaled ticks not yet read
+    uint16_t          _canNodeHeartbeatInterval               = 0;
+    uint16_t          _canNodeWatchdogTime                    = 1200;
+    uint16_t          _currentEncoderBlinkLed[ENCODER_AMOUNT] = {};
+    uint16_t          _currentEncoderLed[ENCODER_AMOUNT]      = {};
+    uint16_t          _encoderInitValue[ENCODER_AMOUNT]       = {};
+    uint16_t          _encoderPosition[ENCODER_AMOUNT]        = {};
+    uint16_t          _reconnectDelay                         = 0;
+    uint16_t          _wiredInputThreshold[WIRED_IN_AMOUNT]   = {};
+    uint16_t          _wiredInputValue[WIRED_IN_AMOUNT]       = {}; // filtered, 0 to WIRED_IN_RAW_MAX
+    keyMask_t         _keyColorPlane[2][4][3]                 = {}; // [colorMode_e][key state][R, G, B] key bitmasks
+    keyMask_t         _keyPressedMask                         = 0;
+    keyMask_t         _keyStateMask[4]                        = {KEY_MASK_ALL, 0, 0, 0}; // keys per key state
+    keyMask_t         _overrideKeyMask                        = 0; // keys with an active override
+    uint8_t           _backlightBrightness                    = 10;
+    uint8_t           _backlightColor                         = BACKLIGHT_AMBER;
+    uint8_t           _encoderTopValue[ENCODER_AMOUNT]        = {};
+    bool              _initialized                            = false;
+    uint8_t           _keyBrightness                          = 50;
+    keypadCanStatus_e _keypadCanStatus                        = KPS_FRESH;
+    nmtState_e        _nmtState                               = NMT_UNKNOWN;
+    bool              _reconnectConfig                        = true; // SDO configuration has to be rewritten
+    uint8_t           _reconnectSdoMask                       = 0; // requests the current reconnect stage waits for
+    reconnectStage_e  _reconnectStage                         = RC_IDLE;
+    uint8_t           _sdoConfigMask                          = 0; // SP_CONFIG frames waiting for a request slot, bit n for frame n
+    uint8_t           _sdoDirtyMask                           = 0; // requests whose payload changed after transmission
+    uint8_t           _sdoPendingMask                         = 0; // occupied request slots
+    uint8_t           _startupFrame                           = STARTUP_FRAME_AMOUNT; // next frame of a paced startup
+    uint8_t           _startupParts                           = 0; // startupPart_e flags of the paced startup
+    uint8_t           _wiredInputHighMask                     = 0;
+    uint8_t           _wiredInputHysteresis[WIRED_IN_AMOUNT]  = {};
+#if PKP_ANIMATOR
+    PkpAnimator*      _animator                               = nullptr;
+    uint8_t           _animatorChannel                        = 0; // first channel to check in the next tick
+    uint8_t           _keyBrightnessSent                      = 0xFF; // raw value of the last brightness write, 0xFF if unknown
+#endif
+#if PKP_ENCODER_DYNAMICS
+    int32_t           _encoderAcceleration[ENCODER_AMOUNT]    = {}; // ticks per second squared, fixed point
+    uint32_t          _encoderSampleTime[ENCODER_AMOUNT]      = {}; // micros() of the newest sample, does not wrap like the samples
+    int32_t           _encoderVelocity[ENCODER_AMOUNT]        = {}; // ticks per second, fixed point
+    encoderSample_t   _encoderSamples[ENCODER_AMOUNT][PKP_ENCODER_SAMPLES] = {};
+    encoderCurve_t    _encoderCurve[ENCODER_AMOUNT]           = {};
+    int16_t           _encoderRemainder[ENCODER_AMOUNT]       = {}; // fraction of a scaled tick, fixed point
+    uint8_t           _encoderSampleHead[ENCODER_AMOUNT]      = {};
+#endif
+#if PKP_EVENTS
+    EventCallback     _eventCallback                          = nullptr;
+    event_t           _events[PKP_EVENT_QUEUE_SIZE];
+    uint8_t           _eventHead                              = 0;
+    uint8_t           _eventTail                              = 0;
+#endif
+#if PKP_LED_SHADOW
+    ledShadow_t       _ledShadow[LC_AMOUNT]                   = {};
+    uint16_t          _ledRefreshInterval                     = 0;
+#endif
+#if PKP_PDO_CONFIG
+    PdoCallback       _pdoCallback                            = nullptr;
+    pdoResult_t       _pdoResult                              = {};
+    uint8_t           _pdoSdoMask                             = 0; // requests the current PDO configuration waits for
+#endif
+#if PKP_STATS
+    stats_t           _stats                                  = {};
+#endif
+#if PKP_WIRED_IN_FILTER
+    uint16_t          _wiredInputAverage[WIRED_IN_AMOUNT][PKP_WIRED_IN_AVERAGE_SIZE];
+    uint16_t          _wiredInputFilterState[WIRED_IN_AMOUNT] = {}; // IIR: value with WIRED_IN_IIR_SHIFT fractional bits, average: sum
+    uint8_t           _wiredInputAverageHead                  = 0; // all inputs arrive in one PDO, so they share the ring position
+    uint8_t           _wiredInputFilter[WIRED_IN_AMOUNT]      = {}; // wiredInputFilter_e in the upper, order in the lower nibble
+    uint8_t           _wiredInputPrimedMask                   = 0; // inputs whose filter holds a received value
+#endif
 
 
     // ------ Private Functions ------
+    returnState_e     _beginStartup(bool broadcastStart) override;
+    void              _checkSdoTimeouts(uint16_t now);
+    bool              _dispatch(uint32_t baseId, const struct can_frame& rxMsg) override;
+    void              _decodeHeartbeat(const uint8_t data[8]);
     returnState_e     _decodeKeyStates(const uint8_t data[8]);
     returnState_e     _decodeRotaryEncoder(const uint8_t data[8], uint8_t encoderIndex);
+    void              _decodeSdoResponse(const uint8_t data[8]);
     returnState_e     _decodeWiredInputs(const uint8_t data[8]);
+#if PKP_WIRED_IN_FILTER
+    uint16_t          _filterWiredInput(uint8_t inputIndex, uint16_t value);
+#endif
+#if PKP_PDO_CONFIG
+    void              _finishPdoRequest(const sdoResult_t& result, bool upload);
+#endif
+    void              _finishSdo(uint8_t slot, sdoStatus_e status, uint32_t value);
+    void              _composeBacklight(struct can_frame& txMsg);
+    void              _composeEncoderLeds(struct can_frame& txMsg);
+    uint8_t           _composeKeyBrightness();
+    void              _composeKeyLeds(bool mode, struct can_frame& txMsg);
+    void              _composeNmtStart(struct can_frame& txMsg);
+    void              _composeSdoDownload(struct can_frame& txMsg, uint16_t index, uint8_t subIndex, uint32_t value, uint8_t size);
+    bool              _composeStartupFrame(uint8_t frameIndex, uint8_t parts, struct can_frame& txMsg);
+    static uint16_t   _crc16(const uint8_t* data, uint8_t length);
+    static uint8_t    _getKeyField(uint32_t fields, uint8_t keyIndex);
+    uint32_t          _getEncoderBlinkLeds();
+    uint8_t           _getKeyState(uint8_t keyIndex);
+#if PKP_STATS
+    static uint8_t    _getRxFrameType(uint32_t baseId);
+#endif
     returnState_e     _initializeKeypad();
+    void              _invalidateLedShadow(uint8_t channelMask);
+    bool              _isLedFrameDue(ledChannel_e channel, const struct can_frame& txMsg, uint16_t now);
+#if PKP_ENCODER_DYNAMICS
+    bool              _isEncoderMoving(uint8_t encoderIndex);
+#endif
+#if PKP_PDO_CONFIG
+    bool              _isPdoAvailable(tpdo_e pdo);
+#endif
+    bool              _isStartupReady() override;
+#if PKP_PDO_CONFIG
+    returnState_e     _issuePdoRequests(tpdo_e pdo, const pdoConfig_t* config, PdoCallback callback);
+#endif
+    void              _pushEvent(eventType_e type, uint8_t index, int16_t value, uint32_t timestamp);
     keypadCanStatus_e _keypadStatusWatchdog(const keypadStatusUpdate_e action);
+#if PKP_ENCODER_DYNAMICS
+    static int32_t    _multiplyFixed(int32_t value, uint32_t factor);
+    int16_t           _scaleEncoderTicks(uint8_t encoderIndex, int16_t ticks);
+#endif
+    static uint8_t    _scaleWiredInput(uint16_t value);
+    void              _scheduleReconnect(uint32_t now);
+#if PKP_ANIMATOR
+    void              _serviceAnimator(uint32_t now);
+#endif
+    static uint32_t   _readLittleEndian(const uint8_t*& cursor, uint8_t size);
+    returnState_e     _readSdo(uint16_t index, uint8_t subIndex, SdoCallback callback);
+#if PKP_STATS
+    static void       _recordTiming(timing_t& timing, uint32_t start);
+#endif
+    returnState_e     _sendSdo(uint8_t slot, bool initMsg = false);
+    static void       _setKeyField(uint32_t& fields, uint8_t keyIndex, uint8_t value);
+    void              _serviceReconnect(uint32_t now);
+    startupStep_e     _serviceStartup() override;
+    void              _setKeyState(uint8_t keyIndex, uint8_t keyState);
     returnState_e     _transmit(const struct can_frame& txMsg, bool initMsg = false);
+    returnState_e     _transmitLed(ledChannel_e channel, const struct can_frame& txMsg);
+    returnState_e     _transmitNmtStart(bool initMsg);
+    returnState_e     _transmitStartupFrame(const struct can_frame& txMsg);
+    returnState_e     _transmitStartupFrames(uint8_t parts);
+    returnState_e     _transmitConfigFrames();
+#if PKP_ENCODER_DYNAMICS
+    void              _updateEncoderEstimate(uint8_t encoderIndex, uint32_t now);
+#endif
     returnState_e     _writeEncoderLeds();
+    static void       _writeLittleEndian(uint8_t*& cursor, uint32_t value, uint8_t size);
     returnState_e     _writeKeyLeds(bool mode);
+    returnState_e     _writeSdo(uint16_t index, uint8_t subIndex, uint32_t value, uint8_t size, SdoCallback callback, bool initMsg);
     returnState_e     _update(updateType_e updateType = UT_ALL);
 };
 
+typedef PkpKeypad<Pkp3500SiMt> Pkp;
+
 #endif // BLINK_MARINE_CAN_OPEN_KEYPAD
@@ -0,0 +1,305 @@
+#include "PkpAnimator.h"
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs an animator.
+ *
+ * @param framesPerTick Maximum number of LED frames the keypad transmits per tick, at least 1.
+ * @param tickInterval Milliseconds between two renderings of the LED image.
+ */
+PkpAnimator::PkpAnimator(uint8_t framesPerTick, uint16_t tickInterval)
+    : _framesPerTick(max(framesPerTick, (uint8_t)1)), _tickInterval(tickInterval) {
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Runs a single lit LED around the LEDs of an encoder ring.
+ *
+ * @param encoderIndex The index of the encoder (0 to PKP_MAX_ROTARY_ENCODER_AMOUNT - 1).
+ * @param ledMask The ring LEDs to run over, in the order of their bits. The other LEDs keep their state.
+ * @param stepTime Milliseconds per step.
+ * @param duration Milliseconds until the animation ends, 0 to run until stopped.
+ * @return The handle of the animation, or -1 if the index is invalid or all slots are in use.
+ */
+int8_t PkpAnimator::chaseEncoder(uint8_t encoderIndex, uint16_t ledMask, uint16_t stepTime, uint16_t duration) {
+    if (encoderIndex >= PKP_MAX_ROTARY_ENCODER_AMOUNT) {
+        return -1;
+    }
+    int8_t handle = _start(AT_CHASE_ENCODER, ledMask, 0, 0, max(stepTime, (uint16_t)1), duration);
+    if (handle >= 0) {
+        _animations[handle].encoderIndex = encoderIndex;
+    }
+    return handle;
+}
+
+/**
+ * @brief Runs a single lit key over a group of keys.
+ *
+ * @param keyMask The keys to run over, in the order of their bits. The other keys of the group are dark.
+ * @param color The color of the lit key (keyColor_e).
+ * @param stepTime Milliseconds per step.
+ * @param duration Milliseconds until the animation ends, 0 to run until stopped.
+ * @return The handle of the animation, or -1 if all slots are in use.
+ */
+int8_t PkpAnimator::chaseKeys(uint16_t keyMask, uint8_t color, uint16_t stepTime, uint16_t duration) {
+    return _start(AT_CHASE_KEYS, keyMask, color, 0, max(stepTime, (uint16_t)1), duration);
+}
+
+/**
+ * @brief Fades the backlight brightness, the backlight color is kept.
+ *
+ * The target brightness is held after the fade until the animation is stopped. Afterwards the brightness set via
+ * setBacklight() applies again.
+ *
+ * @param from Brightness at the start, 0 to 100.
+ * @param to Brightness at the end, 0 to 100.
+ * @param duration Milliseconds of the fade.
+ * @return The handle of the animation, or -1 if all slots are in use.
+ */
+int8_t PkpAnimator::fadeBacklight(uint8_t from, uint8_t to, uint16_t duration) {
+    return _start(AT_FADE_BACKLIGHT, 0, min(from, (uint8_t)100), min(to, (uint8_t)100), 0, duration);
+}
+
+/**
+ * @brief Fades the key brightness.
+ *
+ * The brightness is written via SDO, so each step occupies an SDO request until it is confirmed. The target
+ * brightness is held after the fade until the animation is stopped. Afterwards the brightness set via
+ * setKeyBrightness() applies again.
+ *
+ * @param from Brightness at the start, 0 to 100.
+ * @param to Brightness at the end, 0 to 100.
+ * @param duration Milliseconds of the fade.
+ * @return The handle of the animation, or -1 if all slots are in use.
+ */
+int8_t PkpAnimator::fadeKeyBrightness(uint8_t from, uint8_t to, uint16_t duration) {
+    return _start(AT_FADE_KEYS, 0, min(from, (uint8_t)100), min(to, (uint8_t)100), 0, duration);
+}
+
+/**
+ * @brief Returns the maximum number of LED frames per tick.
+ *
+ * @return The frame budget of one tick.
+ */
+uint8_t PkpAnimator::getFramesPerTick() {
+    return _framesPerTick;
+}
+
+/**
+ * @brief Returns the LED image of the last rendered tick.
+ *
+ * @return The image, parts not covered by a running animation are marked by the masks and -1 brightness values.
+ */
+const PkpAnimator::ledImage_t& PkpAnimator::getImage() {
+    return _image;
+}
+
+/**
+ * @brief Checks whether an animation is still running.
+ *
+ * Animations with a duration end with the first tick after their duration has elapsed, fades keep running.
+ *
+ * @param handle The handle returned when the animation was started.
+ * @return True while the animation occupies its slot.
+ */
+bool PkpAnimator::isRunning(int8_t handle) {
+    return handle >= 0 && handle < PKP_ANIMATION_SLOTS && _animations[handle].type != AT_NONE;
+}
+
+/**
+ * @brief Shows fixed colors on a group of keys for some time, regardless of their key states.
+ *
+ * Replaces the blink-for-some-time pattern of calling setKeyStateOverride() from the main loop.
+ *
+ * @param keyMask The keys to override.
+ * @param color The solid color (keyColor_e).
+ * @param blinkColor The blink color (keyColor_e), KEY_COLOR_BLANK for a steady color.
+ * @param duration Milliseconds until the keys show their state colors again, 0 to override until stopped.
+ * @return The handle of the animation, or -1 if all slots are in use.
+ */
+int8_t PkpAnimator::overrideKeys(uint16_t keyMask, uint8_t color, uint8_t blinkColor, uint16_t duration) {
+    return _start(AT_OVERRIDE_KEYS, keyMask, color, blinkColor, 0, duration);
+}
+
+/**
+ * @brief Switches a group of keys on and off.
+ *
+ * Unlike the blink colors of the keypad, the pulse period is freely selectable.
+ *
+ * @param keyMask The keys to pulse.
+ * @param color The color of the on phase (keyColor_e).
+ * @param period Milliseconds of one on and off phase.
+ * @param duration Milliseconds until the animation ends, 0 to run until stopped.
+ * @return The handle of the animation, or -1 if all slots are in use.
+ */
+int8_t PkpAnimator::pulseKeys(uint16_t keyMask, uint8_t color, uint16_t period, uint16_t duration) {
+    return _start(AT_PULSE_KEYS, keyMask, color, 0, max(period, (uint16_t)2), duration);
+}
+
+/**
+ * @brief Renders the LED image of all running animations if a tick is due.
+ *
+ * Called by the keypad from its poll(). Animations in higher slots are painted over those in lower slots.
+ *
+ * @param now The current millis() value.
+ * @return True if the image was rendered, false if the tick interval has not elapsed yet.
+ */
+bool PkpAnimator::render(uint32_t now) {
+    if (!_restart && now - _lastTick < _tickInterval) {
+        return false;
+    }
+    _lastTick = now;
+    _restart  = false;
+
+    memset(&_image, 0, sizeof(_image));
+    _image.backlightBrightness = -1;
+    _image.keyBrightness       = -1;
+
+    for (uint8_t i = 0; i < PKP_ANIMATION_SLOTS; i++) {
+        animation_t& animation = _animations[i];
+        if (animation.type == AT_NONE) {
+            continue;
+        }
+
+        uint32_t elapsed  = now - animation.start;
+        bool     isFade   = animation.type == AT_FADE_BACKLIGHT || animation.type == AT_FADE_KEYS;
+        bool     finished = animation.duration > 0 && elapsed >= animation.duration;
+        if (finished && !isFade) {
+            animation.type = AT_NONE;
+            continue;
+        }
+
+        switch (animation.type) {
+            case AT_CHASE_ENCODER:
+            case AT_CHASE_KEYS: {
+                // The lit LED or key is the n-th set bit of the mask
+                uint8_t count = 0;
+                for (uint16_t bits = animation.mask; bits != 0; bits &= bits - 1) {
+                    count++;
+                }
+                if (count == 0) {
+                    break;
+                }
+                uint8_t  step = (elapsed / animation.period) % count;
+                uint16_t lit  = animation.mask;
+                while (step-- > 0) {
+                    lit &= lit - 1;
+                }
+                lit &= -lit;
+                if (animation.type == AT_CHASE_KEYS) {
+                    _paintKeys(_image, animation.mask & ~lit, 0, 0);
+                    _paintKeys(_image, lit, 0, animation.value[0]);
+                    _paintKeys(_image, animation.mask, 1, 0);
+                    break;
+                }
+                uint8_t e             = animation.encoderIndex;
+                _image.encoderMask[e] |= animation.mask;
+                _image.encoderLeds[e] = (_image.encoderLeds[e] & ~animation.mask) | lit;
+                break;
+            }
+            case AT_FADE_BACKLIGHT:
+            case AT_FADE_KEYS: {
+                int16_t from       = animation.value[0];
+                int16_t to         = animation.value[1];
+                int8_t  brightness = to;
+                if (!finished && animation.duration > 0) {
+                    brightness = from + (int32_t)(to - from) * (int32_t)elapsed / animation.duration;
+                }
+                if (animation.type == AT_FADE_BACKLIGHT) {
+                    _image.backlightBrightness = brightness;
+                } else {
+                    _image.keyBrightness = brightness;
+                }
+                break;
+            }
+            case AT_OVERRIDE_KEYS:
+                _paintKeys(_image, animation.mask, 0, animation.value[0]);
+                _paintKeys(_image, animation.mask, 1, animation.value[1]);
+                break;
+            case AT_PULSE_KEYS: {
+                bool on = (elapsed % animation.period) < animation.period / 2;
+                _paintKeys(_image, animation.mask, 0, on ? animation.value[0] : 0);
+                _paintKeys(_image, animation.mask, 1, 0);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Sets the maximum number of LED frames transmitted per tick.
+ *
+ * Changed frames beyond the budget are sent in the following ticks, starting with the channel after the last one
+ * sent, so a busy animation does not starve the others.
+ *
+ * @param framesPerTick The frame budget of one tick, at least 1.
+ */
+void PkpAnimator::setFramesPerTick(uint8_t framesPerTick) {
+    _framesPerTick = max(framesPerTick, (uint8_t)1);
+}
+
+/**
+ * @brief Sets the time between two renderings of the LED image.
+ *
+ * @param tickInterval Milliseconds per tick.
+ */
+void PkpAnimator::setTickInterval(uint16_t tickInterval) {
+    _tickInterval = tickInterval;
+}
+
+/**
+ * @brief Stops an animation, the affected LEDs return to their state set through the keypad API.
+ *
+ * @param handle The handle returned when the animation was started, invalid handles are ignored.
+ */
+void PkpAnimator::stop(int8_t handle) {
+    if (handle < 0 || handle >= PKP_ANIMATION_SLOTS) {
+        return;
+    }
+    _animations[handle].type = AT_NONE;
+    _restart                 = true;
+}
+
+/**
+ * @brief Stops all animations.
+ */
+void PkpAnimator::stopAll() {
+    for (uint8_t i = 0; i < PKP_ANIMATION_SLOTS; i++) {
+        _animations[i].type = AT_NONE;
+    }
+    _restart = true;
+}
+
+//********** PRIVATE METHODS **********
+
+void PkpAnimator::_paintKeys(ledImage_t& image, uint16_t keyMask, uint8_t layer, uint8_t color) {
+    image.keyMask |= keyMask;
+    for (uint8_t c = 0; c < 3; c++) {
+        uint16_t& plane = image.keyColor[layer][c];
+        plane           = (color & (0b100 >> c)) ? (plane | keyMask) : (plane & ~keyMask); // R, G, B
+    }
+}
+
+int8_t PkpAnimator::_start(animationType_e type, uint16_t mask, uint8_t value0, uint8_t value1, uint16_t period, uint16_t duration) {
+    for (uint8_t i = 0; i < PKP_ANIMATION_SLOTS; i++) {
+        animation_t& animation = _animations[i];
+        if (animation.type != AT_NONE) {
+            continue;
+        }
+        animation.type     = type;
+        animation.mask     = mask;
+        animation.value[0] = value0;
+        animation.value[1] = value1;
+        animation.period   = period;
+        animation.duration = duration;
+        animation.start    = millis();
+        _restart           = true;
+        return i;
+    }
+    return -1;
+}
@@ -0,0 +1,88 @@
+/*
+ * LED animation scheduler for Blink Marine KeyPads
+ *
+ * Runs timed LED effects (pulses, chases, timed overrides and brightness fades) on top of the
+ * LED state set through the keypad API. Every tick the animator renders the LED image of all
+ * running animations. The keypad it is attached to diffs the resulting frames against the
+ * frames last sent and transmits at most a configured number of frames per tick, so effects
+ * neither flood the bus nor need code in the main loop.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_ANIMATOR
+#define BLINK_MARINE_CAN_OPEN_ANIMATOR
+
+#include "BlinkMarinePkpCanOpen.h"
+
+#ifndef PKP_ANIMATION_SLOTS
+#define PKP_ANIMATION_SLOTS 4
+#endif
+
+static_assert(PKP_ANIMATION_SLOTS >= 1 && PKP_ANIMATION_SLOTS <= 16, "PKP_ANIMATION_SLOTS must be between 1 and 16");
+
+class PkpAnimator {
+  public:
+    // ------ Public Types ------
+    struct ledImage_t {
+        uint16_t keyMask;                                        // keys whose colors are taken from the image
+        uint16_t keyColor[2][3];                                 // [solid, blink][R, G, B] bit per key
+        uint16_t encoderMask[PKP_MAX_ROTARY_ENCODER_AMOUNT];     // ring LEDs taken from the image
+        uint16_t encoderLeds[PKP_MAX_ROTARY_ENCODER_AMOUNT];
+        int8_t   backlightBrightness;                            // 0 to 100, -1 if not animated
+        int8_t   keyBrightness;                                  // 0 to 100, -1 if not animated
+    };
+
+    // ------ Public Functions ------
+    PkpAnimator(uint8_t framesPerTick = 2, uint16_t tickInterval = 20);
+    int8_t            chaseEncoder(uint8_t encoderIndex, uint16_t ledMask, uint16_t stepTime, uint16_t duration = 0);
+    int8_t            chaseKeys(uint16_t keyMask, uint8_t color, uint16_t stepTime, uint16_t duration = 0);
+    int8_t            fadeBacklight(uint8_t from, uint8_t to, uint16_t duration);
+    int8_t            fadeKeyBrightness(uint8_t from, uint8_t to, uint16_t duration);
+    uint8_t           getFramesPerTick();
+    const ledImage_t& getImage();
+    bool              isRunning(int8_t handle);
+    int8_t            overrideKeys(uint16_t keyMask, uint8_t color, uint8_t blinkColor, uint16_t duration);
+    int8_t            pulseKeys(uint16_t keyMask, uint8_t color, uint16_t period, uint16_t duration = 0);
+    bool              render(uint32_t now);
+    void              setFramesPerTick(uint8_t framesPerTick);
+    void              setTickInterval(uint16_t tickInterval);
+    void              stop(int8_t handle);
+    void              stopAll();
+
+  private:
+    // ------ Private Type Definitions  ------
+    enum animationType_e : uint8_t {
+        AT_NONE           = 0, // free slot
+        AT_CHASE_ENCODER  = 1,
+        AT_CHASE_KEYS     = 2,
+        AT_FADE_BACKLIGHT = 3,
+        AT_FADE_KEYS      = 4,
+        AT_OVERRIDE_KEYS  = 5,
+        AT_PULSE_KEYS     = 6
+    };
+
+    struct animation_t {
+        animationType_e type;
+        uint8_t         encoderIndex;
+        uint8_t         value[2]; // solid and blink color, or brightness from and to
+        uint16_t        mask;     // keys or encoder ring LEDs
+        uint16_t        period;   // pulse period or chase step time in milliseconds
+        uint16_t        duration; // milliseconds, 0 runs until stopped
+        uint32_t        start;
+    };
+
+    // ------ Private Variables ------
+    animation_t _animations[PKP_ANIMATION_SLOTS] = {};
+    uint8_t     _framesPerTick;
+    ledImage_t  _image                           = {};
+    uint32_t    _lastTick                        = 0;
+    bool        _restart                         = true; // next render() is due regardless of the interval
+    uint16_t    _tickInterval;
+
+    // ------ Private Functions ------
+    int8_t      _start(animationType_e type, uint16_t mask, uint8_t value0, uint8_t value1, uint16_t period, uint16_t duration);
+    static void _paintKeys(ledImage_t& image, uint16_t keyMask, uint8_t layer, uint8_t color);
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_ANIMATOR
@@ -0,0 +1,227 @@
+
+#include "PkpBus.h"
+#include "PkpBusLoad.h"
+#include "PkpRecorder.h"
+#include "PkpRxRing.h"
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs an empty keypad bus.
+ */
+PkpBus::PkpBus() {
+    memset(_nodeSlot, (NO_SLOT << 4) | NO_SLOT, sizeof(_nodeSlot));
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Adds a keypad to the bus.
+ *
+ * The keypad is registered under its CAN node ID. Each node ID (1 to 127) can only be attached once and
+ * at most PKP_BUS_MAX_NODES keypads can be attached.
+ *
+ * @param keypad The keypad to attach. It must outlive the bus.
+ * @return A status code indicating success, an invalid or already used node ID, or a full node table.
+ */
+PkpBase::returnState_e PkpBus::attach(PkpBase& keypad) {
+    if (!inLimits(keypad._canId, 1, NODE_ID_COUNT - 1) || _getSlot(keypad._canId) != NO_SLOT) {
+        return PkpBase::RS_INVALID_NODE_ID;
+    }
+    if (_nodeCount >= PKP_BUS_MAX_NODES) {
+        return PkpBase::RS_NODE_TABLE_FULL;
+    }
+
+    uint8_t shift                 = (keypad._canId & 1) * 4;
+    _nodes[_nodeCount]            = &keypad;
+    _nodeSlot[keypad._canId >> 1] &= ~(0x0F << shift);
+    _nodeSlot[keypad._canId >> 1] |= _nodeCount << shift;
+    _nodeCount++;
+    return PkpBase::RS_SUCCESS;
+}
+
+/**
+ * @brief Accounts the bus time of the received frames that are not consumed by an attached keypad.
+ *
+ * These are the frames of other nodes and the frames of a keypad's node ID with a function code the keypad does
+ * not decode. The frames consumed by the attached keypads are accounted by the meters attached to the keypads (see
+ * Pkp::attachBusLoad()). Attaching the same meter to the bus and all keypads, or chaining the meters of the
+ * keypads to this one with PkpBusLoad::attachTotal(), accounts the load of the whole bus.
+ *
+ * @param meter The meter to use, nullptr to stop accounting.
+ */
+void PkpBus::attachBusLoad(PkpBusLoad* meter) {
+    _busLoad = meter;
+}
+
+/**
+ * @brief Logs all frames passed to process().
+ *
+ * Transmitted frames are logged by the keypads, attach the same recorder to them with Pkp::attachRecorder().
+ *
+ * @param recorder The recorder to log to, nullptr to stop logging.
+ */
+void PkpBus::attachRecorder(PkpRecorder* recorder) {
+    _recorder = recorder;
+}
+
+/**
+ * @brief Enables deferred processing of received frames.
+ *
+ * The CAN receive interrupt only pushes frames into the ring, poll() routes them to the keypads from the main loop.
+ *
+ * @param ring The ring to drain in poll(), nullptr to disable deferred processing.
+ */
+void PkpBus::attachRxRing(PkpRxRing* ring) {
+    _rxRing = ring;
+}
+
+/**
+ * @brief Starts all attached keypads as a fleet, instead of calling begin() on each keypad.
+ *
+ * A single broadcast NMT start (node 0) brings all keypads to operational, which also starts nodes on the bus
+ * that are not attached. The configuration and LED frames of the keypads are then sent interleaved from poll(),
+ * at most framesPerPoll frames per call, so the transmit buffers of the CAN controller are not overrun. An SDO
+ * write waits while the SDO client of its keypad is busy, while the other keypads continue. Use isNodeReady() to
+ * find out when a keypad has confirmed its configuration.
+ *
+ * @param framesPerPoll Maximum number of frames per poll() call, at least 1. At 250 kbit/s a frame takes about
+ *        0.5 ms, so 2 frames per millisecond of poll() period keep up with the bus.
+ * @return A status code indicating success or the error of the broadcast NMT start.
+ */
+PkpBase::returnState_e PkpBus::begin(uint8_t framesPerPoll) {
+    _startupFrames = max(framesPerPoll, (uint8_t)1);
+    _startupMask   = 0;
+    _startupNode   = 0;
+
+    for (uint8_t i = 0; i < _nodeCount; i++) {
+        PkpBase::returnState_e returnValue = _nodes[i]->_beginStartup(i == 0);
+        if (returnValue != PkpBase::RS_SUCCESS) {
+            return returnValue;
+        }
+        _startupMask |= 1u << i;
+    }
+    _serviceStartup();
+    return PkpBase::RS_SUCCESS;
+}
+
+/**
+ * @brief Returns the number of attached keypads.
+ *
+ * @return The number of keypads attached via attach().
+ */
+uint8_t PkpBus::getNodeCount() {
+    return _nodeCount;
+}
+
+/**
+ * @brief Returns the CAN node ID of an attached keypad.
+ *
+ * @param index The index of the keypad in order of attachment (0 to getNodeCount() - 1).
+ * @return The node ID, 0 if the index is out of range.
+ */
+uint8_t PkpBus::getNodeId(uint8_t index) {
+    if (index >= _nodeCount) {
+        return 0;
+    }
+    return _nodes[index]->_canId;
+}
+
+/**
+ * @brief Checks whether a keypad started via begin() has confirmed its configuration.
+ *
+ * A keypad is ready once all of its startup frames are sent, its SDO writes are confirmed and no reconnect is
+ * pending. A keypad that does not confirm them in time is reconfigured by its reconnect logic.
+ *
+ * @param index The index of the keypad in order of attachment (0 to getNodeCount() - 1).
+ * @return True if the keypad is ready, false if it is still starting or the index is out of range.
+ */
+bool PkpBus::isNodeReady(uint8_t index) {
+    if (index >= _nodeCount) {
+        return false;
+    }
+    return _nodes[index]->_isStartupReady();
+}
+
+/**
+ * @brief Processes frames from the attached receive ring and runs the communication watchdog of all keypads.
+ *
+ * Frames that are not addressed to any keypad are dropped by process() without touching the keypads, so the
+ * watchdogs (and the reconnect attempts triggered by them) have to be serviced by calling this function
+ * cyclically from the main loop. Also sends the pending startup frames after begin().
+ */
+void PkpBus::poll() {
+    struct can_frame rxMsg;
+    while (_rxRing != nullptr && _rxRing->pop(rxMsg)) {
+        process(rxMsg);
+    }
+    _serviceStartup();
+    for (uint8_t i = 0; i < _nodeCount; i++) {
+        _nodes[i]->getStatus();
+    }
+}
+
+/**
+ * @brief Routes a received CAN frame to the keypad it originates from.
+ *
+ * The function code and node ID are taken from the 11-bit identifier, the node ID is resolved through a lookup
+ * table, so the cost per frame does not depend on the number of attached keypads.
+ *
+ * @param rxMsg The received CAN frame.
+ * @return True if the frame was consumed by one of the keypads, false otherwise.
+ */
+bool PkpBus::process(const struct can_frame& rxMsg) {
+    if (_recorder != nullptr) {
+        _recorder->record(rxMsg, false);
+    }
+
+    uint8_t slot = rxMsg.can_id > 0x7FF ? NO_SLOT : _getSlot(rxMsg.can_id & 0x7F);
+    if (slot == NO_SLOT) {
+        if (_busLoad != nullptr) {
+            _busLoad->add(rxMsg);
+        }
+        return false;
+    }
+    if (!_nodes[slot]->_dispatch(rxMsg.can_id & 0x780, rxMsg)) {
+        // A function code the keypad does not decode, e.g. an emergency message or a PDO sent to the keypad
+        if (_busLoad != nullptr) {
+            _busLoad->add(rxMsg);
+        }
+        return false;
+    }
+    return true;
+}
+
+//********** PRIVATE METHODS **********
+uint8_t PkpBus::_getSlot(uint8_t nodeId) {
+    return (_nodeSlot[nodeId >> 1] >> ((nodeId & 1) * 4)) & 0x0F;
+}
+
+void PkpBus::_serviceStartup() {
+    uint8_t frames = 0;
+    uint8_t idle   = 0; // keypads in a row that sent nothing
+
+    while (_startupMask != 0 && frames < _startupFrames && idle < _nodeCount) {
+        uint8_t node = _startupNode;
+        _startupNode = (_startupNode + 1) % _nodeCount;
+        if (!(_startupMask & (1u << node))) {
+            idle++;
+            continue;
+        }
+
+        // One frame per keypad and turn, so the configuration of all keypads progresses in parallel
+        switch (_nodes[node]->_serviceStartup()) {
+            case PkpBase::ST_SENT:
+                frames++;
+                idle = 0;
+                break;
+            case PkpBase::ST_DONE:
+                _startupMask &= ~(1u << node);
+                idle++;
+                break;
+            default:
+                idle++;
+                break;
+        }
+    }
+}
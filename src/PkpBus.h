@@ -0,0 +1,58 @@
+/*
+ * Dispatcher for several Blink Marine KeyPads sharing one CAN bus
+ *
+ * Decodes the CANopen function code and node ID of a received frame once and routes
+ * it through a node lookup table to the decoder of the addressed keypad. Keypads of
+ * different models (see PkpModels.h) can share one bus.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_BUS
+#define BLINK_MARINE_CAN_OPEN_BUS
+
+#include "BlinkMarinePkpCanOpen.h"
+
+#ifndef PKP_BUS_MAX_NODES
+#define PKP_BUS_MAX_NODES 8
+#endif
+
+static_assert(PKP_BUS_MAX_NODES > 0 && PKP_BUS_MAX_NODES < 16, "PKP_BUS_MAX_NODES must be within 1 and 15");
+
+class PkpBus {
+  public:
+    // ------ Public Functions ------
+    PkpBus();
+    PkpBase::returnState_e attach(PkpBase& keypad);
+    void                   attachBusLoad(PkpBusLoad* meter);
+    void                   attachRecorder(PkpRecorder* recorder);
+    void                   attachRxRing(PkpRxRing* ring);
+    PkpBase::returnState_e begin(uint8_t framesPerPoll = 2);
+    uint8_t                getNodeCount();
+    uint8_t                getNodeId(uint8_t index);
+    bool                   isNodeReady(uint8_t index);
+    void                   poll();
+    bool                   process(const struct can_frame& rxMsg);
+
+  private:
+    // ------ Private Constants ------
+    static constexpr uint8_t NO_SLOT       = 0x0F;
+    static constexpr uint8_t NODE_ID_COUNT = 128;
+
+    // ------ Private Variables ------
+    PkpBusLoad*  _busLoad                     = nullptr;
+    uint8_t      _nodeCount                   = 0;
+    uint8_t      _nodeSlot[NODE_ID_COUNT / 2] = {}; // one nibble per node ID holding the slot index
+    PkpBase*     _nodes[PKP_BUS_MAX_NODES]    = {};
+    PkpRecorder* _recorder                    = nullptr;
+    PkpRxRing*   _rxRing                      = nullptr;
+    uint8_t      _startupFrames               = 2; // frames per poll() while starting the keypads
+    uint16_t     _startupMask                 = 0; // keypads with startup frames left
+    uint8_t      _startupNode                 = 0; // keypad to continue the round robin with
+
+    // ------ Private Functions ------
+    uint8_t _getSlot(uint8_t nodeId);
+    void    _serviceStartup();
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_BUS
@@ -0,0 +1,196 @@
+#include "PkpBusLoad.h"
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs a bus load meter.
+ *
+ * @param bitrate The bit rate of the CAN bus in bit/s, e.g. 125000.
+ * @param window Milliseconds of the sliding window the load is averaged over, at least PKP_BUS_LOAD_BUCKETS.
+ */
+PkpBusLoad::PkpBusLoad(uint32_t bitrate, uint16_t window)
+    : _bitrate(max(bitrate, (uint32_t)1000)), _bucketStart(millis()), _bucketTime(max(window / PKP_BUS_LOAD_BUCKETS, 1)) {
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Accounts one frame.
+ *
+ * Called by the keypads and the bus the meter is attached to, but may also be called by the application, e.g. for
+ * frames of other nodes if no PkpBus is used. The frame is accounted by the total meter as well.
+ *
+ * @param frame The received or transmitted frame.
+ */
+void PkpBusLoad::add(const struct can_frame& frame) {
+    uint16_t bits = getFrameBits(frame);
+
+    _advance(millis());
+    _bits[_bucket] += bits;
+    _bitsInWindow  += bits;
+    _bitCount      += bits;
+    _frameCount++;
+    _checkBudget();
+
+    if (_total != nullptr) {
+        _total->add(frame);
+    }
+}
+
+/**
+ * @brief Passes all frames accounted by this meter on to a second meter.
+ *
+ * Used to combine per-keypad meters into one for the whole bus. The total meter may be attached to a PkpBus to
+ * account the frames of nodes that are not attached to it as well.
+ *
+ * @param total The meter to pass the frames to, nullptr to stop. It must not be this meter.
+ */
+void PkpBusLoad::attachTotal(PkpBusLoad* total) {
+    _total = total != this ? total : nullptr;
+}
+
+/**
+ * @brief Returns the bits accounted since construction or the last reset().
+ *
+ * @return The sum of the worst-case frame lengths, wraps at 2^32.
+ */
+uint32_t PkpBusLoad::getBitCount() {
+    return _bitCount;
+}
+
+/**
+ * @brief Returns the number of frames accounted since construction or the last reset().
+ *
+ * @return The number of calls to add().
+ */
+uint32_t PkpBusLoad::getFrameCount() {
+    return _frameCount;
+}
+
+/**
+ * @brief Computes the worst-case length of a frame on the bus.
+ *
+ * Includes start of frame, arbitration, control, data, CRC, acknowledge and end of frame fields, the interframe
+ * space and the maximum number of stuff bits (one per four bits from start of frame to the end of the CRC).
+ * Frames with an identifier above 0x7FF are treated as extended frames.
+ *
+ * @param frame The frame.
+ * @return The length in bits, 55 to 135 for standard frames.
+ */
+uint16_t PkpBusLoad::getFrameBits(const struct can_frame& frame) {
+    uint8_t  dlc       = min(frame.can_dlc, (uint8_t)8);
+    bool     extended  = frame.can_id > 0x7FF;
+    uint16_t stuffable = (extended ? 54 : 34) + 8 * dlc;
+    return stuffable + 13 + (stuffable - 1) / 4;
+}
+
+/**
+ * @brief Returns the bus utilization within the sliding window.
+ *
+ * Directly after construction or reset() the load refers to the time elapsed so far.
+ *
+ * @return The utilization in 0.1 % units, e.g. 250 for 25 %. Can exceed 1000 as the frame lengths are upper bounds.
+ */
+uint16_t PkpBusLoad::getLoad() {
+    uint32_t now = millis();
+    _advance(now);
+    return _computeLoad(_bitsInWindow, (_bucketCount - 1) * (uint32_t)_bucketTime + (now - _bucketStart));
+}
+
+/**
+ * @brief Returns the highest utilization of a full window since construction or the last reset().
+ *
+ * The load is sampled whenever a bucket of the window is completed.
+ *
+ * @return The peak utilization in 0.1 % units.
+ */
+uint16_t PkpBusLoad::getPeakLoad() {
+    _advance(millis());
+    return _peakLoad;
+}
+
+/**
+ * @brief Checks whether the budget of this meter or of its total meter is exceeded.
+ *
+ * The keypads the meter is attached to skip periodic LED refreshes and animator frames while this returns true.
+ *
+ * @return True if the bits within the sliding window exceed the budget.
+ */
+bool PkpBusLoad::isOverBudget() {
+    _advance(millis());
+    _checkBudget();
+    return _overBudget || (_total != nullptr && _total->isOverBudget());
+}
+
+/**
+ * @brief Clears the window, the counters and the peak load.
+ */
+void PkpBusLoad::reset() {
+    memset(_bits, 0, sizeof(_bits));
+    _bitCount     = 0;
+    _bitsInWindow = 0;
+    _bucket       = 0;
+    _bucketCount  = 1;
+    _bucketStart  = millis();
+    _frameCount   = 0;
+    _peakLoad     = 0;
+    _checkBudget();
+}
+
+/**
+ * @brief Sets the maximum utilization within the sliding window.
+ *
+ * The budget is checked with every accounted frame against the bits of the last full window, so it is not exceeded
+ * by bursts that are short compared to the window. The callback is invoked from add() or isOverBudget() when the
+ * budget is exceeded and again when the load is back within it.
+ *
+ * @param load The budget in 0.1 % units up to 10000, 0 to disable the budget.
+ * @param callback The function to notify, nullptr for none.
+ */
+void PkpBusLoad::setBudget(uint16_t load, BudgetCallback callback) {
+    // 32 bit only: up to 1 Mbit/s the capacity of a window is below 2^26 bits and the load is limited to 1000 %, so
+    // both products stay below 2^32
+    uint32_t capacity = _bitrate / 1000 * ((uint32_t)_bucketTime * PKP_BUS_LOAD_BUCKETS);
+    uint16_t limited  = min(load, (uint16_t)10000);
+    _budgetBits       = load == 0 ? 0 : max(capacity / 1000 * limited + capacity % 1000 * limited / 1000, (uint32_t)1);
+    _budgetCallback = callback;
+    _checkBudget();
+}
+
+//********** PRIVATE METHODS **********
+void PkpBusLoad::_advance(uint32_t now) {
+    uint32_t elapsed = (now - _bucketStart) / _bucketTime;
+    if (elapsed == 0) {
+        return;
+    }
+
+    // After a full window without any call all buckets are cleared, further rotations would not change anything
+    for (uint32_t i = 0; i < min(elapsed, (uint32_t)PKP_BUS_LOAD_BUCKETS); i++) {
+        // The completed window is sampled before its oldest bucket is dropped
+        if (_bucketCount == PKP_BUS_LOAD_BUCKETS) {
+            _peakLoad = max(_peakLoad, _computeLoad(_bitsInWindow, (uint32_t)_bucketTime * PKP_BUS_LOAD_BUCKETS));
+        }
+        _bucket        = (_bucket + 1) % PKP_BUS_LOAD_BUCKETS;
+        _bitsInWindow  -= _bits[_bucket];
+        _bits[_bucket] = 0;
+        _bucketCount   = min(_bucketCount + 1, PKP_BUS_LOAD_BUCKETS);
+    }
+    _bucketStart += elapsed * _bucketTime;
+}
+
+void PkpBusLoad::_checkBudget() {
+    bool overBudget = _budgetBits > 0 && _bitsInWindow > _budgetBits;
+    if (overBudget == _overBudget) {
+        return;
+    }
+    _overBudget = overBudget;
+    if (_budgetCallback != nullptr) {
+        _budgetCallback(*this, overBudget);
+    }
+}
+
+uint16_t PkpBusLoad::_computeLoad(uint32_t bits, uint32_t span) {
+    uint32_t capacity = _bitrate / 1000 * max(span, (uint32_t)1); // bits per span
+    uint32_t load     = bits <= UINT32_MAX / 1000 ? bits * 1000 / capacity : bits / max(capacity / 1000, (uint32_t)1);
+    return min(load, (uint32_t)UINT16_MAX);
+}
@@ -0,0 +1,66 @@
+/*
+ * Bus load meter for Blink Marine KeyPads
+ *
+ * Accounts the bus time of the frames received and transmitted by one or more Pkp instances
+ * and a PkpBus. Every frame is weighted with its worst-case length including stuff bits and
+ * interframe space, so the reported utilization is an upper bound of the real bus load. The
+ * bits are summed in a sliding window of PKP_BUS_LOAD_BUCKETS buckets. A budget raises a
+ * callback when exceeded and makes the attached keypads skip optional traffic (periodic LED
+ * refreshes and animator frames) until the load is back within the budget.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_BUS_LOAD
+#define BLINK_MARINE_CAN_OPEN_BUS_LOAD
+
+#include "BlinkMarinePkpCanOpen.h"
+
+#ifndef PKP_BUS_LOAD_BUCKETS
+#define PKP_BUS_LOAD_BUCKETS 10
+#endif
+
+static_assert(PKP_BUS_LOAD_BUCKETS >= 2 && PKP_BUS_LOAD_BUCKETS <= 64, "PKP_BUS_LOAD_BUCKETS must be between 2 and 64");
+
+class PkpBusLoad {
+  public:
+    // ------ Public Types ------
+    typedef void (*BudgetCallback)(PkpBusLoad& meter, bool exceeded);
+
+    // ------ Public Functions ------
+    PkpBusLoad(uint32_t bitrate = 250000, uint16_t window = 1000);
+    void            add(const struct can_frame& frame);
+    void            attachTotal(PkpBusLoad* total);
+    uint32_t        getBitCount();
+    uint32_t        getFrameCount();
+    static uint16_t getFrameBits(const struct can_frame& frame);
+    uint16_t        getLoad();
+    uint16_t        getPeakLoad();
+    bool            isOverBudget();
+    void            reset();
+    void            setBudget(uint16_t load, BudgetCallback callback = nullptr);
+
+  private:
+    // ------ Private Variables ------
+    uint32_t       _bitCount                     = 0; // since construction or reset()
+    uint32_t       _bitrate;
+    uint32_t       _bits[PKP_BUS_LOAD_BUCKETS]   = {};
+    uint32_t       _bitsInWindow                 = 0;
+    uint32_t       _budgetBits                   = 0; // bits per window the budget allows, 0 for no budget
+    BudgetCallback _budgetCallback               = nullptr;
+    uint8_t        _bucket                       = 0; // bucket the current frames are added to
+    uint8_t        _bucketCount                  = 1; // buckets since reset(), up to PKP_BUS_LOAD_BUCKETS
+    uint32_t       _bucketStart;                      // millis() when the current bucket started
+    uint16_t       _bucketTime;                       // milliseconds per bucket
+    uint32_t       _frameCount                   = 0;
+    bool           _overBudget                   = false;
+    uint16_t       _peakLoad                     = 0;
+    PkpBusLoad*    _total                        = nullptr;
+
+    // ------ Private Functions ------
+    void     _advance(uint32_t now);
+    void     _checkBudget();
+    uint16_t _computeLoad(uint32_t bits, uint32_t span);
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_BUS_LOAD
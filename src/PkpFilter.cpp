@@ -0,0 +1,330 @@
+
+#include "PkpFilter.h"
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs an empty filter set, which accepts no keypad frames.
+ */
+PkpFilter::PkpFilter() {
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Checks whether a standard frame passes MCP2515 filters.
+ *
+ * @param filters The filters as computed by getMcp2515Filters().
+ * @param canId The 11-bit identifier of the frame.
+ * @return True if the frame is received.
+ */
+bool PkpFilter::accepts(const mcp2515Filters_t& filters, uint16_t canId) {
+    for (uint8_t i = 0; i < MCP2515_FILTERS0 + MCP2515_FILTERS1; i++) {
+        uint16_t mask = filters.mask[i < MCP2515_FILTERS0 ? 0 : 1];
+        if (((canId ^ filters.filter[i]) & mask) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks whether a standard frame passes SAME5x standard message ID filter elements.
+ *
+ * @param elements The filter elements as computed by getSame5xFilters().
+ * @param count The number of filter elements.
+ * @param canId The 11-bit identifier of the frame.
+ * @return True if the frame is received.
+ */
+bool PkpFilter::acceptsSame5x(const uint32_t elements[], uint8_t count, uint16_t canId) {
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t id1  = (elements[i] >> 16) & ID_MASK;
+        uint16_t id2  = elements[i] & ID_MASK;
+        uint32_t type = elements[i] & (3uL << 30);
+        if ((type == SAME5X_DUAL && (canId == id1 || canId == id2)) || (type == SAME5X_CLASSIC && ((canId ^ id1) & id2) == 0)
+            || (type == 0 && canId >= id1 && canId <= id2)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Adds the frames of all keypads attached to a bus.
+ *
+ * All receive functions are added, use addNode() to leave out the encoder and wired input PDOs of models without them.
+ *
+ * @param bus The bus whose keypads are added.
+ * @return True on success, false if MAX_IDS is exceeded.
+ */
+bool PkpFilter::addBus(PkpBus& bus) {
+    for (uint8_t i = 0; i < bus.getNodeCount(); i++) {
+        if (!addNode(bus.getNodeId(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Adds the frames sent by one keypad.
+ *
+ * @param nodeId The CAN node ID of the keypad (1 to 127).
+ * @param functions The frames to receive as a combination of rxFunction_e.
+ * @return True on success, false for an invalid node ID or if MAX_IDS is exceeded.
+ */
+bool PkpFilter::addNode(uint8_t nodeId, uint8_t functions) {
+    static const uint16_t BASE_IDS[] = {0x180, 0x280, 0x380, 0x480, 0x580, 0x700};
+
+    if (!inLimits(nodeId, 1, 127)) {
+        return false;
+    }
+    for (uint8_t f = 0; f < sizeof(BASE_IDS) / sizeof(BASE_IDS[0]); f++) {
+        uint16_t id      = BASE_IDS[f] + nodeId;
+        bool     present = false;
+        for (uint8_t i = 0; i < _idCount; i++) {
+            present |= _ids[i] == id;
+        }
+        if (!checkBit(functions, f) || present) {
+            continue;
+        }
+        if (_idCount >= MAX_IDS) {
+            return false;
+        }
+        _ids[_idCount++] = id;
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the number of identifiers to receive.
+ *
+ * @return The number of distinct COB-IDs added.
+ */
+uint8_t PkpFilter::getIdCount() {
+    return _idCount;
+}
+
+/**
+ * @brief Computes the mask and filter registers of an MCP2515.
+ *
+ * Receive buffer 0 has one mask and two filters, receive buffer 1 one mask and four filters. All added identifiers
+ * are accepted, unused filters repeat a used one. The filters match standard frames only (EXIDE cleared).
+ *
+ * @param filters Receives the register values and the number of accepted identifiers.
+ */
+void PkpFilter::getMcp2515Filters(mcp2515Filters_t& filters) {
+    filters.mask[0] = ID_MASK;
+    filters.mask[1] = ID_MASK;
+    memset(filters.filter, 0, sizeof(filters.filter));
+    if (_idCount == 0) {
+        filters.acceptedIds = _countAccepted(filters);
+        return;
+    }
+
+    // Groups of identifiers sharing their bits under one common mask, which are then split between both buffers
+    uint16_t classes[MCP2515_FILTERS0 + MCP2515_FILTERS1];
+    uint16_t sharedMask = _findMask(_ids, _idCount, MCP2515_FILTERS0 + MCP2515_FILTERS1);
+    uint8_t  classCount = _countClasses(_ids, _idCount, sharedMask, classes);
+
+    mcp2515Filters_t candidate;
+    filters.acceptedIds = ID_MASK + 1;
+    for (uint8_t split = 0; split < (1 << classCount); split++) {
+        uint8_t buffer0Classes = 0;
+        for (uint8_t c = 0; c < classCount; c++) {
+            buffer0Classes += checkBit(split, c);
+        }
+        if (buffer0Classes > MCP2515_FILTERS0 || classCount - buffer0Classes > MCP2515_FILTERS1) {
+            continue;
+        }
+
+        // Identifiers of buffer 0 first, followed by those of buffer 1
+        uint16_t ids[MAX_IDS];
+        uint8_t  count0 = 0;
+        uint8_t  count1 = 0;
+        for (uint8_t pass = 0; pass < 2; pass++) {
+            for (uint8_t i = 0; i < _idCount; i++) {
+                bool inBuffer0 = false;
+                for (uint8_t c = 0; c < classCount; c++) {
+                    inBuffer0 |= checkBit(split, c) && (_ids[i] & sharedMask) == classes[c];
+                }
+                if (inBuffer0 != (pass == 0)) {
+                    continue;
+                }
+                ids[count0 + count1] = _ids[i];
+                if (pass == 0) {
+                    count0++;
+                } else {
+                    count1++;
+                }
+            }
+        }
+        const uint16_t* ids0 = ids;
+        const uint16_t* ids1 = &ids[count0];
+
+        // Each buffer gets the tightest mask for its own groups, the shared mask is the fallback
+        for (uint8_t refine = 0; refine < 2; refine++) {
+            candidate.mask[0] = (count0 == 0) ? ID_MASK : (refine ? _findMask(ids0, count0, MCP2515_FILTERS0) : sharedMask);
+            candidate.mask[1] = (count1 == 0) ? ID_MASK : (refine ? _findMask(ids1, count1, MCP2515_FILTERS1) : sharedMask);
+            _fillBuffer(count0 ? ids0 : ids1, count0 ? count0 : 1, candidate.mask[0], candidate.filter, MCP2515_FILTERS0);
+            _fillBuffer(count1 ? ids1 : ids0, count1 ? count1 : 1, candidate.mask[1], &candidate.filter[MCP2515_FILTERS0], MCP2515_FILTERS1);
+            candidate.acceptedIds = _countAccepted(candidate);
+            if (candidate.acceptedIds < filters.acceptedIds) {
+                filters = candidate;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes standard message ID filter elements of the SAME5x CAN peripheral.
+ *
+ * If the capacity allows, every identifier gets an exact match (two per dual ID element). Otherwise, classic
+ * filter elements with a common mask are used. All elements store matching frames in Rx FIFO 0, the global filter
+ * has to reject non-matching frames (GFC.ANFS).
+ *
+ * @param elements Receives the 32-bit filter elements.
+ * @param capacity The number of elements available, at least 1.
+ * @param acceptedIds Receives the number of standard identifiers passing the filters.
+ * @return The number of elements used.
+ */
+uint8_t PkpFilter::getSame5xFilters(uint32_t elements[], uint8_t capacity, uint16_t& acceptedIds) {
+    acceptedIds = 0;
+    if (_idCount == 0 || capacity == 0) {
+        return 0;
+    }
+
+    uint8_t count = 0;
+    if (_idCount <= 2 * capacity) {
+        for (uint8_t i = 0; i < _idCount; i += 2) {
+            uint16_t second   = _ids[min(i + 1, _idCount - 1)];
+            elements[count++] = SAME5X_DUAL | SAME5X_FIFO0 | ((uint32_t)_ids[i] << 16) | second;
+        }
+        acceptedIds = _idCount;
+        return count;
+    }
+
+    uint16_t classes[MAX_IDS];
+    uint16_t mask = _findMask(_ids, _idCount, capacity);
+    count         = _countClasses(_ids, _idCount, mask, classes);
+    for (uint8_t c = 0; c < count; c++) {
+        elements[c] = SAME5X_CLASSIC | SAME5X_FIFO0 | ((uint32_t)classes[c] << 16) | mask;
+    }
+    acceptedIds = count << (11 - _countBits(mask));
+    return count;
+}
+
+//********** PRIVATE METHODS **********
+uint16_t PkpFilter::_countAccepted(const mcp2515Filters_t& filters) {
+    // Filters of one buffer match the same identifiers or none in common, each matches 2^(unmasked bits) of them.
+    // Two filters of different buffers share 2^(bits unmasked by either mask) identifiers if they agree on the others.
+    uint16_t distinct[MCP2515_FILTERS0 + MCP2515_FILTERS1];
+    uint8_t  distinctCount[2] = {0, 0};
+    for (uint8_t i = 0; i < MCP2515_FILTERS0 + MCP2515_FILTERS1; i++) {
+        uint8_t  buffer = i < MCP2515_FILTERS0 ? 0 : 1;
+        uint16_t value  = filters.filter[i] & filters.mask[buffer];
+        uint8_t  first  = buffer == 0 ? 0 : MCP2515_FILTERS0;
+        bool     known  = false;
+        for (uint8_t j = first; j < first + distinctCount[buffer] && !known; j++) {
+            known = distinct[j] == value;
+        }
+        if (!known) {
+            distinct[first + distinctCount[buffer]++] = value;
+        }
+    }
+
+    uint16_t bothMask = filters.mask[0] & filters.mask[1];
+    uint16_t shared   = 1 << (11 - _countBits(filters.mask[0] | filters.mask[1]));
+    uint16_t accepted = (distinctCount[0] << (11 - _countBits(filters.mask[0]))) + (distinctCount[1] << (11 - _countBits(filters.mask[1])));
+    for (uint8_t i = 0; i < distinctCount[0]; i++) {
+        for (uint8_t j = 0; j < distinctCount[1]; j++) {
+            if (((distinct[i] ^ distinct[MCP2515_FILTERS0 + j]) & bothMask) == 0) {
+                accepted -= shared;
+            }
+        }
+    }
+    return accepted;
+}
+
+uint8_t PkpFilter::_countBits(uint16_t value) {
+    uint8_t count = 0;
+    for (; value != 0; value &= value - 1) {
+        count++;
+    }
+    return count;
+}
+
+uint8_t PkpFilter::_countClasses(const uint16_t ids[], uint8_t count, uint16_t mask, uint16_t classes[]) {
+    uint8_t classCount = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        bool known = false;
+        for (uint8_t j = 0; j < i && !known; j++) {
+            known = ((ids[i] ^ ids[j]) & mask) == 0;
+        }
+        if (!known) {
+            if (classes != nullptr) {
+                classes[classCount] = ids[i] & mask;
+            }
+            classCount++;
+        }
+    }
+    return classCount;
+}
+
+void PkpFilter::_fillBuffer(const uint16_t ids[], uint8_t count, uint16_t mask, uint16_t filters[], uint8_t filterCount) {
+    // The groups under the mask fit into the filters, unused filters repeat the last group
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < count && used < filterCount; i++) {
+        bool known = false;
+        for (uint8_t j = 0; j < used && !known; j++) {
+            known = filters[j] == (ids[i] & mask);
+        }
+        if (!known) {
+            filters[used++] = ids[i] & mask;
+        }
+    }
+    for (uint8_t i = used; i < filterCount; i++) {
+        filters[i] = filters[used - 1];
+    }
+}
+
+uint16_t PkpFilter::_findMask(const uint16_t ids[], uint8_t count, uint8_t maxClasses) {
+    // Clear the identifier bit merging the most groups until the groups fit into the filters. Clearing a bit merges
+    // the pairs of groups differing in this bit only, so one comparison of all groups rates every bit.
+    uint16_t mask = ID_MASK;
+    for (;;) {
+        uint8_t first[(MAX_IDS + 7) / 8] = {}; // identifiers opening a group
+        uint8_t classCount               = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            bool known = false;
+            for (uint8_t j = 0; j < i && !known; j++) {
+                known = checkBit(first[j / 8], j % 8) && ((ids[i] ^ ids[j]) & mask) == 0;
+            }
+            if (!known) {
+                first[i / 8] |= 1 << (i % 8);
+                classCount++;
+            }
+        }
+        if (classCount <= maxClasses) {
+            return mask;
+        }
+
+        uint8_t merges[11] = {};
+        for (uint8_t i = 0; i < count; i++) {
+            for (uint8_t j = i + 1; j < count && checkBit(first[i / 8], i % 8); j++) {
+                uint16_t difference = (ids[i] ^ ids[j]) & mask;
+                if (checkBit(first[j / 8], j % 8) && (difference & (difference - 1)) == 0) {
+                    merges[_countBits(difference - 1)]++;
+                }
+            }
+        }
+
+        uint8_t bestBit = 0xFF;
+        for (uint8_t bit = 0; bit < 11; bit++) {
+            if (checkBit(mask, bit) && (bestBit == 0xFF || merges[bit] > merges[bestBit])) {
+                bestBit = bit;
+            }
+        }
+        mask &= ~(1 << bestBit);
+    }
+}
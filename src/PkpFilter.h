@@ -0,0 +1,80 @@
+/*
+ * Acceptance filter generator for Blink Marine KeyPads
+ *
+ * Computes the acceptance filter registers of the CAN controller from the node IDs of the
+ * keypads in use, so foreign frames are dropped by the hardware instead of costing an
+ * interrupt, a readout and a call of process() each. Supported are the MCP2515 (2 masks,
+ * 6 filters) and the standard message ID filter elements of the SAME5x CAN peripheral.
+ *
+ * The MCP2515 cannot express every set of COB-IDs exactly. The masks are found by a greedy
+ * search, which combines the COB-IDs into as few groups as there are filters while keeping as
+ * many identifier bits as possible. The number of accepted identifiers is reported, the
+ * share of real traffic passing the filters can be checked with accepts().
+ *
+ * Meant to be run once during setup(). The search compares the identifiers pairwise, about 3000
+ * comparisons for two keypads and 100000 for eight with all functions. On a 16 MHz AVR this takes
+ * a few milliseconds for two keypads and up to some 200 ms for eight.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_FILTER
+#define BLINK_MARINE_CAN_OPEN_FILTER
+
+#include "BlinkMarinePkpCanOpen.h"
+#include "PkpBus.h"
+
+class PkpFilter {
+  public:
+    // ------ Public Type Definitions ------
+    enum rxFunction_e : uint8_t {
+        FN_KEYS      = 0x01,
+        FN_ENCODER_1 = 0x02,
+        FN_ENCODER_2 = 0x04,
+        FN_WIRED_IN  = 0x08,
+        FN_SDO       = 0x10,
+        FN_HEARTBEAT = 0x20,
+        FN_ALL       = 0x3F
+    };
+
+    struct mcp2515Filters_t {
+        uint16_t mask[2];     // RXM0 (receive buffer 0), RXM1 (receive buffer 1), standard identifier bits
+        uint16_t filter[6];   // RXF0, RXF1 (receive buffer 0), RXF2 to RXF5 (receive buffer 1), standard frames only
+        uint16_t acceptedIds; // number of standard identifiers passing the filters
+    };
+
+    // ------ Public Constants ------
+    static constexpr uint8_t MAX_IDS = PKP_BUS_MAX_NODES * 6;
+
+    // ------ Public Functions ------
+    PkpFilter();
+    static bool accepts(const mcp2515Filters_t& filters, uint16_t canId);
+    static bool acceptsSame5x(const uint32_t elements[], uint8_t count, uint16_t canId);
+    bool        addBus(PkpBus& bus);
+    bool        addNode(uint8_t nodeId, uint8_t functions = FN_ALL);
+    uint8_t     getIdCount();
+    void        getMcp2515Filters(mcp2515Filters_t& filters);
+    uint8_t     getSame5xFilters(uint32_t elements[], uint8_t capacity, uint16_t& acceptedIds);
+
+  private:
+    // ------ Private Constants ------
+    static constexpr uint16_t ID_MASK          = 0x7FF;
+    static constexpr uint8_t  MCP2515_FILTERS0 = 2;
+    static constexpr uint8_t  MCP2515_FILTERS1 = 4;
+    static constexpr uint32_t SAME5X_CLASSIC   = 2uL << 30;
+    static constexpr uint32_t SAME5X_DUAL      = 1uL << 30;
+    static constexpr uint32_t SAME5X_FIFO0     = 1uL << 27;
+
+    // ------ Private Variables ------
+    uint8_t  _idCount = 0;
+    uint16_t _ids[MAX_IDS];
+
+    // ------ Private Functions ------
+    static uint16_t _countAccepted(const mcp2515Filters_t& filters);
+    static uint8_t  _countBits(uint16_t value);
+    static uint8_t  _countClasses(const uint16_t ids[], uint8_t count, uint16_t mask, uint16_t classes[] = nullptr);
+    static void     _fillBuffer(const uint16_t ids[], uint8_t count, uint16_t mask, uint16_t filters[], uint8_t filterCount);
+    static uint16_t _findMask(const uint16_t ids[], uint8_t count, uint8_t maxClasses);
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_FILTER
@@ -0,0 +1,56 @@
+/*
+ * Model traits for Blink Marine KeyPads
+ *
+ * Each supported keypad model is described by a traits struct, which is passed as template
+ * argument to PkpKeypad. The counts size the state of a keypad instance exactly and compile
+ * out the decoders of inputs a model does not have.
+ *
+ * All models use the CANopen predefined connection set: keys on TPDO1 (0x180), encoders on
+ * TPDO2/3 (0x280/0x380), wired inputs on TPDO4 (0x480), key LEDs on RPDO1/2 (0x200/0x300).
+ * The key LED PDOs hold one bitmask per color (red, green, blue) with KEY_LED_BYTES bytes each.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_MODELS
+#define BLINK_MARINE_CAN_OPEN_MODELS
+
+#include <Arduino.h>
+
+struct Pkp2200Si {
+    static constexpr uint8_t KEY_AMOUNT      = 4;
+    static constexpr uint8_t ENCODER_AMOUNT  = 0;
+    static constexpr uint8_t WIRED_IN_AMOUNT = 0;
+};
+
+struct Pkp2300Si {
+    static constexpr uint8_t KEY_AMOUNT      = 6;
+    static constexpr uint8_t ENCODER_AMOUNT  = 0;
+    static constexpr uint8_t WIRED_IN_AMOUNT = 0;
+};
+
+struct Pkp2400Si {
+    static constexpr uint8_t KEY_AMOUNT      = 8;
+    static constexpr uint8_t ENCODER_AMOUNT  = 0;
+    static constexpr uint8_t WIRED_IN_AMOUNT = 0;
+};
+
+struct Pkp2500Si {
+    static constexpr uint8_t KEY_AMOUNT      = 10;
+    static constexpr uint8_t ENCODER_AMOUNT  = 0;
+    static constexpr uint8_t WIRED_IN_AMOUNT = 0;
+};
+
+struct Pkp2600Si {
+    static constexpr uint8_t KEY_AMOUNT      = 12;
+    static constexpr uint8_t ENCODER_AMOUNT  = 0;
+    static constexpr uint8_t WIRED_IN_AMOUNT = 0;
+};
+
+struct Pkp3500SiMt {
+    static constexpr uint8_t KEY_AMOUNT      = 15;
+    static constexpr uint8_t ENCODER_AMOUNT  = 2;
+    static constexpr uint8_t WIRED_IN_AMOUNT = 4;
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_MODELS
@@ -0,0 +1,106 @@
+
+#include "PkpRecorder.h"
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs a frame recorder.
+ *
+ * @param output The stream the log is written to. It must outlive the recorder.
+ * @param format The log format, RF_CANDUMP for candump -l compatible text or RF_BINARY for 16 byte records.
+ */
+PkpRecorder::PkpRecorder(Print& output, recordFormat_e format) : _format(format), _lastMicros(micros()), _output(output) {
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Returns the number of frames logged so far.
+ *
+ * @return The number of calls to record().
+ */
+uint32_t PkpRecorder::getRecordCount() {
+    return _recordCount;
+}
+
+/**
+ * @brief Logs one frame.
+ *
+ * Called by the keypads and the bus the recorder is attached to, but may also be called by the application,
+ * e.g. to log frames of other nodes. The candump timestamp counts seconds since construction of the recorder and
+ * does not wrap with micros(), as long as at least one frame is logged every 71 minutes.
+ *
+ * @param frame The frame to log.
+ * @param transmitted True for frames sent to the keypad, false for received frames.
+ */
+void PkpRecorder::record(const struct can_frame& frame, bool transmitted) {
+    uint32_t now  = micros();
+    _microseconds += now - _lastMicros;
+    _lastMicros   = now;
+    while (_microseconds >= 1000000uL) {
+        _microseconds -= 1000000uL;
+        _seconds++;
+    }
+
+    if (_format == RF_BINARY) {
+        _writeBinary(frame, transmitted, now);
+    } else {
+        _writeCandump(frame, transmitted);
+    }
+    _recordCount++;
+}
+
+//********** PRIVATE METHODS **********
+void PkpRecorder::_writeBinary(const struct can_frame& frame, bool transmitted, uint32_t timestamp) {
+    uint8_t  record[BINARY_RECORD_SIZE] = {};
+    uint16_t id                         = (frame.can_id & 0x7FF) | (transmitted ? BINARY_TX_FLAG : 0);
+    uint8_t  dlc                        = min(frame.can_dlc, (uint8_t)8);
+
+    for (uint8_t i = 0; i < 4; i++) {
+        record[i] = (timestamp >> (8 * i)) & 0xFF;
+    }
+    record[4] = id & 0xFF;
+    record[5] = id >> 8;
+    record[6] = dlc;
+    memcpy(&record[8], frame.data, dlc);
+    _output.write(record, sizeof(record));
+}
+
+void PkpRecorder::_writeCandump(const struct can_frame& frame, bool transmitted) {
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+    uint8_t line[CANDUMP_LINE_MAX];
+    uint8_t pos = 0;
+
+    // "(ssssssssss.uuuuuu) " with zero padded seconds and microseconds like candump
+    line[pos++]    = '(';
+    uint32_t value = _seconds;
+    for (int8_t i = 9; i >= 0; i--) {
+        line[pos + i] = '0' + value % 10;
+        value /= 10;
+    }
+    pos += 10;
+    line[pos++] = '.';
+    value       = _microseconds;
+    for (int8_t i = 5; i >= 0; i--) {
+        line[pos + i] = '0' + value % 10;
+        value /= 10;
+    }
+    pos += 6;
+    line[pos++] = ')';
+    line[pos++] = ' ';
+    line[pos++] = transmitted ? 't' : 'r';
+    line[pos++] = 'x';
+    line[pos++] = ' ';
+
+    line[pos++] = HEX_DIGITS[(frame.can_id >> 8) & 0x07];
+    line[pos++] = HEX_DIGITS[(frame.can_id >> 4) & 0x0F];
+    line[pos++] = HEX_DIGITS[frame.can_id & 0x0F];
+    line[pos++] = '#';
+    for (uint8_t i = 0; i < min(frame.can_dlc, (uint8_t)8); i++) {
+        line[pos++] = HEX_DIGITS[frame.data[i] >> 4];
+        line[pos++] = HEX_DIGITS[frame.data[i] & 0x0F];
+    }
+    line[pos++] = '\n';
+    _output.write(line, pos);
+}
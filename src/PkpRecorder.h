@@ -0,0 +1,59 @@
+/*
+ * Frame recorder for Blink Marine KeyPads
+ *
+ * Logs the frames received and transmitted by one or more Pkp instances together with a
+ * timestamp to any Arduino Print (Serial, an SD card file, ...). Two formats are supported:
+ *
+ * - RF_CANDUMP: text lines as written by the Linux candump tool with option -l, e.g.
+ *   "(0000000012.345678) rx 195#0100000000000000". Received frames are logged on interface
+ *   "rx", transmitted frames on interface "tx", so the log can be fed to canplayer with
+ *   an interface mapping such as "can0=tx".
+ * - RF_BINARY: fixed BINARY_RECORD_SIZE byte records, little endian:
+ *   [0..3] timestamp in microseconds (micros()), [4..5] 11-bit CAN ID with BINARY_TX_FLAG
+ *   set for transmitted frames, [6] DLC, [7] reserved (0), [8..15] data padded with zeros.
+ *
+ * Both formats are read by the replay tool in extras/replay.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_RECORDER
+#define BLINK_MARINE_CAN_OPEN_RECORDER
+
+#include "BlinkMarinePkpCanOpen.h"
+
+class PkpRecorder {
+  public:
+    // ------ Public Types ------
+    enum recordFormat_e : uint8_t {
+        RF_CANDUMP = 0,
+        RF_BINARY  = 1,
+    };
+
+    // ------ Public Constants ------
+    static constexpr uint8_t  BINARY_RECORD_SIZE = 16;
+    static constexpr uint16_t BINARY_TX_FLAG     = 0x8000;
+
+    // ------ Public Functions ------
+    PkpRecorder(Print& output, recordFormat_e format = RF_CANDUMP);
+    uint32_t getRecordCount();
+    void     record(const struct can_frame& frame, bool transmitted);
+
+  private:
+    // ------ Private Constants ------
+    static constexpr uint8_t CANDUMP_LINE_MAX = 44;
+
+    // ------ Private Variables ------
+    recordFormat_e _format;
+    uint32_t       _lastMicros   = 0;
+    uint32_t       _microseconds = 0;
+    Print&         _output;
+    uint32_t       _recordCount  = 0;
+    uint32_t       _seconds      = 0;
+
+    // ------ Private Functions ------
+    void _writeBinary(const struct can_frame& frame, bool transmitted, uint32_t timestamp);
+    void _writeCandump(const struct can_frame& frame, bool transmitted);
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_RECORDER
@@ -0,0 +1,53 @@
+
+#include "PkpRxRing.h"
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Returns the number of frames dropped because the ring was full.
+ *
+ * @return The number of dropped frames (wraps around at 255).
+ */
+uint8_t PkpRxRing::getOverflowCount() {
+    return __atomic_load_n(&_overflowCount, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Removes the oldest frame from the ring.
+ *
+ * Must only be called from a single consumer context, usually the main loop.
+ *
+ * @param rxMsg Receives the frame.
+ * @return True if a frame was available, false if the ring is empty.
+ */
+bool PkpRxRing::pop(struct can_frame& rxMsg) {
+    uint8_t tail = _tail;
+    if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    rxMsg = _frames[tail & INDEX_MASK];
+    __atomic_store_n(&_tail, (uint8_t)(tail + 1), __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Appends a frame to the ring.
+ *
+ * Must only be called from a single producer context, usually the CAN receive interrupt. The function does not
+ * block and only copies the frame.
+ *
+ * @param rxMsg The received frame.
+ * @return True if the frame was stored, false if the ring is full and the frame was dropped.
+ */
+bool PkpRxRing::push(const struct can_frame& rxMsg) {
+    uint8_t head = _head;
+    if ((uint8_t)(head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE)) >= PKP_RX_RING_SIZE) {
+        __atomic_store_n(&_overflowCount, (uint8_t)(_overflowCount + 1), __ATOMIC_RELAXED);
+        return false;
+    }
+
+    _frames[head & INDEX_MASK] = rxMsg;
+    __atomic_store_n(&_head, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+    return true;
+}
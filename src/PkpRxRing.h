@@ -0,0 +1,39 @@
+/*
+ * Interrupt safe receive ring for Blink Marine KeyPads
+ *
+ * Single-producer/single-consumer lock-free frame buffer. The CAN receive interrupt pushes
+ * frames, the main loop pops and decodes them via Pkp::poll() or PkpBus::poll().
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_RX_RING
+#define BLINK_MARINE_CAN_OPEN_RX_RING
+
+#include "BlinkMarinePkpCanOpen.h"
+
+#ifndef PKP_RX_RING_SIZE
+#define PKP_RX_RING_SIZE 16
+#endif
+
+static_assert((PKP_RX_RING_SIZE & (PKP_RX_RING_SIZE - 1)) == 0 && PKP_RX_RING_SIZE <= 128, "PKP_RX_RING_SIZE must be a power of two up to 128");
+
+class PkpRxRing {
+  public:
+    // ------ Public Functions ------
+    uint8_t getOverflowCount();
+    bool    pop(struct can_frame& rxMsg);
+    bool    push(const struct can_frame& rxMsg);
+
+  private:
+    // ------ Private Constants ------
+    static constexpr uint8_t INDEX_MASK = PKP_RX_RING_SIZE - 1;
+
+    // ------ Private Variables ------
+    struct can_frame _frames[PKP_RX_RING_SIZE];
+    uint8_t          _head          = 0; // written by the producer only
+    uint8_t          _overflowCount = 0; // written by the producer only
+    uint8_t          _tail          = 0; // written by the consumer only
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_RX_RING
@@ -0,0 +1,152 @@
+
+#include "PkpTxQueue.h"
+#include "PkpBusLoad.h"
+
+//********** CONSTRUCTOR **********
+
+/**
+ * @brief Constructs a transmit queue.
+ *
+ * @param callback The function to call for transmitting messages over the CAN bus. It has to return 0 if the
+ *                 frame was accepted by the CAN controller, the frame stays queued otherwise.
+ * @param framesPerMs Maximum number of frames transmitted per millisecond, 0 for no limit.
+ */
+PkpTxQueue::PkpTxQueue(CanMsgTxCallback callback, uint8_t framesPerMs)
+    : _budget(framesPerMs), _tokens(framesPerMs), _transmitMessage(callback) {
+}
+
+//********** PUBLIC METHODS **********
+
+/**
+ * @brief Accounts the bus time of the frames leaving the queue.
+ *
+ * Frames are accounted when the transmit callback accepted them, so frames replaced by a newer payload while queued
+ * are not. Keypads with a transmit queue leave the accounting of their transmitted frames to this meter.
+ *
+ * @param meter The meter to use, nullptr to stop accounting.
+ */
+void PkpTxQueue::attachBusLoad(PkpBusLoad* meter) {
+    _busLoad = meter;
+}
+
+/**
+ * @brief Returns the number of frames waiting for transmission.
+ *
+ * @return The number of queued frames.
+ */
+uint8_t PkpTxQueue::getPending() {
+    return _count;
+}
+
+/**
+ * @brief Transmits queued frames.
+ *
+ * Frames are handed to the transmit callback until the queue is empty, the budget is used up or the callback
+ * reports an error, e.g. because all transmit buffers of the CAN controller are occupied. The frames of one node
+ * are sent in order of arrival, e.g. an encoder LED PDO queued after the SDO writing the blinking LEDs follows it.
+ * Among the oldest frames of the nodes, the one with the lowest COB-ID is sent first (CANopen priority order). To
+ * use the full budget, this function has to be called at least once per millisecond.
+ *
+ * @return The number of frames transmitted.
+ */
+uint8_t PkpTxQueue::poll() {
+    if (_transmitMessage == nullptr) {
+        return 0;
+    }
+
+    // The budget refers to one millisecond, so unused tokens do not accumulate beyond that
+    uint32_t now = millis();
+    if (_budget > 0 && now != _lastRefill) {
+        _tokens     = _budget;
+        _lastRefill = now;
+    }
+
+    uint8_t sent = 0;
+    while (_count > 0 && (_budget == 0 || _tokens > 0)) {
+        // Only the oldest frame of each node competes, one bit per node ID
+        uint32_t queuedNodes[4] = {0};
+        uint8_t  next           = 0;
+        for (uint8_t i = 0; i < _count; i++) {
+            uint8_t node = _getNode(_frames[i]);
+            if (checkBit(queuedNodes[node >> 5], node & 0x1F)) {
+                continue;
+            }
+            queuedNodes[node >> 5] |= 1uL << (node & 0x1F);
+            if (_frames[i].can_id < _frames[next].can_id) {
+                next = i;
+            }
+        }
+
+        if (0 != _transmitMessage(_frames[next])) {
+            break;
+        }
+        if (_busLoad != nullptr) {
+            _busLoad->add(_frames[next]);
+        }
+
+        _count--;
+        memmove(&_frames[next], &_frames[next + 1], (_count - next) * sizeof(_frames[0]));
+        sent++;
+        if (_budget > 0) {
+            _tokens--;
+        }
+    }
+    return sent;
+}
+
+/**
+ * @brief Queues a frame for transmission.
+ *
+ * A queued frame addressing the same target (same COB-ID, for SDO requests also the same object index and
+ * sub-index, for NMT commands the same node) is replaced by the new frame, so only the latest state is sent. The
+ * replacing frame is queued behind the other frames of its node, as it is the newest one.
+ *
+ * @param txMsg The frame to transmit.
+ * @return True if the frame was queued, false if the queue is full.
+ */
+bool PkpTxQueue::push(const struct can_frame& txMsg) {
+    for (uint8_t i = 0; i < _count; i++) {
+        if (_isSameTarget(_frames[i], txMsg)) {
+            _count--;
+            memmove(&_frames[i], &_frames[i + 1], (_count - i) * sizeof(_frames[0]));
+            break;
+        }
+    }
+
+    if (_count >= PKP_TX_QUEUE_SIZE) {
+        return false;
+    }
+    _frames[_count++] = txMsg;
+    return true;
+}
+
+/**
+ * @brief Sets the transmission budget.
+ *
+ * @param framesPerMs Maximum number of frames transmitted per millisecond, 0 for no limit.
+ */
+void PkpTxQueue::setBudget(uint8_t framesPerMs) {
+    _budget = framesPerMs;
+    _tokens = min(_tokens, _budget);
+}
+
+//********** PRIVATE METHODS **********
+uint8_t PkpTxQueue::_getNode(const struct can_frame& frame) {
+    // NMT commands are addressed by data[1], 0 for all nodes
+    return frame.can_id == 0x00 ? frame.data[1] & 0x7F : frame.can_id & 0x7F;
+}
+
+bool PkpTxQueue::_isSameTarget(const struct can_frame& a, const struct can_frame& b) {
+    if (a.can_id != b.can_id) {
+        return false;
+    }
+    if (a.can_id == 0x00) {
+        // NMT command, data[1] holds the addressed node
+        return a.data[1] == b.data[1];
+    }
+    if ((a.can_id & ~0x7FuL) == CAN_TX_BASE_ID_SDO) {
+        // SDO request, same command specifier class, object index and sub-index
+        return (a.data[0] & 0xE0) == (b.data[0] & 0xE0) && 0 == memcmp(&a.data[1], &b.data[1], 3);
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+/*
+ * Transmit queue for Blink Marine KeyPads
+ *
+ * Decouples the frame generation of one or more Pkp instances from the CAN controller.
+ * Queued frames to the same target are replaced by newer payloads. The frames of one node are
+ * sent in order of arrival, between nodes in CANopen priority order (lowest COB-ID first), and
+ * limited to a frames per millisecond budget.
+ *
+ * spell-checker: enableCompoundWords
+ */
+
+#ifndef BLINK_MARINE_CAN_OPEN_TX_QUEUE
+#define BLINK_MARINE_CAN_OPEN_TX_QUEUE
+
+#include "BlinkMarinePkpCanOpen.h"
+
+#ifndef PKP_TX_QUEUE_SIZE
+#define PKP_TX_QUEUE_SIZE 16
+#endif
+
+class PkpTxQueue {
+  public:
+    // ------ Public Functions ------
+    PkpTxQueue(CanMsgTxCallback callback, uint8_t framesPerMs = 0);
+    void    attachBusLoad(PkpBusLoad* meter);
+    uint8_t getPending();
+    uint8_t poll();
+    bool    push(const struct can_frame& txMsg);
+    void    setBudget(uint8_t framesPerMs);
+
+  private:
+    // ------ Private Constants ------
+    static constexpr uint16_t CAN_TX_BASE_ID_SDO = 0x600;
+
+    // ------ Private Variables ------
+    uint8_t          _budget     = 0;
+    PkpBusLoad*      _busLoad    = nullptr;
+    uint8_t          _count      = 0;
+    struct can_frame _frames[PKP_TX_QUEUE_SIZE];
+    uint32_t         _lastRefill = 0;
+    uint8_t          _tokens     = 0;
+    CanMsgTxCallback _transmitMessage;
+
+    // ------ Private Functions ------
+    static uint8_t _getNode(const struct can_frame& frame);
+    bool           _isSameTarget(const struct can_frame& a, const struct can_frame& b);
+};
+
+#endif // BLINK_MARINE_CAN_OPEN_TX_QUEUE